@@ -1,38 +1,92 @@
 #pragma once
 #include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <mutex>
+#include <vector>
 namespace memoryPool {
 #define MEMORY_POOL_NUM 64
 #define SLOT_BASE_SIZE 8
 #define MAX_SLOT_SIZE 512
+// 每个线程每种槽大小缓存的槽数上限
+#define MAGAZINE_SIZE 64
 struct Slot {
   std::atomic<Slot*> next;
 };
 
+// 位于每个内存块的起始处 内存块按块大小对齐, 由槽地址取整即可找到
+struct BlockHeader {
+  size_t capacity;           // 块内槽数
+  size_t trimCount;          // 回收时统计的空闲槽数 仅在持锁时访问
+  std::atomic<size_t> live;  // 不在空闲链表中的槽数 线程弹匣中的槽也计入
+};
+
 class MemoryPool {
  public:
+  // BlockSize为最小内存块大小 须为2的幂
   MemoryPool(size_t BlockSize = 4096);
   ~MemoryPool();
   void init(size_t);
   void* allocate();
   void deallocate(void*);
+  // 批量取出n个槽组成链表返回 空闲链表不足时在一次加锁内切分新槽
+  Slot* allocateBatch(size_t n);
+  // 将first到last组成的链表一次归还
+  void deallocateBatch(Slot* first, Slot* last);
+  // 将槽全部空闲的内存块归还系统 返回归还的块数
+  size_t trim();
+  // 当前已归还系统、等待复用的内存块数
+  size_t getReclaimedBlocks();
 
  private:
+  // 每个内存块至少容纳的槽数
+  static const size_t SLOTS_PER_BLOCK = 64;
+  // 每次向系统申请的内存大小 再切分为内存块
+  static const size_t CHUNK_SIZE = 1024 * 1024;
+  // 累计多少个内存块变为全空后执行一次回收
+  static const size_t RECLAIM_BATCH = 4;
+
   void allocateNewBlock();
   size_t padPointer(char* p, size_t align);
+  BlockHeader* blockOf(Slot* slot) const {
+    return reinterpret_cast<BlockHeader*>(reinterpret_cast<uintptr_t>(slot) &
+                                          ~(uintptr_t(BlockSize_) - 1));
+  }
+  // 槽离开或进入空闲链表时维护所在块的在用计数
+  void markAllocated(Slot* slot);
+  void markFreed(Slot* slot);
 
   // 使用CAS操作进行无锁入队和出队
+  // 链表头为标记指针: 低48位为地址, 高16位为版本号
+  // 每次出队递增版本号 槽被其他线程取走又放回时CAS失败, 避免ABA
+  static const int TAG_SHIFT = 48;
+  static const uint64_t PTR_MASK = (uint64_t(1) << TAG_SHIFT) - 1;
+  static Slot* untag(uint64_t head) {
+    return reinterpret_cast<Slot*>(head & PTR_MASK);
+  }
+  static uint64_t makeTagged(Slot* slot, uint64_t head, uint64_t delta) {
+    return ((head & ~PTR_MASK) + (delta << TAG_SHIFT)) |
+           reinterpret_cast<uint64_t>(slot);
+  }
   bool pushFreeList(Slot* slot);
+  bool pushFreeList(Slot* first, Slot* last);
   Slot* popFreeList();
+  // 取走整条空闲链表
+  Slot* takeFreeList();
 
  private:
+  size_t MinBlockSize_;
   size_t BlockSize_;
   size_t SlotSize_;
-  Slot* firstBlock_;
   Slot* curSlot_;
-  std::atomic<Slot*> freeList_;
+  std::atomic<uint64_t> freeList_;
   Slot* lastSlot_;
+  // 以下成员均受mutexForBlock_保护
+  char* chunkCur_;  // 当前chunk中尚未切分的部分
+  char* chunkEnd_;
+  std::vector<void*> chunks_;
+  std::vector<BlockHeader*> emptyBlocks_;  // 已归还系统 可重新使用的块
+  std::atomic<size_t> pendingReclaims_;
   std::mutex mutexForBlock_;  // 避免多线程下重复开辟内存
 };
 class HashBucket {
@@ -46,7 +100,7 @@ class HashBucket {
   static void* useMemory(size_t size) {
     if (size <= 0) return nullptr;
     if (size > MAX_SLOT_SIZE) return operator new(size);
-    return getMemortPool((size + 7) / SLOT_BASE_SIZE - 1).allocate();
+    return allocateSlot((size + 7) / SLOT_BASE_SIZE - 1);
   }
   static void freeMemory(void* ptr, size_t size) {
     if (!ptr) return;
@@ -54,9 +108,16 @@ class HashBucket {
       operator delete(ptr);
       return;
     }
-    getMemortPool((size + 7) / SLOT_BASE_SIZE - 1).deallocate(ptr);
+    freeSlot(ptr, (size + 7) / SLOT_BASE_SIZE - 1);
   }
 
+ private:
+  // 经由线程本地弹匣分配和释放 弹匣命中时不需要原子操作
+  static void* allocateSlot(size_t index);
+  static void freeSlot(void* ptr, size_t index);
+
+ public:
+
   template <typename T, typename... Args>
   friend T* newElement(Args&&... args);
 
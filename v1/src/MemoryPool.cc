@@ -1,37 +1,60 @@
 #include "../include/MemoryPool.h"
 
 #include <assert.h>
+#include <sys/mman.h>
+
+#include <new>
 namespace memoryPool {
 MemoryPool::MemoryPool(size_t BlockSize)
-    : BlockSize_(BlockSize),
+    : MinBlockSize_(BlockSize),
+      BlockSize_(BlockSize),
       SlotSize_(0),
-      firstBlock_(nullptr),
       curSlot_(nullptr),
-      freeList_(nullptr),
-      lastSlot_(nullptr) {}
+      freeList_(0),
+      lastSlot_(nullptr),
+      chunkCur_(nullptr),
+      chunkEnd_(nullptr),
+      pendingReclaims_(0) {}
 MemoryPool::~MemoryPool() {
-  Slot *cur = firstBlock_;
-  while (cur) {
-    Slot *nex = cur->next;
-    operator delete(reinterpret_cast<void *>(cur));
-    cur = nex;
+  for (void *chunk : chunks_) {
+    munmap(chunk, CHUNK_SIZE);
   }
 }
 
 void MemoryPool::init(size_t size) {
   assert(size > 0);
+  assert((MinBlockSize_ & (MinBlockSize_ - 1)) == 0);
   SlotSize_ = size;
-  firstBlock_ = nullptr;
+  // 块大小随槽大小增长 每块约容纳SLOTS_PER_BLOCK个槽
+  BlockSize_ = MinBlockSize_;
+  while (BlockSize_ < SlotSize_ * SLOTS_PER_BLOCK) {
+    BlockSize_ *= 2;
+  }
+  assert(BlockSize_ <= CHUNK_SIZE);
   curSlot_ = nullptr;
-  freeList_.store(nullptr, std::memory_order_relaxed);
+  freeList_.store(0, std::memory_order_relaxed);
   lastSlot_ = nullptr;
 }
 
-bool MemoryPool::pushFreeList(Slot *slot) {
+void MemoryPool::markAllocated(Slot *slot) {
+  blockOf(slot)->live.fetch_add(1, std::memory_order_relaxed);
+}
+
+void MemoryPool::markFreed(Slot *slot) {
+  if (blockOf(slot)->live.fetch_sub(1, std::memory_order_relaxed) == 1) {
+    pendingReclaims_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+bool MemoryPool::pushFreeList(Slot *slot) { return pushFreeList(slot, slot); }
+
+bool MemoryPool::pushFreeList(Slot *first, Slot *last) {
+  uint64_t oldHead = freeList_.load(std::memory_order_relaxed);
   while (true) {
-    Slot *OldHead = freeList_.load(std::memory_order_relaxed);
-    slot->next.store(OldHead, std::memory_order_relaxed);
-    if (freeList_.compare_exchange_weak(OldHead, slot,
+    last->next.store(untag(oldHead), std::memory_order_relaxed);
+    // 入队不改变版本号 与出队竞争时由出队一方的版本号检测冲突
+    uint64_t newTagged = makeTagged(first, oldHead, 0);
+    if (freeList_.compare_exchange_weak(oldHead, newTagged,
                                         std::memory_order_release,
                                         std::memory_order_relaxed)) {
       return true;
@@ -40,18 +63,36 @@ bool MemoryPool::pushFreeList(Slot *slot) {
 }
 
 Slot *MemoryPool::popFreeList() {
+  uint64_t oldHead = freeList_.load(std::memory_order_acquire);
   while (true) {
-    Slot *OldHead = freeList_.load(std::memory_order_relaxed);
-    if (OldHead == nullptr) {
+    Slot *slot = untag(oldHead);
+    if (slot == nullptr) {
       return nullptr;
     }
-    Slot *newHead = OldHead->next.load(std::memory_order_relaxed);
-    if (freeList_.compare_exchange_weak(OldHead, newHead,
+    // slot可能已被其他线程取走甚至所在块已被回收 读到的next此时已过期,
+    // 但版本号变化会使CAS失败 回收只释放物理页不解除映射, 读取总是安全的
+    Slot *newHead = slot->next.load(std::memory_order_relaxed);
+    uint64_t newTagged = makeTagged(newHead, oldHead, 1);
+    if (freeList_.compare_exchange_weak(oldHead, newTagged,
                                         std::memory_order_acquire,
-                                        std::memory_order_relaxed)) {
-      return OldHead;
+                                        std::memory_order_acquire)) {
+      markAllocated(slot);
+      return slot;
+    }
+  }
+}
+
+Slot *MemoryPool::takeFreeList() {
+  uint64_t oldHead = freeList_.load(std::memory_order_acquire);
+  while (untag(oldHead) != nullptr) {
+    uint64_t newTagged = makeTagged(nullptr, oldHead, 1);
+    if (freeList_.compare_exchange_weak(oldHead, newTagged,
+                                        std::memory_order_acquire,
+                                        std::memory_order_acquire)) {
+      return untag(oldHead);
     }
   }
+  return nullptr;
 }
 
 void *MemoryPool::allocate() {
@@ -67,27 +108,144 @@ void *MemoryPool::allocate() {
   Slot *result = curSlot_;
   curSlot_ =
       reinterpret_cast<Slot *>(reinterpret_cast<char *>(curSlot_) + SlotSize_);
+  markAllocated(result);
   return result;
 }
 
+Slot *MemoryPool::allocateBatch(size_t n) {
+  Slot *head = nullptr;
+  size_t count = 0;
+  for (; count < n; count++) {
+    Slot *slot = popFreeList();
+    if (slot == nullptr) break;
+    slot->next.store(head, std::memory_order_relaxed);
+    head = slot;
+  }
+  if (count == n) return head;
+
+  // 剩余的槽在一次加锁内从内存块切分
+  std::lock_guard<std::mutex> lock(mutexForBlock_);
+  for (; count < n; count++) {
+    if (curSlot_ >= lastSlot_) {
+      allocateNewBlock();
+    }
+    Slot *slot = curSlot_;
+    curSlot_ = reinterpret_cast<Slot *>(reinterpret_cast<char *>(curSlot_) +
+                                        SlotSize_);
+    markAllocated(slot);
+    slot->next.store(head, std::memory_order_relaxed);
+    head = slot;
+  }
+  return head;
+}
+
+void MemoryPool::deallocateBatch(Slot *first, Slot *last) {
+  if (!first) return;
+  for (Slot *slot = first;; slot = slot->next.load(std::memory_order_relaxed)) {
+    markFreed(slot);
+    if (slot == last) break;
+  }
+  pushFreeList(first, last);
+  if (pendingReclaims_.load(std::memory_order_relaxed) >= RECLAIM_BATCH) {
+    trim();
+  }
+}
+
 void MemoryPool::deallocate(void *ptr) {
   if (!ptr) return;
   Slot *slot = static_cast<Slot *>(ptr);
+  markFreed(slot);
   pushFreeList(slot);
+  if (pendingReclaims_.load(std::memory_order_relaxed) >= RECLAIM_BATCH) {
+    trim();
+  }
+}
+
+size_t MemoryPool::trim() {
+  std::lock_guard<std::mutex> lock(mutexForBlock_);
+  pendingReclaims_.store(0, std::memory_order_relaxed);
+  // 独占整条空闲链表 统计每个块有多少空闲槽
+  Slot *head = takeFreeList();
+  for (Slot *slot = head; slot;
+       slot = slot->next.load(std::memory_order_relaxed)) {
+    blockOf(slot)->trimCount++;
+  }
+  // 空闲槽数等于容量的块全部空闲 其余的槽重新放回空闲链表
+  // 正在切分的块未切分完, 空闲槽数不会达到容量
+  Slot *keepHead = nullptr;
+  Slot *keepTail = nullptr;
+  std::vector<BlockHeader *> reclaimed;
+  for (Slot *slot = head; slot;) {
+    Slot *next = slot->next.load(std::memory_order_relaxed);
+    BlockHeader *block = blockOf(slot);
+    if (block->capacity == 0) {
+      // 所在块已决定回收
+    } else if (block->trimCount == block->capacity) {
+      reclaimed.push_back(block);
+      block->capacity = 0;  // 标记已回收 同一块的其他槽直接跳过
+    } else {
+      if (keepTail) {
+        keepTail->next.store(slot, std::memory_order_relaxed);
+      } else {
+        keepHead = slot;
+      }
+      keepTail = slot;
+    }
+    slot = next;
+  }
+  for (Slot *slot = keepHead; slot;
+       slot = slot == keepTail ? nullptr
+                               : slot->next.load(std::memory_order_relaxed)) {
+    blockOf(slot)->trimCount = 0;
+  }
+  if (keepHead) pushFreeList(keepHead, keepTail);
+
+  // 释放物理页但保留映射 并发出队读到已回收块中的旧槽时不会出错
+  for (BlockHeader *block : reclaimed) {
+    madvise(block, BlockSize_, MADV_DONTNEED);
+    emptyBlocks_.push_back(block);
+  }
+  return reclaimed.size();
+}
+
+size_t MemoryPool::getReclaimedBlocks() {
+  std::lock_guard<std::mutex> lock(mutexForBlock_);
+  return emptyBlocks_.size();
 }
 
 void MemoryPool::allocateNewBlock() {
-  void *newBlock = operator new(BlockSize_);
-  reinterpret_cast<Slot *>(newBlock)->next = firstBlock_;
-  firstBlock_ = reinterpret_cast<Slot *>(newBlock);
+  // 优先复用已回收的块 其次从当前chunk切分, 都没有时向系统申请新的chunk
+  // 不能改动空闲链表 其中的槽仍然有效
+  char *newBlock;
+  if (!emptyBlocks_.empty()) {
+    newBlock = reinterpret_cast<char *>(emptyBlocks_.back());
+    emptyBlocks_.pop_back();
+  } else {
+    if (chunkCur_ == chunkEnd_) {
+      void *chunk = mmap(nullptr, CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (chunk == MAP_FAILED) throw std::bad_alloc();
+      chunks_.push_back(chunk);
+      // mmap返回页对齐的地址 按块大小对齐后丢弃chunk尾部不足一块的部分
+      chunkCur_ = reinterpret_cast<char *>(chunk) +
+                  padPointer(reinterpret_cast<char *>(chunk), BlockSize_);
+      chunkEnd_ = chunkCur_ +
+                  (reinterpret_cast<char *>(chunk) + CHUNK_SIZE - chunkCur_) /
+                      BlockSize_ * BlockSize_;
+    }
+    newBlock = chunkCur_;
+    chunkCur_ += BlockSize_;
+  }
 
-  char *body = reinterpret_cast<char *>(newBlock) + sizeof(Slot);
+  char *body = newBlock + sizeof(BlockHeader);
   size_t paddingSize = padPointer(body, SlotSize_);
   curSlot_ = reinterpret_cast<Slot *>(body + paddingSize);
 
   lastSlot_ = reinterpret_cast<Slot *>(reinterpret_cast<size_t>(newBlock) +
                                        BlockSize_ - SlotSize_ + 1);
-  freeList_ = nullptr;
+  BlockHeader *header = new (newBlock) BlockHeader();
+  header->capacity =
+      (BlockSize_ - sizeof(BlockHeader) - paddingSize) / SlotSize_;
 }
 
 size_t MemoryPool::padPointer(char *p, size_t align) {
@@ -104,4 +262,65 @@ MemoryPool &HashBucket::getMemortPool(size_t index) {
   return memoryPool[index];
 }
 
+namespace {
+// 线程本地的槽缓存 每种槽大小一个
+struct Magazine {
+  Slot *head;
+  size_t count;
+};
+
+struct ThreadMagazines {
+  Magazine magazines[MEMORY_POOL_NUM];
+
+  // 线程退出时把缓存的槽归还给对应的内存池
+  ~ThreadMagazines() {
+    for (size_t i = 0; i < MEMORY_POOL_NUM; i++) {
+      Magazine &mag = magazines[i];
+      if (mag.count == 0) continue;
+      Slot *last = mag.head;
+      while (last->next.load(std::memory_order_relaxed)) {
+        last = last->next.load(std::memory_order_relaxed);
+      }
+      HashBucket::getMemortPool(i).deallocateBatch(mag.head, last);
+      mag.head = nullptr;
+      mag.count = 0;
+    }
+  }
+};
+
+thread_local ThreadMagazines threadMagazines;
+}  // namespace
+
+void *HashBucket::allocateSlot(size_t index) {
+  Magazine &mag = threadMagazines.magazines[index];
+  if (mag.count == 0) {
+    // 弹匣为空 一次补充半个弹匣
+    mag.head = getMemortPool(index).allocateBatch(MAGAZINE_SIZE / 2);
+    mag.count = MAGAZINE_SIZE / 2;
+  }
+  Slot *slot = mag.head;
+  mag.head = slot->next.load(std::memory_order_relaxed);
+  mag.count--;
+  return slot;
+}
+
+void HashBucket::freeSlot(void *ptr, size_t index) {
+  Magazine &mag = threadMagazines.magazines[index];
+  if (mag.count == MAGAZINE_SIZE) {
+    // 弹匣已满 将前一半作为一条链表归还内存池
+    Slot *first = mag.head;
+    Slot *last = first;
+    for (size_t i = 1; i < MAGAZINE_SIZE / 2; i++) {
+      last = last->next.load(std::memory_order_relaxed);
+    }
+    mag.head = last->next.load(std::memory_order_relaxed);
+    mag.count -= MAGAZINE_SIZE / 2;
+    getMemortPool(index).deallocateBatch(first, last);
+  }
+  Slot *slot = static_cast<Slot *>(ptr);
+  slot->next.store(mag.head, std::memory_order_relaxed);
+  mag.head = slot;
+  mag.count++;
+}
+
 }  // namespace memoryPool
\ No newline at end of file
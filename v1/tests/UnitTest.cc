@@ -1,4 +1,7 @@
+#include <assert.h>
+
 #include <iostream>
+#include <set>
 #include <thread>
 #include <vector>
 
@@ -88,8 +91,81 @@ void BenchmarkNew(size_t ntimes, size_t nworks, size_t rounds) {
       nworks, rounds, ntimes, total_costtime);
 }
 
+// 每个线程分配后交给下一个线程释放 检查槽不会被重复分配
+void TestCrossThreadFree(size_t ntimes, size_t nworks) {
+  std::vector<std::vector<P2*>> handoff(nworks);
+  std::vector<std::thread> vthread(nworks);
+  for (size_t k = 0; k < nworks; ++k) {
+    vthread[k] = std::thread([&, k]() {
+      for (size_t i = 0; i < ntimes; i++) {
+        handoff[k].push_back(newElement<P2>());
+      }
+    });
+  }
+  for (auto& t : vthread) {
+    t.join();
+  }
+  std::set<P2*> unique;
+  for (auto& ptrs : handoff) {
+    unique.insert(ptrs.begin(), ptrs.end());
+  }
+  assert(unique.size() == ntimes * nworks);
+
+  for (size_t k = 0; k < nworks; ++k) {
+    vthread[k] = std::thread([&, k]() {
+      std::vector<P2*>& ptrs = handoff[(k + 1) % nworks];
+      for (P2* p : ptrs) {
+        deleteElement<P2>(p);
+      }
+      // 并发地从空闲链表取回 仍不能出现重复
+      for (size_t i = 0; i < ntimes; i++) {
+        ptrs[i] = newElement<P2>();
+      }
+    });
+  }
+  for (auto& t : vthread) {
+    t.join();
+  }
+  unique.clear();
+  for (auto& ptrs : handoff) {
+    unique.insert(ptrs.begin(), ptrs.end());
+    for (P2* p : ptrs) {
+      deleteElement<P2>(p);
+    }
+  }
+  assert(unique.size() == ntimes * nworks);
+  printf("%lu个线程交叉释放%lu次，检查通过\n", nworks, ntimes);
+}
+
+// 全部释放后空闲的内存块应能归还系统 之后仍可正常分配
+void TestReclaim(size_t ntimes) {
+  MemoryPool& pool = HashBucket::getMemortPool((sizeof(P3) + 7) / 8 - 1);
+  std::vector<P3*> ptrs;
+  for (size_t i = 0; i < ntimes; i++) {
+    ptrs.push_back(newElement<P3>());
+  }
+  for (P3* p : ptrs) {
+    deleteElement<P3>(p);
+  }
+  // 释放过程中已自动回收一部分 trim回收剩余的全空块
+  pool.trim();
+  size_t reclaimed = pool.getReclaimedBlocks();
+  assert(reclaimed > 0);
+  for (size_t i = 0; i < ntimes; i++) {
+    ptrs[i] = newElement<P3>();
+  }
+  // 重新分配时优先复用已回收的块
+  assert(pool.getReclaimedBlocks() < reclaimed);
+  for (P3* p : ptrs) {
+    deleteElement<P3>(p);
+  }
+  printf("释放%lu个对象后归还%lu个内存块\n", ntimes, reclaimed);
+}
+
 int main() {
   HashBucket::initMemoryPool();     // 使用内存池接口前一定要先调用该函数
+  TestCrossThreadFree(10000, 4);
+  TestReclaim(100000);
   BenchmarkMemoryPool(100, 1, 10);  // 测试内存池
   std::cout << "==============================================================="
                "============"
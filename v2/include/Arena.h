@@ -0,0 +1,59 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "common.h"
+
+namespace memory_pool {
+// 单调增长的区域分配器: 从页缓存取span做指针碰撞分配, 不支持单个释放
+// reset()或析构时一次性归还全部span 适合生命周期一致的大量小对象
+class Arena {
+ public:
+  static constexpr size_t DEFAULT_SPAN_PAGES = 16;  // 64KB
+
+  explicit Arena(size_t spanPages = DEFAULT_SPAN_PAGES);
+  ~Arena();
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  // align须为2的幂
+  void* allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+    // 0字节按1字节分配 否则新建或reset后的空区域会返回nullptr
+    if (size == 0) size = 1;
+    uintptr_t current = reinterpret_cast<uintptr_t>(current_);
+    uintptr_t aligned = (current + align - 1) & ~(uintptr_t(align) - 1);
+    uintptr_t end = reinterpret_cast<uintptr_t>(end_);
+    // 用减法比较 超大的size不会使加法回绕
+    if (aligned <= end && size <= end - aligned) {
+      current_ = reinterpret_cast<char*>(aligned + size);
+      bytesAllocated_ += size;
+      return reinterpret_cast<void*>(aligned);
+    }
+    return allocateSlow(size, align);
+  }
+
+  // 归还全部span 之前分配的内存全部失效
+  void reset();
+
+  size_t getBytesAllocated() const { return bytesAllocated_; }
+  size_t getBytesReserved() const { return bytesReserved_; }
+
+ private:
+  // 位于每个span的起始处
+  struct SpanHeader {
+    SpanHeader* next;
+    size_t numPages;
+  };
+
+  void* allocateSlow(size_t size, size_t align);
+
+ private:
+  size_t spanPages_;
+  SpanHeader* spans_;
+  char* current_;
+  char* end_;
+  size_t bytesAllocated_;
+  size_t bytesReserved_;
+};
+
+}  // namespace memory_pool
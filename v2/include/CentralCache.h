@@ -1,6 +1,7 @@
 #pragma once
 #include <mutex>
 
+#include "PageCache.h"
 #include "common.h"
 
 namespace memory_pool {
@@ -10,19 +11,41 @@ struct SpanTracker {
   std::atomic<size_t> numPages{0};
   std::atomic<size_t> blockCount{0};
   std::atomic<size_t> freeCount{0};
+  size_t scanCount{0};  // 延迟归还时的临时计数 持有对应大小类的锁时访问
 };
 
 class CentralCache {
  public:
   static CentralCache& getInstance() {
-    static CentralCache instance;
+    static CentralCache instance(PageCache::getInstance());
     return instance;
   }
   void* fetchRange(size_t index);
+  // 批量获取恰好batchNum个块 内存不足时返回nullptr
   void* fetchRange(size_t index, size_t batchNum);
   void returnRange(void* statr, size_t size, size_t index);
+  // 中心缓存中某个大小类的空闲块数 需遍历链表, 仅用于统计
+  size_t getFreeBlockCount(size_t index);
+  // 预先切分至少count个块放入中心缓存 返回实际增加的块数, 内存不足时可能少于count
+  size_t reserve(size_t index, size_t count);
+  // 对每个大小类立即执行一次延迟归还 全部块都空闲的span归还页缓存
+  void releaseFreeSpans();
+  // 持有该大小类的锁 对中心缓存中的每个空闲块调用visit, visit中不能分配内存
+  template <typename Visit>
+  void forEachFreeBlock(size_t index, Visit visit) {
+    if (index >= FREE_LIST_SIZE) return;
+    uint64_t lockedAt = lock(index);
+    for (void* p = centralFreeList_[index].load(std::memory_order_relaxed); p;
+         p = *reinterpret_cast<void**>(p)) {
+      visit(p);
+    }
+    unlock(index, lockedAt);
+  }
 
  private:
+  // span来源的页缓存
+  PageCache& pageCache_;
+
   // 中心缓存的自由链表
   std::array<std::atomic<void*>, FREE_LIST_SIZE> centralFreeList_;
 
@@ -30,7 +53,8 @@ class CentralCache {
   std::array<std::atomic_flag, FREE_LIST_SIZE> locks_;
 
   // 使用数组存储span信息，避免map的开销
-  std::array<SpanTracker, 1024> spanTrackers_;
+  static const size_t MAX_SPAN_TRACKERS = 1024;
+  std::array<SpanTracker, MAX_SPAN_TRACKERS> spanTrackers_;
   std::atomic<size_t> spanCount_{0};
 
   // 延迟归还相关的成员变量
@@ -47,11 +71,26 @@ class CentralCache {
   void performDelayedReturn(size_t index);
 
  private:
-  CentralCache();
+  friend class Heap;
+  friend class ForkHandler;
+
+  explicit CentralCache(PageCache& pageCache);
+  // 加解锁locks_[index] 开启锁分析时记录等待与持有时间
+  uint64_t lock(size_t index);
+  void unlock(size_t index, uint64_t lockedAt);
+  // fork前按下标顺序取得全部大小类的锁 fork后全部释放, 不计入锁分析
+  void prepareFork();
+  void afterFork();
   // 从页缓存获取内存
   void* fetchFromPageCache(size_t size);
+  // 切分为size大小的块的span的页数
+  static size_t spanPages(size_t size);
+  // 从页缓存获取span并切分到中心缓存链表
+  void* refillFromPageCache(size_t index);
   // 获取span信息
   SpanTracker* getSpanTracker(void* blockAddr);
+  SpanTracker* claimSpanTracker(size_t numPages);
+  bool spanContains(SpanTracker* tracker, void* blockAddr);
   // 更新span的空闲计数并检查是否可以归还
   void updateSpanFreeCount(SpanTracker* tracker, size_t newFreeBlocks,
                            size_t index);
@@ -0,0 +1,24 @@
+#pragma once
+
+namespace memory_pool {
+// fork安全: 静态初始化时通过pthread_atfork登记
+// prepare按固定顺序取得内存池的全部锁, 保证fork时没有锁被其他线程持有
+// parent与child按相反顺序释放这些锁
+// 子进程中只有调用fork的线程存活, child把其他线程的线程缓存归还中心缓存
+//
+// 加锁顺序(先外后内), 与正常路径上的嵌套加锁一致:
+//   GuardedPool -> Heap登记表与各个堆 -> HeapProfiler -> LockProfiler
+//   -> TraceRecorder -> StatsRegistry -> 中心缓存(按下标) -> 页缓存
+//   -> 元数据分配器
+class ForkHandler {
+ public:
+  static void prepare();
+  static void parent();
+  static void child();
+
+ private:
+  // 父子进程共用的部分 释放StatsRegistry及之后的锁
+  static void unlockPool();
+};
+
+}  // namespace memory_pool
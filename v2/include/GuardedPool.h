@@ -0,0 +1,57 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace memory_pool {
+// 采样的保护页分配 类似GWP-ASan, 默认关闭
+// 平均每sampleRate次分配有一次放到单独的页上, 右端紧贴PROT_NONE的保护页
+// 释放后整页不可访问, 并按先进先出尽量晚地复用
+// 越界或释放后使用触发SIGSEGV时, 输出错误类型与分配、释放时的调用栈
+class GuardedPool {
+ public:
+  static constexpr size_t DEFAULT_SAMPLE_RATE = 5000;
+  static constexpr size_t DEFAULT_SLOTS = 64;
+  // 未开启时线程每分配这么多次才再次检查是否已开启
+  static constexpr size_t DISABLED_RECHECK_COUNT = 1 << 20;
+  static constexpr int MAX_DEPTH = 16;
+  // 可放入槽位的最大字节数
+  static constexpr size_t MAX_SIZE = 4096;
+
+  // 第一次开启时保留slots个槽位的地址空间并安装SIGSEGV/SIGBUS处理函数
+  // 之后再调用只修改采样率 失败返回false
+  // 调用线程立即生效 其他线程最多再分配DISABLED_RECHECK_COUNT次后生效
+  static bool enable(size_t sampleRate = DEFAULT_SAMPLE_RATE,
+                     size_t slots = DEFAULT_SLOTS);
+  // 停止新的采样 已分配的槽位仍然受保护
+  static void disable();
+  static bool isEnabled() {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+  // ptr是否位于保护区域内 未开启过时恒为false
+  static bool contains(const void* ptr) {
+    return reinterpret_cast<uintptr_t>(ptr) -
+               regionBegin_.load(std::memory_order_relaxed) <
+           regionSize_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  friend class ThreadCache;
+  friend class ForkHandler;
+
+  // 距下一次采样还需经过的分配次数 均值为sampleRate - 1
+  static size_t nextSampleCountdown();
+  // 没有空闲槽位时返回nullptr
+  static void* allocate(size_t size);
+  // 重复释放或释放的不是槽位起始地址时输出报告并abort
+  static void deallocate(void* ptr);
+  // fork前取得槽位表的锁 fork后在父子进程中释放
+  static void prepareFork();
+  static void afterFork();
+
+  static inline std::atomic<bool> enabled_{false};
+  static inline std::atomic<uintptr_t> regionBegin_{0};
+  static inline std::atomic<size_t> regionSize_{0};
+};
+
+}  // namespace memory_pool
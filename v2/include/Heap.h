@@ -0,0 +1,81 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#include "common.h"
+
+namespace memory_pool {
+class CentralCache;
+class PageCache;
+class ThreadCache;
+struct HeapCacheTable;
+
+struct HeapStats {
+  size_t allocCount;      // 累计分配次数
+  size_t freeCount;       // 累计释放次数
+  size_t allocatedBytes;  // 按块大小累计的分配字节数
+  size_t freedBytes;      // 按块大小累计的释放字节数
+  size_t liveBytes;       // 仍在使用的字节数
+  size_t mappedBytes;     // 向系统申请的字节数
+  size_t memoryLimit;     // 内存上限 0表示不限制
+  size_t threadCaches;    // 为该堆创建过的线程缓存数
+};
+
+// 独立的堆: 拥有自己的中心缓存与页缓存, 每个线程为其创建单独的线程缓存
+// 不同子系统使用不同的堆可互相隔离 destroy()一次性归还堆拥有的全部内存
+// 从某个堆分配的内存只能释放回该堆
+class Heap {
+ public:
+  explicit Heap(size_t memoryLimit = 0);
+  ~Heap();
+  Heap(const Heap&) = delete;
+  Heap& operator=(const Heap&) = delete;
+
+  void* allocate(size_t size);
+  void deallocate(void* ptr, size_t size);
+  // 不带大小的释放 由页映射查询块大小
+  void deallocate(void* ptr);
+
+  // 与MemoryPool::reserve相同 预留的内存计入本堆的上限
+  bool reserve(size_t size, size_t count, bool fillThreadCache = false);
+
+  // 超过上限后分配返回nullptr
+  void setMemoryLimit(size_t bytes);
+  HeapStats getStats();
+
+  // 释放堆拥有的全部内存 之后该堆分配的指针全部失效, 堆也不能再使用
+  // 调用时其他线程不能再访问该堆
+  void destroy();
+
+ private:
+  friend struct HeapCacheTable;
+  friend class ForkHandler;
+  struct LocalCache;
+
+  LocalCache* getLocalCache();
+  LocalCache* attachLocalCache();
+  LocalCache* acquireLocalCache();
+  // 线程退出或缓存表替换时归还线程缓存 堆已销毁时忽略
+  static void releaseLocalCache(uint64_t heapId, LocalCache* cache);
+  // fork前依次取得登记表与每个堆的锁 fork后在父子进程中释放
+  // 子进程中其他线程的线程缓存归还各堆的中心缓存, 并放入可复用链表
+  static void prepareFork();
+  static void afterFork();
+  static void childAfterFork();
+  // local是否在可复用链表中 需持有mutex_
+  bool isFreeCache(const LocalCache* local) const;
+
+ private:
+  uint64_t id_;
+  PageCache* pageCache_;
+  CentralCache* central_;
+  std::mutex mutex_;
+  LocalCache* caches_;      // 所有线程缓存
+  LocalCache* freeCaches_;  // 已退出线程留下的可复用线程缓存
+  size_t cacheCount_;
+  Heap* nextLive_;
+};
+
+}  // namespace memory_pool
@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+
+namespace memory_pool {
+// 采样式堆分析器 默认关闭
+// 每个线程按字节倒计数, 平均每分配sampleInterval字节采样一次并记录调用栈
+// 采样的分配单独占用span, 释放时据此识别并移出记录
+// 输出gperftools heap_v2文本格式, 可直接用pprof分析:
+//   pprof --text ./app app.heap
+class HeapProfiler {
+ public:
+  static constexpr size_t DEFAULT_SAMPLE_INTERVAL = 512 * 1024;
+  // 未开启时的倒计数 线程分配这么多字节后才会再次检查是否已开启
+  static constexpr size_t DISABLED_RECHECK_BYTES = 16 * 1024 * 1024;
+  static constexpr int MAX_DEPTH = 24;
+
+  // 调用线程立即开始采样 其他线程最多再分配DISABLED_RECHECK_BYTES字节后开始
+  static void start(size_t sampleInterval = DEFAULT_SAMPLE_INTERVAL);
+  // 停止采样 已记录的分配仍在释放时移出记录
+  static void stop();
+  static bool isEnabled() {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  // 写出当前的在用与累计分配 成功返回true
+  static bool dump(const char* path);
+  static bool dump(int fd);
+  // 收到signum后在下一次采样时写出到 pathPrefix.<pid>.<序号>.heap
+  static bool dumpOnSignal(int signum, const char* pathPrefix);
+
+ private:
+  friend class ThreadCache;
+  friend class ForkHandler;
+
+  // 开启中或仍有未释放的采样 释放时才需要检查
+  static bool isTracking() {
+    return tracking_.load(std::memory_order_relaxed);
+  }
+  // 已开启且当前线程不在分析器内部
+  static bool shouldSample();
+  // 下一次采样前要分配的字节数 服从指数分布
+  static size_t nextSampleDistance();
+  static void recordAlloc(void* ptr, size_t size);
+  static void recordFree(void* ptr);
+  static void pollDumpRequest();
+  // fork前取得采样表的锁 fork后在父子进程中释放
+  static void prepareFork();
+  static void afterFork();
+
+  static inline std::atomic<bool> enabled_{false};
+  static inline std::atomic<bool> tracking_{false};
+};
+
+}  // namespace memory_pool
@@ -0,0 +1,60 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "common.h"
+
+namespace memory_pool {
+// 堆遍历中一个span的快照
+struct SpanInfo {
+  uintptr_t address;
+  size_t numPages;
+  size_t objSize;        // 切分的块大小 0表示空闲span或整块使用的大块
+  size_t blockCount;     // 块数 整块使用的span为1, 空闲span为0
+  size_t freeBlocks;     // 中心缓存与当前线程缓存中的空闲块
+  size_t liveBlocks;     // 其余的块 包括其他线程缓存中的空闲块
+  size_t residentPages;  // 占用物理内存的页数
+  bool free;             // 在页缓存的空闲链表中
+  bool released;         // 物理页已全部归还系统
+  bool sampled;          // 堆分析器采样的分配
+};
+
+// 一个大小类的碎片情况
+struct SizeClassFragmentation {
+  size_t size;          // 块大小
+  size_t spans;         // 切分给该大小类的span数
+  size_t spanBytes;     // 这些span的总字节数
+  size_t blocks;        // 总块数
+  size_t liveBlocks;    // 在用块数
+  size_t tailBytes;     // span尾部不足一块而无法使用的字节
+  size_t freeBytes;     // 已切分但空闲的块的字节
+  size_t partialSpans;  // 部分在用的span数
+  size_t emptySpans;    // 块全部空闲的span数
+};
+
+struct HeapReport {
+  // 使用率直方图的桶数 第i桶为在用块占[i/10, (i+1)/10)的span, 最后一桶为全满
+  static constexpr size_t UTILIZATION_BUCKETS = 11;
+
+  std::vector<SpanInfo> spans;  // 按地址排序
+  std::vector<SizeClassFragmentation> sizeClasses;
+  // 切分为小块的span按使用率的分布
+  std::array<size_t, UTILIZATION_BUCKETS> utilization;
+  // 页缓存空闲span的外部碎片
+  size_t freeSpans;
+  size_t freeSpanBytes;
+  size_t largestFreeSpanBytes;
+  size_t releasedBytes;  // 空闲span中物理页已归还系统的字节
+  // 1 - 最大空闲span / 空闲span总字节 越接近1越难满足大的span请求
+  double externalFragmentation;
+
+  // 遍历默认内存池的全部span 读取时不停止分配, 结果是近似的快照
+  // 其他线程缓存中的空闲块无法安全读取, 计为在用
+  static HeapReport collect();
+  void dumpText(FILE* out) const;
+  void dumpJson(FILE* out) const;
+};
+
+}  // namespace memory_pool
@@ -0,0 +1,112 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+#include "common.h"
+
+// 编译时打开MEMORY_POOL_LATENCY_STATS后 按层级与大小分组记录分配和释放的耗时
+// 未打开时分配路径上不留任何代码, 统计结果中enabled为false
+namespace memory_pool {
+// 一次分配或释放到达的最深层级
+enum LatencyTier {
+  TIER_THREAD_CACHE,
+  TIER_CENTRAL_CACHE,
+  TIER_PAGE_CACHE,
+  TIER_SYSTEM,  // 向系统申请了内存
+  TIER_COUNT
+};
+
+enum LatencyOp { OP_ALLOCATE, OP_DEALLOCATE, OP_COUNT };
+
+// 按2的幂划分的大小分组 第0组为8字节, 第i组为(2^(i+2), 2^(i+3)]字节
+// 最后一组为超过MAX_BYTES的大块
+constexpr size_t LATENCY_SIZE_GROUPS = 17;
+
+// 对数刻度的周期数直方图 每个2的幂区间再等分为4个桶, 相对误差不超过25%
+struct LatencyHistogram {
+  static constexpr size_t SUB_BUCKETS = 4;
+  static constexpr size_t MAX_OCTAVE = 40;  // 超过2^40个周期的计入最后一桶
+  static constexpr size_t BUCKETS = MAX_OCTAVE * SUB_BUCKETS;
+
+  std::array<std::atomic<size_t>, BUCKETS> counts;
+
+  static size_t bucketOf(uint64_t cycles) {
+    if (cycles < SUB_BUCKETS) return cycles;
+    size_t octave = 63 - __builtin_clzll(cycles);
+    if (octave >= MAX_OCTAVE) return BUCKETS - 1;
+    size_t sub = (cycles >> (octave - 2)) & (SUB_BUCKETS - 1);
+    return (octave - 1) * SUB_BUCKETS + sub;
+  }
+  // 桶的下界 上界为下一个桶的下界
+  static uint64_t lowerBound(size_t bucket) {
+    if (bucket < SUB_BUCKETS) return bucket;
+    size_t octave = bucket / SUB_BUCKETS + 1;
+    return (SUB_BUCKETS + bucket % SUB_BUCKETS) << (octave - 2);
+  }
+};
+
+// 每个线程的耗时直方图 按层级与按大小分组各记一次
+struct ThreadLatency {
+  LatencyHistogram byTier[OP_COUNT][TIER_COUNT];
+  LatencyHistogram bySize[OP_COUNT][LATENCY_SIZE_GROUPS];
+
+  static size_t sizeGroup(size_t size) {
+    if (size > MAX_BYTES) return LATENCY_SIZE_GROUPS - 1;
+    if (size <= ALIGNMENT) return 0;
+    return 64 - __builtin_clzll(size - 1) - 3;
+  }
+};
+
+// 一组耗时的汇总 单位为时钟周期, 分位数取所在桶的上界
+struct LatencySummary {
+  uint64_t count;
+  uint64_t p50;
+  uint64_t p99;
+  uint64_t p999;
+  std::vector<uint64_t> histogram;  // LatencyHistogram::BUCKETS个桶的计数
+};
+
+struct LatencyReport {
+  bool enabled;        // 编译时是否打开了耗时统计
+  double cyclesPerNs;  // 周期数换算为纳秒
+  LatencySummary byTier[OP_COUNT][TIER_COUNT];
+  LatencySummary bySize[OP_COUNT][LATENCY_SIZE_GROUPS];
+};
+
+// 读取时钟周期 x86上为rdtsc, 其他平台为纳秒
+inline uint64_t readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+// 当前线程本次操作到达的最深层级 由各层在进入时提升
+inline int& latencyTier() {
+  static thread_local int tier MEMORY_POOL_TLS_MODEL = TIER_THREAD_CACHE;
+  return tier;
+}
+
+}  // namespace memory_pool
+
+#ifdef MEMORY_POOL_LATENCY_STATS
+#define MEMORY_POOL_LATENCY_TIER(tier)           \
+  do {                                           \
+    int& current = ::memory_pool::latencyTier(); \
+    if (current < (tier)) current = (tier);      \
+  } while (0)
+#else
+#define MEMORY_POOL_LATENCY_TIER(tier) ((void)0)
+#endif
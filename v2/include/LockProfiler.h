@@ -0,0 +1,90 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "PoolStats.h"
+#include "common.h"
+
+namespace memory_pool {
+// 锁竞争分析 默认关闭, 关闭时每次加锁只多一次原子读
+// 按锁记录等待时间与持有时间的直方图: 中心缓存按大小类, 页缓存一把锁
+// 所有Heap实例的同类锁计入同一处
+// 结果通过PoolStats的pageCacheLock与centralLocks输出
+class LockProfiler {
+ public:
+  // 页缓存锁的位置 之前的位置为中心缓存各大小类的锁
+  static constexpr size_t PAGE_CACHE_SITE = FREE_LIST_SIZE;
+
+  // 首次开启时分配计数表 之后的开启与关闭只切换开关, 计数一直累积
+  static bool start();
+  static void stop();
+  static bool isEnabled() {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+  // 读出各锁的计数 central只包含有过加锁的大小类, 按等待总时间降序
+  static void collect(LockContentionStats* pageCache,
+                      std::vector<LockContentionStats>* central);
+
+  // 加锁 tryLock失败即为一次竞争
+  // 返回加锁完成的时间, 未开启分析时返回0
+  template <typename TryLock, typename Lock>
+  static uint64_t acquire(size_t site, TryLock tryLock, Lock lock) {
+    if (!isEnabled()) {
+      lock();
+      return 0;
+    }
+    if (tryLock()) {
+      uint64_t lockedAt = now();
+      recordWait(site, 0, false);
+      return lockedAt;
+    }
+    uint64_t start = now();
+    lock();
+    uint64_t lockedAt = now();
+    recordWait(site, lockedAt - start, true);
+    return lockedAt;
+  }
+  // 解锁 lockedAt为acquire的返回值, 在解锁前记录持有时间
+  template <typename Unlock>
+  static void release(size_t site, uint64_t lockedAt, Unlock unlock) {
+    if (lockedAt) recordHold(site, now() - lockedAt);
+    unlock();
+  }
+
+ private:
+  friend class ForkHandler;
+
+  static uint64_t now();
+  static void recordWait(size_t site, uint64_t ns, bool contended);
+  static void recordHold(size_t site, uint64_t ns);
+  // fork前取得开启时的锁 fork后在父子进程中释放
+  static void prepareFork();
+  static void afterFork();
+
+  static inline std::atomic<bool> enabled_{false};
+};
+
+// std::lock_guard的替代 同时统计竞争
+class ProfiledLockGuard {
+ public:
+  ProfiledLockGuard(std::mutex& mutex, size_t site)
+      : mutex_(mutex),
+        site_(site),
+        lockedAt_(LockProfiler::acquire(
+            site, [&mutex] { return mutex.try_lock(); },
+            [&mutex] { mutex.lock(); })) {}
+  ~ProfiledLockGuard() {
+    LockProfiler::release(site_, lockedAt_, [this] { mutex_.unlock(); });
+  }
+  ProfiledLockGuard(const ProfiledLockGuard&) = delete;
+  ProfiledLockGuard& operator=(const ProfiledLockGuard&) = delete;
+
+ private:
+  std::mutex& mutex_;
+  size_t site_;
+  uint64_t lockedAt_;
+};
+
+}  // namespace memory_pool
@@ -1,16 +1,121 @@
 #pragma once
+#include <cstdlib>
 
+#include "HeapReport.h"
+#include "MemoryPressure.h"
+#include "PageCache.h"
+#include "PoolStats.h"
+#include "RealTimePool.h"
 #include "ThreadCache.h"
+#include "TraceRecorder.h"
 
 namespace memory_pool {
 class MemoryPool {
  public:
+  // 各入口在TraceRecorder开启时记录轨迹 未开启时只多一次读取
   static void* allocate(size_t size) {
-    return ThreadCache::getInstance()->allocate(size);
+    void* ptr = ThreadCache::getInstance()->allocate(size);
+    if (TraceRecorder::isEnabled()) TraceRecorder::recordAllocate(ptr, size);
+    return ptr;
   }
   static void deallocate(void* ptr, size_t size) {
+    if (TraceRecorder::isEnabled()) TraceRecorder::recordFree(ptr, size);
     ThreadCache::getInstance()->deallocate(ptr, size);
   }
+  // 不带大小的释放 用于无法得知分配大小的场景(如free)
+  static void deallocate(void* ptr) {
+    if (TraceRecorder::isEnabled()) TraceRecorder::recordFree(ptr, 0);
+    ThreadCache::getInstance()->deallocate(ptr);
+  }
+  // 重新分配 同一大小类或大块可原地扩展时不复制
+  static void* reallocate(void* ptr, size_t oldSize, size_t newSize) {
+    if (!TraceRecorder::isEnabled()) {
+      return ThreadCache::getInstance()->reallocate(ptr, oldSize, newSize);
+    }
+    uint64_t start = TraceRecorder::now();
+    void* newPtr =
+        ThreadCache::getInstance()->reallocate(ptr, oldSize, newSize);
+    TraceRecorder::recordReallocate(ptr, oldSize, newPtr, newSize, start);
+    return newPtr;
+  }
+  // ptr所在块的实际可用大小 不属于内存池时返回0
+  static size_t getUsableSize(const void* ptr) {
+    if (RealTimePool::contains(ptr)) return RealTimePool::getUsableSize(ptr);
+    return PageCache::getObjectSize(ptr);
+  }
+  static void* allocateAligned(size_t size, size_t align) {
+    void* ptr = ThreadCache::getInstance()->allocateAligned(size, align);
+    if (TraceRecorder::isEnabled()) {
+      TraceRecorder::recordAllocate(ptr, size, align);
+    }
+    return ptr;
+  }
+  static void deallocateAligned(void* ptr, size_t size, size_t align) {
+    if (TraceRecorder::isEnabled()) TraceRecorder::recordFree(ptr, size);
+    ThreadCache::getInstance()->deallocateAligned(ptr, size, align);
+  }
+  static size_t allocateBatch(size_t size, size_t n, void** out) {
+    size_t count = ThreadCache::getInstance()->allocateBatch(size, n, out);
+    if (TraceRecorder::isEnabled()) {
+      for (size_t i = 0; i < count; i++) {
+        TraceRecorder::recordAllocate(out[i], size);
+      }
+    }
+    return count;
+  }
+  static void deallocateBatch(void** ptrs, size_t n, size_t size) {
+    if (TraceRecorder::isEnabled()) {
+      for (size_t i = 0; i < n; i++) TraceRecorder::recordFree(ptrs[i], size);
+    }
+    ThreadCache::getInstance()->deallocateBatch(ptrs, n, size);
+  }
+  // 预先映射并切分count个size大小的块 映射时用MAP_POPULATE一次完成缺页
+  // fillThreadCache时把其中至多THREAD_HOLD块放入当前线程的缓存
+  // 内存不足或超过内存上限时返回false
+  static bool reserve(size_t size, size_t count,
+                      bool fillThreadCache = false) {
+    return ThreadCache::getInstance()->reserve(size, count, fillThreadCache);
+  }
+  // 按配置预热 profile为逗号分隔的"大小:块数", 如"64:10000,4096:256"
+  // 格式错误时在该项停止并返回false
+  static bool warmUp(const char* profile, bool fillThreadCache = false) {
+    bool ok = true;
+    const char* p = profile;
+    while (*p) {
+      char* end;
+      size_t size = strtoul(p, &end, 10);
+      if (end == p || *end != ':') return false;
+      p = end + 1;
+      size_t count = strtoul(p, &end, 10);
+      if (end == p || (*end != ',' && *end != '\0')) return false;
+      ok = reserve(size, count, fillThreadCache) && ok;
+      p = *end ? end + 1 : end;
+    }
+    return ok;
+  }
+  // 内存上限 0表示不限制, 按占用的字节计算(不含已用madvise归还的页)
+  // 新的映射会超过上限时依次清空线程缓存、归还中心缓存的空闲span、
+  // madvise空闲页、调用setPressureCallback登记的回调, 仍不足时分配返回nullptr
+  static void setMemoryLimit(size_t bytes) {
+    PageCache::getInstance().setMemoryLimit(bytes);
+  }
+  // callback为空时取消登记 回调中应释放调用方自己缓存的内存
+  static void setPressureCallback(MemoryPressure::Callback callback,
+                                  void* context = nullptr) {
+    MemoryPressure::setCallback(callback, context);
+  }
+  // 实时模式 启动时映射并mlock约bytes字节, 只能成功一次
+  // 调用enterRealTime的线程之后只从该区域分配: 没有系统调用与锁,
+  // 工作量有固定上限, 区域用尽时返回nullptr
+  static bool enableRealTime(size_t bytes) { return RealTimePool::init(bytes); }
+  static bool enterRealTime() { return RealTimePool::enter(); }
+  static void leaveRealTime() { RealTimePool::leave(); }
+  // 按大小类汇总的运行时统计 可用dumpText/dumpJson输出
+  static PoolStats getStats() { return PoolStats::collect(); }
+  // 遍历全部span 输出每个span的使用情况与碎片汇总
+  static HeapReport walkHeap() { return HeapReport::collect(); }
+  static void dumpHeap(FILE* out) { HeapReport::collect().dumpText(out); }
+  static void dumpHeapJson(FILE* out) { HeapReport::collect().dumpJson(out); }
 };
 
 }  // namespace memory_pool
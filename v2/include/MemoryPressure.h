@@ -0,0 +1,57 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+#include "PoolStats.h"
+
+namespace memory_pool {
+// 默认内存池在内存上限下的分级回收
+// 分配因新的映射会超过上限而失败时依次执行下列阶段, 每个阶段后重试一次:
+//   1. 清空当前线程的缓存 其他线程在下次进入慢路径时清空自身
+//   2. 中心缓存把全部块都空闲的span归还页缓存
+//   3. 用madvise归还页缓存中空闲span的物理页
+//   4. 调用用户登记的回调 之后再执行一遍1~3
+// 全部阶段之后仍失败时分配返回nullptr
+// 独立的Heap不参与, 它们的内存上限仍是硬上限
+class MemoryPressure {
+ public:
+  // bytes为触发回收的分配大小 回调中可以释放内存, 再次分配不会触发回收
+  using Callback = void (*)(size_t bytes, void* context);
+  static void setCallback(Callback callback, void* context);
+  static MemoryPressureStats getStats();
+  // 每次清空线程缓存阶段加一 线程缓存发现变化时清空自身
+  static uint64_t flushEpoch() {
+    return flushEpoch_.load(std::memory_order_relaxed);
+  }
+
+  // retry重新尝试分配 成功时返回非空指针
+  template <typename Retry>
+  static void* relieve(size_t bytes, Retry retry) {
+    if (!begin()) return nullptr;
+    void* ptr = nullptr;
+    for (size_t stage = 0; stage < STAGE_COUNT && !ptr; stage++) {
+      if (runStage(static_cast<Stage>(stage), bytes)) ptr = retry();
+    }
+    end(ptr != nullptr);
+    return ptr;
+  }
+
+ private:
+  enum Stage {
+    FLUSH_THREAD_CACHES,
+    RELEASE_CENTRAL_SPANS,
+    RELEASE_PAGES,
+    CALL_CALLBACK,
+    STAGE_COUNT
+  };
+
+  // 未设置内存上限或本线程已在回收中时返回false
+  static bool begin();
+  static void end(bool succeeded);
+  // 执行一个阶段 没有可做的事时返回false, 此时不必重试
+  static bool runStage(Stage stage, size_t bytes);
+
+  static inline std::atomic<uint64_t> flushEpoch_{0};
+};
+
+}  // namespace memory_pool
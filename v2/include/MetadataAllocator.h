@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+#include <new>
+
+namespace memory_pool {
+// 元数据分配器: 内存直接来自mmap
+// 内存池自身的元数据(span, map节点)都从这里分配, 保证不会回调malloc
+class MetadataAllocator {
+ public:
+  static void* allocate(size_t size);
+  static void deallocate(void* ptr, size_t size);
+
+  // 每次向系统申请的内存大小
+  static constexpr size_t CHUNK_SIZE = 64 * 1024;
+  // 按16字节分级管理的最大元数据大小 超出部分直接mmap
+  static constexpr size_t MAX_META_SIZE = 256;
+  static constexpr size_t META_ALIGNMENT = 16;
+
+ private:
+  friend class ForkHandler;
+  // fork前取得分配器的锁 fork后在父子进程中释放
+  static void prepareFork();
+  static void afterFork();
+};
+
+// 供STL容器使用的元数据分配器
+template <typename T>
+struct MetadataStlAllocator {
+  using value_type = T;
+
+  MetadataStlAllocator() = default;
+  template <typename U>
+  MetadataStlAllocator(const MetadataStlAllocator<U>&) {}
+
+  T* allocate(size_t n) {
+    void* ptr = MetadataAllocator::allocate(n * sizeof(T));
+    if (!ptr) throw std::bad_alloc();
+    return static_cast<T*>(ptr);
+  }
+  void deallocate(T* p, size_t n) {
+    MetadataAllocator::deallocate(p, n * sizeof(T));
+  }
+};
+
+template <typename T, typename U>
+bool operator==(const MetadataStlAllocator<T>&,
+                const MetadataStlAllocator<U>&) {
+  return true;
+}
+template <typename T, typename U>
+bool operator!=(const MetadataStlAllocator<T>&,
+                const MetadataStlAllocator<U>&) {
+  return false;
+}
+
+}  // namespace memory_pool
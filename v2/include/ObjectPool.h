@@ -0,0 +1,115 @@
+#pragma once
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "MemoryPool.h"
+
+namespace memory_pool {
+// 按类型分配对象 大小类在编译期确定
+template <typename T>
+class ObjectPool {
+ public:
+  // 对齐要求超过ALIGNMENT时取align的倍数 使块天然对齐
+  static constexpr size_t BLOCK_SIZE = SizeClass::alignedSize(
+      sizeof(T), alignof(T) > ALIGNMENT ? alignof(T) : ALIGNMENT);
+  static_assert(alignof(T) <= PageCache::PAGE_SIZE,
+                "ObjectPool supports alignment up to the page size");
+
+  template <typename... Args>
+  static T* create(Args&&... args) {
+    void* ptr = allocateBlock();
+    if (!ptr) throw std::bad_alloc();
+    try {
+      return new (ptr) T(std::forward<Args>(args)...);
+    } catch (...) {
+      deallocateBlock(ptr);
+      throw;
+    }
+  }
+
+  static void destroy(T* ptr) {
+    if (!ptr) return;
+    // 平凡析构的类型直接回收内存
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      ptr->~T();
+    }
+    deallocateBlock(ptr);
+  }
+
+  // 批量构造n个对象到out 每个对象都以args构造
+  template <typename... Args>
+  static void createBatch(T** out, size_t n, const Args&... args) {
+    void** blocks = reinterpret_cast<void**>(out);
+    size_t count = MemoryPool::allocateBatch(BLOCK_SIZE, n, blocks);
+    if (count < n) {
+      MemoryPool::deallocateBatch(blocks, count, BLOCK_SIZE);
+      throw std::bad_alloc();
+    }
+    size_t constructed = 0;
+    try {
+      for (; constructed < n; constructed++) {
+        out[constructed] = new (blocks[constructed]) T(args...);
+      }
+    } catch (...) {
+      destroyBatch(out, constructed);
+      MemoryPool::deallocateBatch(blocks + constructed, n - constructed,
+                                  BLOCK_SIZE);
+      throw;
+    }
+  }
+
+  static void destroyBatch(T** ptrs, size_t n) {
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      for (size_t i = 0; i < n; i++) {
+        ptrs[i]->~T();
+      }
+    }
+    MemoryPool::deallocateBatch(reinterpret_cast<void**>(ptrs), n,
+                                BLOCK_SIZE);
+  }
+
+ private:
+  static void* allocateBlock() {
+    if constexpr (BLOCK_SIZE <= MAX_BYTES) {
+      constexpr size_t index = SizeClass::getIndex(BLOCK_SIZE);
+      ThreadCache* cache = ThreadCache::getInstance();
+      // 实时线程的分配只来自锁定区域
+      if (cache->isRealTime()) return cache->allocate(BLOCK_SIZE);
+      return cache->allocateByIndex(index);
+    } else {
+      return MemoryPool::allocate(BLOCK_SIZE);
+    }
+  }
+
+  static void deallocateBlock(void* ptr) {
+    if constexpr (BLOCK_SIZE <= MAX_BYTES) {
+      constexpr size_t index = SizeClass::getIndex(BLOCK_SIZE);
+      ThreadCache* cache = ThreadCache::getInstance();
+      // 实时区域的块不属于任何大小类
+      if (RealTimePool::contains(ptr)) {
+        cache->deallocate(ptr, BLOCK_SIZE);
+        return;
+      }
+      cache->deallocateByIndex(ptr, index);
+    } else {
+      MemoryPool::deallocate(ptr, BLOCK_SIZE);
+    }
+  }
+};
+
+template <typename T>
+struct PoolDeleter {
+  void operator()(T* ptr) const { ObjectPool<T>::destroy(ptr); }
+};
+
+template <typename T>
+using PooledPtr = std::unique_ptr<T, PoolDeleter<T>>;
+
+template <typename T, typename... Args>
+PooledPtr<T> make_pooled(Args&&... args) {
+  return PooledPtr<T>(ObjectPool<T>::create(std::forward<Args>(args)...));
+}
+
+}  // namespace memory_pool
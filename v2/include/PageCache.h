@@ -1,9 +1,23 @@
 #pragma once
 #include <map>
 #include <mutex>
+#include <vector>
 
+#include "HeapReport.h"
+#include "MetadataAllocator.h"
+#include "PageMap.h"
+#include "PoolStats.h"
 #include "common.h"
 namespace memory_pool {
+struct Span {
+  void* pageAddr;
+  size_t numPages;
+  size_t objSize;  // span被切分成的块大小 0表示整个span作为一块
+  bool sampled;    // 整个span是一次被堆分析器采样的分配
+  Span* next;
+  bool released;   // 空闲span的物理页已用madvise归还系统
+};
+
 class PageCache {
  public:
   static const size_t PAGE_SIZE = 4096;
@@ -11,26 +25,78 @@ class PageCache {
     static PageCache instance;
     return instance;
   }
-  // 分配制定页数的span
-  void* allocateSpan(size_t numPages);
+  // 分配制定页数的span objSize为span切分的块大小
+  void* allocateSpan(size_t numPages, size_t objSize = 0);
+  // 分配首地址按align(超过页大小的2的幂)对齐的span
+  // 多取align - PAGE_SIZE字节 对齐点之前与numPages页之后的部分放回空闲链表
+  void* allocateAlignedSpan(size_t numPages, size_t align);
   // 释放span
   void deallocateSpan(void* ptr, size_t numPages);
+  // 与后一块空闲span合并, 将已分配的span原地扩展到numPages页
+  bool growSpan(void* ptr, size_t numPages);
+  // 将已分配的span收缩到numPages页 多余的页放回空闲链表
+  void shrinkSpan(void* ptr, size_t numPages);
+  // 用mremap将已分配的span扩展到numPages页 返回新地址, 失败返回nullptr
+  void* remapSpan(void* ptr, size_t numPages);
+  // 一次映射numPages页并预先缺页(MAP_POPULATE) 作为空闲span放入页缓存
+  // 之后的分配从中切分, 不再经过mmap与缺页, 超过内存上限时返回false
+  bool reserve(size_t numPages);
+  // 内存上限 0表示不限制
+  // 按占用的字节计算: 向系统申请的字节减去已用madvise归还的字节
+  void setMemoryLimit(size_t bytes);
+  size_t getMemoryLimit();
+  // 用madvise归还全部空闲span的物理页 映射保留, 返回本次归还的字节数
+  size_t releaseFreeSpans();
+  // 已向系统申请的总字节数
+  size_t getMappedBytes();
+  // 页缓存的统计 spanBytes按大小类下标累加已切分span的字节数
+  PageCacheStats getStats(size_t* spanBytes);
+  // 按地址顺序列出全部span 只填写页缓存已知的字段
+  // 持锁期间不能经过内存池分配, 结果放在元数据分配器的内存中
+  using SpanList = std::vector<SpanInfo, MetadataStlAllocator<SpanInfo>>;
+  void getSpans(SpanList* spans);
+  // 无锁查询ptr所在块的大小 不属于内存池时返回0
+  static size_t getObjectSize(const void* ptr) {
+    Span* span = PageMap::getInstance().get(ptr);
+    if (!span) return 0;
+    return span->objSize ? span->objSize : span->numPages * PAGE_SIZE;
+  }
 
  private:
-  /* data */
+  friend class Heap;
+  friend class ForkHandler;
+
   PageCache(/* args */) = default;
-  void* systemAlloc(size_t numPages);
+  // fork前取得mutex_ fork后在父子进程中释放
+  void prepareFork() { mutex_.lock(); }
+  void afterFork() { mutex_.unlock(); }
+  // populate时用MAP_POPULATE一次建立全部页
+  void* systemAlloc(size_t numPages, bool populate = false);
+  // 归还所有向系统申请的内存 之后所有span都失效
+  void releaseAll();
+  void recordMapping(void* addr, size_t size);
+  void forgetMapping(void* addr, size_t size);
+  // 再占用extra字节是否仍在内存上限内
+  bool withinLimit(size_t extra) const;
+  Span* newSpan(void* pageAddr, size_t numPages);
+  void deleteSpan(Span* span);
 
  private:
-  struct Span {
-    void* pageAddr;
-    size_t numPages;
-    Span* next;
-  };
+  template <typename K, typename V>
+  using MetaMap = std::map<K, V, std::less<K>,
+                           MetadataStlAllocator<std::pair<const K, V>>>;
+
+  void releaseSpan(Span* span);
+  bool removeFreeSpan(Span* target);
   // 按页数管理空闲span 不同页数对应不同span链表
-  std::map<size_t, Span*> freeSpans_;
+  MetaMap<size_t, Span*> freeSpans_;
   // 页号到span的映射，用于回收
-  std::map<void*, Span*> spanMap_;
+  MetaMap<void*, Span*> spanMap_;
+  // 向系统申请的内存区域 起始地址到字节数
+  MetaMap<void*, size_t> mappings_;
+  size_t mappedBytes_ = 0;
+  size_t releasedBytes_ = 0;
+  size_t memoryLimit_ = 0;
   std::mutex mutex_;
 };
 
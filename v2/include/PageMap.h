@@ -0,0 +1,78 @@
+#pragma once
+#include <sys/mman.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace memory_pool {
+struct Span;
+
+// 页号到span的两级基数树
+// 读操作无锁, 可由任意地址直接查到所属span; 叶子节点按需mmap
+class PageMap {
+ public:
+  static PageMap& getInstance() {
+    static PageMap instance;
+    return instance;
+  }
+
+  Span* get(const void* addr) const {
+    uintptr_t page = reinterpret_cast<uintptr_t>(addr) >> PAGE_SHIFT;
+    if (page >> (ROOT_BITS + LEAF_BITS)) return nullptr;
+    Leaf* leaf = root_[page >> LEAF_BITS].load(std::memory_order_acquire);
+    if (!leaf) return nullptr;
+    return leaf->spans[page & (LEAF_LENGTH - 1)].load(
+        std::memory_order_acquire);
+  }
+
+  // 将[addr, addr + numPages页)映射到span 叶子节点分配失败时返回false
+  bool set(const void* addr, size_t numPages, Span* span) {
+    uintptr_t page = reinterpret_cast<uintptr_t>(addr) >> PAGE_SHIFT;
+    for (size_t i = 0; i < numPages; i++, page++) {
+      Leaf* leaf = ensureLeaf(page >> LEAF_BITS);
+      if (!leaf) return false;
+      leaf->spans[page & (LEAF_LENGTH - 1)].store(span,
+                                                  std::memory_order_release);
+    }
+    return true;
+  }
+
+ private:
+  static constexpr size_t PAGE_SHIFT = 12;
+  // 48位虚拟地址: 18位根索引 + 18位叶子索引 + 12位页内偏移
+  static constexpr size_t LEAF_BITS = 18;
+  static constexpr size_t ROOT_BITS = 48 - PAGE_SHIFT - LEAF_BITS;
+  static constexpr size_t LEAF_LENGTH = size_t(1) << LEAF_BITS;
+
+  struct Leaf {
+    std::atomic<Span*> spans[LEAF_LENGTH];
+  };
+
+  PageMap() = default;
+
+  Leaf* ensureLeaf(size_t rootIndex) {
+    if (rootIndex >= root_.size()) return nullptr;
+    Leaf* leaf = root_[rootIndex].load(std::memory_order_acquire);
+    if (leaf) return leaf;
+
+    // mmap的内存已清零 即所有页都未映射
+    void* memory = mmap(nullptr, sizeof(Leaf), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return nullptr;
+    Leaf* expected = nullptr;
+    if (!root_[rootIndex].compare_exchange_strong(
+            expected, static_cast<Leaf*>(memory), std::memory_order_acq_rel)) {
+      // 其他线程已经安装了叶子节点
+      munmap(memory, sizeof(Leaf));
+      return expected;
+    }
+    return static_cast<Leaf*>(memory);
+  }
+
+ private:
+  std::array<std::atomic<Leaf*>, size_t(1) << ROOT_BITS> root_;
+};
+
+}  // namespace memory_pool
@@ -0,0 +1,115 @@
+#pragma once
+#include <limits>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+
+#include "Arena.h"
+#include "MemoryPool.h"
+
+namespace memory_pool {
+// 无状态的STL分配器 sizeof(T) * n 直接决定大小类
+template <typename T>
+class StlAllocator {
+ public:
+  using value_type = T;
+  using is_always_equal = std::true_type;
+
+  StlAllocator() noexcept = default;
+  template <typename U>
+  StlAllocator(const StlAllocator<U>&) noexcept {}
+
+  T* allocate(size_t n) {
+    if (n > std::numeric_limits<size_t>::max() / sizeof(T)) {
+      throw std::bad_array_new_length();
+    }
+    void* ptr;
+    if constexpr (alignof(T) > ALIGNMENT) {
+      ptr = MemoryPool::allocateAligned(sizeof(T) * n, alignof(T));
+    } else {
+      ptr = MemoryPool::allocate(sizeof(T) * n);
+    }
+    if (!ptr) throw std::bad_alloc();
+    return static_cast<T*>(ptr);
+  }
+
+  void deallocate(T* ptr, size_t n) noexcept {
+    if constexpr (alignof(T) > ALIGNMENT) {
+      MemoryPool::deallocateAligned(ptr, sizeof(T) * n, alignof(T));
+    } else {
+      MemoryPool::deallocate(ptr, sizeof(T) * n);
+    }
+  }
+};
+
+template <typename T, typename U>
+bool operator==(const StlAllocator<T>&, const StlAllocator<U>&) noexcept {
+  return true;
+}
+template <typename T, typename U>
+bool operator!=(const StlAllocator<T>&, const StlAllocator<U>&) noexcept {
+  return false;
+}
+
+// 以三层缓存为后端的std::pmr::memory_resource
+// 例: std::pmr::unordered_map<int, int> m(&PoolMemoryResource::getInstance());
+class PoolMemoryResource : public std::pmr::memory_resource {
+ public:
+  static PoolMemoryResource& getInstance() {
+    static PoolMemoryResource instance;
+    return instance;
+  }
+
+ private:
+  PoolMemoryResource() = default;
+
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    void* ptr = alignment > ALIGNMENT
+                    ? MemoryPool::allocateAligned(bytes, alignment)
+                    : MemoryPool::allocate(bytes);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+  }
+
+  void do_deallocate(void* ptr, size_t bytes, size_t alignment) override {
+    if (alignment > ALIGNMENT) {
+      MemoryPool::deallocateAligned(ptr, bytes, alignment);
+    } else {
+      MemoryPool::deallocate(ptr, bytes);
+    }
+  }
+
+  // 内存池是进程级的 所有实例都可以互相释放
+  bool do_is_equal(
+      const std::pmr::memory_resource& other) const noexcept override {
+    return dynamic_cast<const PoolMemoryResource*>(&other) != nullptr;
+  }
+};
+
+// 以Arena为后端的memory_resource 释放为空操作, 内存在Arena reset时统一回收
+// 例: std::pmr::vector<int> v(&resource); 其中 ArenaMemoryResource resource(arena);
+class ArenaMemoryResource : public std::pmr::memory_resource {
+ public:
+  explicit ArenaMemoryResource(Arena& arena) : arena_(arena) {}
+
+  Arena& getArena() const { return arena_; }
+
+ private:
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    void* ptr = arena_.allocate(bytes, alignment);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+  }
+
+  void do_deallocate(void*, size_t, size_t) override {}
+
+  bool do_is_equal(
+      const std::pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+
+ private:
+  Arena& arena_;
+};
+
+}  // namespace memory_pool
@@ -0,0 +1,134 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "LatencyStats.h"
+#include "common.h"
+
+namespace memory_pool {
+class ThreadCache;
+
+// 每个线程的分配计数 只由所属线程写入, 汇总时宽松读取
+// 体积较大, 由mmap得到的零页按需分配物理内存
+struct ThreadStats {
+  std::array<std::atomic<size_t>, FREE_LIST_SIZE> allocCount;
+  std::array<std::atomic<size_t>, FREE_LIST_SIZE> freeCount;
+  // 从中心缓存取得的块数减去归还的块数(按2^64取模)
+  // 线程缓存中的块数 = centralNet - allocCount + freeCount
+  std::array<std::atomic<size_t>, FREE_LIST_SIZE> centralNet;
+  std::atomic<size_t> largeAllocCount;
+  std::atomic<size_t> largeFreeCount;
+  std::atomic<size_t> largeAllocBytes;
+  std::atomic<size_t> largeFreeBytes;
+#ifdef MEMORY_POOL_LATENCY_STATS
+  ThreadLatency latency;
+#endif
+  ThreadStats* next;  // 登记表链表
+  // 登记这份计数的默认线程缓存 fork后的子进程据此回收已不存在的线程的缓存
+  ThreadCache* cache;
+
+  // 只有一个写者 不需要原子的读改写
+  static void add(std::atomic<size_t>& counter, size_t value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value,
+                  std::memory_order_relaxed);
+  }
+  static void sub(std::atomic<size_t>& counter, size_t value) {
+    counter.store(counter.load(std::memory_order_relaxed) - value,
+                  std::memory_order_relaxed);
+  }
+};
+
+// 所有默认线程缓存的计数登记表
+class StatsRegistry {
+ public:
+  // 为当前线程的cache分配并登记计数 失败时返回nullptr
+  static ThreadStats* attach(ThreadCache* cache);
+  // 线程退出时把计数并入已退出线程的汇总 并释放stats
+  static void detach(ThreadStats* stats);
+  // 把所有线程的计数累加到total
+  static void sum(ThreadStats* total);
+  // 除keep以外任意一个登记中的计数 没有时返回nullptr
+  static ThreadStats* findOther(const ThreadStats* keep);
+
+ private:
+  friend class ForkHandler;
+  // fork前取得登记表的锁 fork后在父子进程中释放
+  static void prepareFork();
+  static void afterFork();
+};
+
+struct SizeClassStats {
+  size_t size;               // 块大小
+  size_t allocCount;         // 累计分配次数
+  size_t freeCount;          // 累计释放次数
+  size_t threadCacheBytes;   // 线程缓存中的空闲字节数
+  size_t centralCacheBytes;  // 中心缓存中的空闲字节数
+  size_t spanBytes;          // 为该大小类切分的span总字节数
+};
+
+struct PageCacheStats {
+  size_t freeBytes;      // 空闲span的字节数
+  size_t releasedBytes;  // 已把物理页归还系统、仍保留地址空间的字节数
+  size_t mappedBytes;    // 向系统申请的总字节数
+};
+
+// 内存上限下的分级回收 各计数为对应阶段执行的次数
+struct MemoryPressureStats {
+  size_t memoryLimit;         // 0表示不限制
+  size_t limitHits;           // 分配因内存上限失败 进入回收的次数
+  size_t threadCacheFlushes;  // 清空线程缓存
+  size_t centralReleases;     // 中心缓存归还空闲span
+  size_t pageReleases;        // madvise归还空闲页
+  size_t pageReleasedBytes;   // 累计madvise归还的字节数
+  size_t callbacks;           // 调用用户登记的回调
+  size_t failures;            // 各阶段之后仍分配失败
+};
+
+// 实时模式的锁定区域
+struct RealTimeStats {
+  size_t regionBytes;  // 可分配的字节数 0表示未开启
+  size_t usedBytes;    // 已按块分给各线程的字节数
+  size_t threads;      // 处于实时模式的线程数
+  size_t failures;     // 区域用尽返回nullptr的次数
+};
+
+// 一把锁的竞争统计 时间单位为纳秒
+// 直方图第0桶为未等待, 第k桶为[2^(k-1), 2^k)ns, 最后一桶包含更长的时间
+struct LockContentionStats {
+  static constexpr size_t BUCKETS = 32;
+  size_t size;            // 中心缓存锁对应的块大小 页缓存锁为0
+  uint64_t acquisitions;  // 加锁次数
+  uint64_t contended;     // 需要等待的加锁次数
+  uint64_t waitNs;        // 等待总时间
+  uint64_t holdNs;        // 持有总时间
+  std::array<uint64_t, BUCKETS> waitHistogram;
+  std::array<uint64_t, BUCKETS> holdHistogram;
+};
+
+struct PoolStats {
+  // dumpText输出的竞争最多的中心缓存锁个数
+  static constexpr size_t TOP_CONTENDED_LOCKS = 10;
+
+
+  std::vector<SizeClassStats> sizeClasses;  // 只包含有过活动的大小类
+  size_t largeAllocCount;  // 超过MAX_BYTES的大块
+  size_t largeFreeCount;
+  size_t largeAllocBytes;
+  size_t largeFreeBytes;
+  PageCacheStats pageCache;
+  MemoryPressureStats pressure;
+  RealTimeStats realTime;
+  // 锁竞争统计 仅在LockProfiler开启期间累积
+  LockContentionStats pageCacheLock;
+  std::vector<LockContentionStats> centralLocks;  // 按等待总时间降序
+  // 分配与释放的耗时 需编译时打开MEMORY_POOL_LATENCY_STATS
+  LatencyReport latency;
+
+  // 汇总默认内存池的统计 计数来自各线程, 读取时不停止分配, 结果是近似的快照
+  static PoolStats collect();
+  void dumpText(FILE* out) const;
+  void dumpJson(FILE* out) const;
+};
+
+}  // namespace memory_pool
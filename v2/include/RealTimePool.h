@@ -0,0 +1,65 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "PoolStats.h"
+
+namespace memory_pool {
+struct RealTimeThread;
+
+// 实时模式 用于不能错过时限的线程, 默认关闭
+// 启动时一次映射并mlock一块固定区域 之后进入实时模式的线程只从该区域分配:
+// 不进行系统调用、不加锁、不遍历链表, 每次分配与释放的工作量有固定上限
+// 区域用尽时返回nullptr 不向系统申请
+//
+// 区域按CHUNK_SIZE分给各线程 线程在自己的块内按2的幂大小切分
+// 每个大小有线程私有的空闲链表, 其他线程释放的块无锁地压入所属线程的远程链表
+// 私有链表为空时整段取走远程链表
+// 以最多一倍的取整浪费换取固定的工作量
+class RealTimePool {
+ public:
+  static constexpr size_t CHUNK_SIZE = 64 * 1024;
+  // 同时处于实时模式的最大线程数
+  static constexpr size_t MAX_THREADS = 256;
+
+  // 映射并锁定约bytes字节 只能成功一次
+  // mlock失败(如超过RLIMIT_MEMLOCK)时不保留区域并返回false
+  static bool init(size_t bytes);
+  static bool isEnabled() {
+    return regionSize_.load(std::memory_order_relaxed) != 0;
+  }
+  // 当前线程进入实时模式 之后的分配都来自锁定区域
+  // 未调用init或线程数已满时返回false
+  // 进入前分配的普通小块在实时模式中释放时留在线程缓存, 退出时再归还中心缓存
+  // 普通大块与保护页槽位的释放仍会加锁, 实时线程应在进入前释放或交给其他线程
+  static bool enter();
+  // 当前线程退出实时模式 线程退出时自动调用, 未释放的块留给下一个进入的线程
+  static void leave();
+  // ptr是否位于锁定区域内 未开启时恒为false
+  static bool contains(const void* ptr) {
+    return reinterpret_cast<uintptr_t>(ptr) -
+               regionBegin_.load(std::memory_order_relaxed) <
+           regionSize_.load(std::memory_order_relaxed);
+  }
+  // ptr须位于锁定区域内
+  static size_t getUsableSize(const void* ptr);
+  static RealTimeStats getStats();
+
+ private:
+  friend class ThreadCache;
+  friend class ForkHandler;
+
+  // align须为不超过页大小的2的幂 区域用尽时返回nullptr
+  static void* allocate(RealTimeThread* thread, size_t size, size_t align);
+  // thread为当前线程的实时状态 不在实时模式时为空
+  static void deallocate(RealTimeThread* thread, void* ptr);
+  static void onThreadExit(void* thread);
+  // fork后的子进程中调用 其他线程占用的实时状态交给之后进入的线程
+  static void childAfterFork();
+
+  static inline std::atomic<uintptr_t> regionBegin_{0};
+  static inline std::atomic<size_t> regionSize_{0};
+};
+
+}  // namespace memory_pool
@@ -1,11 +1,45 @@
 #pragma once
+#include <cstdint>
+
+#include "PoolStats.h"
 #include "common.h"
 #define THREAD_HOLD 256
+// 超过该大小的大块扩容时可使用mremap避免复制
+#define MREMAP_THRESHOLD (1024 * 1024)
 namespace memory_pool {
+  class CentralCache;
+  class PageCache;
+  struct RealTimeThread;
+
   class ThreadCache {
   private:
+    friend class Heap;
+    friend class HeapProfiler;
+    friend class GuardedPool;
+    friend class ForkHandler;
+    friend class MemoryPressure;
+    friend class RealTimePool;
+
     /* data */
     ThreadCache() = default;
+    ThreadCache(CentralCache* central, PageCache* pageCache,
+                ThreadStats* stats)
+        : freeList_(),
+          freeListSize_(),
+          central_(central),
+          pageCache_(pageCache),
+          stats_(stats),
+          bytesUntilSample_(SIZE_MAX),
+          guardCountdown_(SIZE_MAX),
+          pressureEpoch_(0),
+          realTime_(nullptr) {}
+    // 所属的中心缓存与页缓存 为空时使用全局实例
+    CentralCache& central();
+    PageCache& pageCache();
+    // 将所有空闲块归还中心缓存
+    void flushAll();
+    // 把超过THREAD_HOLD的空闲链表归还中心缓存 用于退出实时模式
+    void returnExcess();
     // 从中心缓存获取内存
     void* fetchFromCentralCache(size_t size);
     // 归还内存到中心缓存
@@ -14,18 +48,120 @@ namespace memory_pool {
     size_t getBatchNum(size_t size);
     // 判断是否需要归还内存
     bool shouldReturnToCentralCache(size_t index);
+    // 大块占用的页数
+    static size_t pagesForSize(size_t size);
+    // 默认线程缓存第一次计数时登记统计 并在线程退出时归还缓存的块
+    ThreadStats* attachStats();
+    static void onThreadExit(void* stats);
+    // fork后的子进程中调用 其他线程已不存在, 它们缓存的块归还中心缓存
+    static void reclaimAfterFork();
+    ThreadStats* getStats() { return stats_ ? stats_ : attachStats(); }
+    void countAlloc(size_t index, size_t n = 1) {
+      if (ThreadStats* stats = getStats()) {
+        ThreadStats::add(stats->allocCount[index], n);
+      }
+    }
+    void countFree(size_t index, size_t n = 1) {
+      if (ThreadStats* stats = getStats()) {
+        ThreadStats::add(stats->freeCount[index], n);
+      }
+    }
+    // 与中心缓存之间移动的块数
+    void countFetched(size_t index, size_t n);
+    void countReturned(size_t index, size_t n);
+    void countLargeAlloc(size_t bytes);
+    void countLargeFree(size_t bytes);
+    // 倒计数用尽时进入 被采样时单独分配span并返回, 否则重置倒计数返回nullptr
+    void* allocateSampled(size_t size);
+    // ptr属于采样的分配时释放并返回true
+    bool deallocateSampled(void* ptr);
+    // 保护页倒计数用尽时进入 被采样时返回槽位中的块, 否则重置倒计数返回nullptr
+    void* allocateGuarded(size_t size);
+    void deallocateGuarded(void* ptr);
+    // 对齐超过页大小的分配 从页缓存取按align对齐的span
+    void* allocateLargeAligned(size_t size, size_t align);
+#ifdef MEMORY_POOL_LATENCY_STATS
+    // 记录一次allocate或deallocate的耗时与到达的层级
+    class LatencyTimer;
+#endif
 
 
   private:
     std::array<void*, FREE_LIST_SIZE> freeList_;
     std::array<size_t, FREE_LIST_SIZE> freeListSize_;
+    // 线程局部的默认实例靠零初始化得到空指针 保持构造函数平凡
+    CentralCache* central_;
+    PageCache* pageCache_;
+    ThreadStats* stats_;
+    // 距下一次堆分析采样还需分配的字节数 独立堆的线程缓存不采样
+    size_t bytesUntilSample_;
+    // 距下一次保护页采样还需经过的分配次数 独立堆的线程缓存不采样
+    size_t guardCountdown_;
+    // 上次清空时MemoryPressure::flushEpoch()的值 独立堆的线程缓存不参与
+    uint64_t pressureEpoch_;
+    // 实时模式下线程的状态 非空时分配只来自RealTimePool的锁定区域
+    RealTimeThread* realTime_;
 
   public:
     static ThreadCache* getInstance() {
-      static thread_local ThreadCache instance;
+      // initial-exec模型访问时不会经过__tls_get_addr 避免作为预加载库时回调malloc
+      static thread_local ThreadCache instance MEMORY_POOL_TLS_MODEL;
       return &instance;
     }
     void* allocate(size_t size);
     void deallocate(void* ptr, size_t size);
+
+    // 已知大小类下标时的快速路径 index须小于FREE_LIST_SIZE
+    void* allocateByIndex(size_t index) {
+      // if (freeListSize_[index] == 0) return fetchFromCentralCache(index);
+      // 这里在没有判断分配成功的情况下先自减了数据
+      // 如果没有分配成功 会从中心缓存取数据
+      // 会返回fetchFromCentralCache 这里会补回这里的一次自减
+      freeListSize_[index]--;
+      void* ptr = freeList_[index];
+      // 检查线程本地空闲链表, 若不为空, 则直接分配
+      if (ptr != nullptr) {
+        freeList_[index] =
+            *reinterpret_cast<void**>(ptr);  // 空闲链表指向下一块空闲地址
+        countAlloc(index);
+        return ptr;
+      }
+      return fetchFromCentralCache(index);
+    }
+    void deallocateByIndex(void* ptr, size_t index) {
+      // 插入对应空闲链表首位
+      *reinterpret_cast<void**>(ptr) = freeList_[index];
+      freeList_[index] = ptr;
+      // 同时更新空闲链表长度
+      freeListSize_[index]++;
+      countFree(index);
+      // 实时线程不归还中心缓存 到退出实时模式时再归还
+      if (shouldReturnToCentralCache(index) && !realTime_) {
+        returnToCentralCache(freeList_[index], (index + 1) * ALIGNMENT);
+      }
+    }
+    // 是否处于实时模式 此时不能经过allocateByIndex分配
+    bool isRealTime() const { return realTime_ != nullptr; }
+    // 不带大小的释放 由页映射查询块大小
+    void deallocate(void* ptr);
+    // 重新分配 能原地扩展或收缩时返回原指针
+    void* reallocate(void* ptr, size_t oldSize, size_t newSize);
+    // 按align对齐分配 align须为2的幂, 超过页大小时单独占用span
+    void* allocateAligned(size_t size, size_t align);
+    void deallocateAligned(void* ptr, size_t size, size_t align);
+    // 批量分配n个同样大小的块到out 返回实际分配的数量
+    size_t allocateBatch(size_t size, size_t n, void** out);
+    // 批量释放n个同样大小的块
+    void deallocateBatch(void** ptrs, size_t n, size_t size);
+    // 预先准备count个size大小的块 小块切分到中心缓存, 大块在页缓存中预留页
+    // fillThreadCache时同时把其中至多THREAD_HOLD块放入本线程缓存
+    bool reserve(size_t size, size_t count, bool fillThreadCache);
+    // 对本线程缓存中该大小类的每个空闲块调用visit
+    template <typename Visit>
+    void forEachFreeBlock(size_t index, Visit visit) const {
+      for (void* p = freeList_[index]; p; p = *reinterpret_cast<void**>(p)) {
+        visit(p);
+      }
+    }
   };
 }  // namespace memory_pool
@@ -0,0 +1,95 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace memory_pool {
+// 分配轨迹记录器 默认关闭
+// 开启后MemoryPool的各入口把每次分配与释放写入线程私有的缓冲区,
+// 缓冲区满、线程退出或stop时整块写入文件, 可用trace_replay离线重放
+//
+// 文件格式: TraceFileHeader, 之后是若干块, 每块为TraceChunkHeader加count条
+// TraceRecord, 同一块的记录来自同一线程. 对象以块地址标识, 地址复用时按时间
+// 先后区分(释放在调用前记时, 分配在返回后记时)
+enum TraceOp : uint8_t {
+  TRACE_ALLOCATE,
+  TRACE_FREE,          // size为0表示不带大小的释放
+  TRACE_REALLOC_FROM,  // 紧跟TRACE_REALLOC_TO 两条组成一次reallocate
+  TRACE_REALLOC_TO,
+};
+
+struct TraceFileHeader {
+  static constexpr char MAGIC[8] = {'M', 'P', 'T', 'R', 'A', 'C', 'E', '1'};
+  char magic[8];
+  uint64_t startNs;  // 开始记录时的单调时钟
+};
+
+struct TraceChunkHeader {
+  uint32_t thread;  // 记录器内的线程序号 从0开始
+  uint32_t count;
+};
+
+// 24字节 大小占低48位, 之后是操作与对齐的以2为底的对数(0表示默认对齐)
+struct TraceRecord {
+  uint64_t timestamp;  // 相对startNs的纳秒数
+  uint64_t object;
+  uint64_t packed;
+
+  static constexpr uint64_t SIZE_MASK = (uint64_t(1) << 48) - 1;
+  uint64_t size() const { return packed & SIZE_MASK; }
+  TraceOp op() const { return static_cast<TraceOp>((packed >> 48) & 0xff); }
+  size_t align() const {
+    size_t shift = packed >> 56;
+    return shift ? size_t(1) << shift : 0;
+  }
+};
+
+// 读出的一条记录 附带线程序号
+struct TraceEvent {
+  uint64_t timestamp;
+  uint64_t object;
+  uint64_t size;
+  size_t align;
+  uint32_t thread;
+  TraceOp op;
+};
+
+class TraceRecorder {
+ public:
+  // 每个线程缓冲的记录数 写满后整块写入文件
+  static constexpr size_t BUFFER_RECORDS = 4096;
+
+  // 截断并打开path开始记录 已在记录时先停止上一次, 失败返回false
+  static bool start(const char* path);
+  // 写出所有线程缓冲区中的记录并关闭文件
+  static void stop();
+  static bool isEnabled() {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  // 由MemoryPool的入口在开启时调用 ptr为空的分配不记录
+  static void recordAllocate(const void* ptr, size_t size, size_t align = 0);
+  static void recordFree(const void* ptr, size_t size);
+  static void recordReallocate(const void* oldPtr, size_t oldSize,
+                               const void* newPtr, size_t newSize,
+                               uint64_t startTime);
+  // recordReallocate需要的调用前时间戳
+  static uint64_t now();
+
+  // 读出整个轨迹并按时间排序 同一时刻保持线程内的顺序, 格式错误返回false
+  static bool load(const char* path, std::vector<TraceEvent>* events);
+
+ private:
+  friend class ForkHandler;
+
+  // fork前按加锁顺序取得记录器的全部锁 fork后在父进程中释放
+  static void prepareFork();
+  static void afterFork();
+  // 子进程停止记录并丢弃其他线程的缓冲区 缓冲区中的记录由父进程写出
+  static void childAfterFork();
+
+  static inline std::atomic<bool> enabled_{false};
+};
+
+}  // namespace memory_pool
@@ -2,11 +2,16 @@
 #include <array>
 #include <atomic>
 #include <cstddef>
+#include <cstdint>
+
+#define MEMORY_POOL_TLS_MODEL __attribute__((tls_model("initial-exec")))
 
 namespace memory_pool {
 constexpr size_t ALIGNMENT = 8;           // 对齐数
 constexpr size_t MAX_BYTES = 256 * 1024;  // 256KB
 constexpr size_t FREE_LIST_SIZE = MAX_BYTES / ALIGNMENT;
+// 单次分配的上限 更大的请求直接失败, 避免页数与对齐计算溢出
+constexpr size_t MAX_ALLOC_BYTES = PTRDIFF_MAX;
 
 struct BlockHeader {
   size_t size;        // 内存块大小
@@ -18,11 +23,20 @@ class SizeClass {
  private:
   /* data */
  public:
-  static size_t roundUp(size_t bytes) {
+  static constexpr size_t roundUp(size_t bytes) {
     // 内存对齐: 先向上取整,再将最低3位置0
     return (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
   }
-  static size_t getIndex(size_t bytes) {
+  // 按align(2的幂)向上取整
+  static constexpr size_t roundUp(size_t bytes, size_t align) {
+    return (bytes + align - 1) & ~(align - 1);
+  }
+  // 满足align对齐的块大小
+  // span按页对齐且从首地址开始等距切分, 块大小为align的倍数时每块天然对齐
+  static constexpr size_t alignedSize(size_t bytes, size_t align) {
+    return roundUp(bytes < align ? align : bytes, align);
+  }
+  static constexpr size_t getIndex(size_t bytes) {
     bytes = roundUp(bytes);
     return (bytes + ALIGNMENT - 1) / ALIGNMENT - 1;
   }
@@ -0,0 +1,221 @@
+// 以LD_PRELOAD方式替换系统分配器
+// 所有malloc/free/new/delete都转发到三层缓存内存池
+#include <errno.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "GuardedPool.h"
+#include "MemoryPool.h"
+#include "TraceRecorder.h"
+
+using memory_pool::GuardedPool;
+using memory_pool::MemoryPool;
+using memory_pool::PageCache;
+using memory_pool::TraceRecorder;
+
+namespace {
+// align为0或不是2的幂时非法
+bool isValidAlignment(size_t align) {
+  return align != 0 && (align & (align - 1)) == 0;
+}
+
+void* alignedAllocate(size_t align, size_t size) {
+  return MemoryPool::allocateAligned(size, align);
+}
+
+void* newImpl(size_t size) {
+  void* ptr = MemoryPool::allocate(size);
+  while (!ptr) {
+    std::new_handler handler = std::get_new_handler();
+    if (!handler) throw std::bad_alloc();
+    handler();
+    ptr = MemoryPool::allocate(size);
+  }
+  return ptr;
+}
+
+void* newAlignedImpl(size_t size, std::align_val_t align) {
+  void* ptr = alignedAllocate(static_cast<size_t>(align), size);
+  while (!ptr) {
+    std::new_handler handler = std::get_new_handler();
+    if (!handler) throw std::bad_alloc();
+    handler();
+    ptr = alignedAllocate(static_cast<size_t>(align), size);
+  }
+  return ptr;
+}
+
+// 设置MEMORY_POOL_GUARDED_SAMPLE_RATE=N时开启保护页采样 平均每N次分配一次
+__attribute__((constructor)) void enableGuardedPoolFromEnv() {
+  const char* value = getenv("MEMORY_POOL_GUARDED_SAMPLE_RATE");
+  if (!value) return;
+  unsigned long rate = strtoul(value, nullptr, 10);
+  if (rate > 0) GuardedPool::enable(rate);
+}
+
+// 设置MEMORY_POOL_MEMORY_LIMIT=字节数时限制内存池占用的内存
+// 接近上限时分级回收, 仍不足时malloc返回NULL并置ENOMEM
+__attribute__((constructor)) void setMemoryLimitFromEnv() {
+  const char* value = getenv("MEMORY_POOL_MEMORY_LIMIT");
+  if (!value) return;
+  unsigned long long bytes = strtoull(value, nullptr, 10);
+  if (bytes > 0) MemoryPool::setMemoryLimit(bytes);
+}
+
+// 设置MEMORY_POOL_WARMUP=大小:块数,...时在启动时预先切分这些大小类
+// 由之后的工作线程使用, 因此只放入中心缓存
+__attribute__((constructor)) void warmUpFromEnv() {
+  const char* profile = getenv("MEMORY_POOL_WARMUP");
+  if (profile && *profile) MemoryPool::warmUp(profile);
+}
+
+// 设置MEMORY_POOL_TRACE=路径时记录分配轨迹 进程退出时写出剩余记录
+__attribute__((constructor)) void startTraceFromEnv() {
+  const char* path = getenv("MEMORY_POOL_TRACE");
+  if (path && *path) TraceRecorder::start(path);
+}
+
+__attribute__((destructor)) void stopTrace() { TraceRecorder::stop(); }
+}  // namespace
+
+extern "C" {
+void* malloc(size_t size) {
+  void* ptr = MemoryPool::allocate(size);
+  if (!ptr) errno = ENOMEM;
+  return ptr;
+}
+
+void free(void* ptr) { MemoryPool::deallocate(ptr); }
+
+void* calloc(size_t num, size_t size) {
+  size_t total;
+  if (__builtin_mul_overflow(num, size, &total)) {
+    errno = ENOMEM;
+    return nullptr;
+  }
+  void* ptr = MemoryPool::allocate(total);
+  if (!ptr) {
+    errno = ENOMEM;
+    return nullptr;
+  }
+  // 复用的块中可能残留旧数据
+  memset(ptr, 0, total);
+  return ptr;
+}
+
+void* realloc(void* ptr, size_t size) {
+  if (!ptr) return malloc(size);
+  if (size == 0) {
+    free(ptr);
+    return nullptr;
+  }
+  size_t oldSize = MemoryPool::getUsableSize(ptr);
+  // 不属于内存池的指针无法得知原大小
+  if (oldSize == 0) {
+    errno = EINVAL;
+    return nullptr;
+  }
+  // 缩小时同样交给reallocate: 同一大小类原地返回, 大块释放多余的页
+  // 跨大小类时换到更小的块
+  void* newPtr = MemoryPool::reallocate(ptr, oldSize, size);
+  if (!newPtr) errno = ENOMEM;
+  return newPtr;
+}
+
+int posix_memalign(void** memptr, size_t align, size_t size) {
+  if (!isValidAlignment(align) || align % sizeof(void*) != 0) return EINVAL;
+  void* ptr = alignedAllocate(align, size);
+  if (!ptr) return ENOMEM;
+  *memptr = ptr;
+  return 0;
+}
+
+void* aligned_alloc(size_t align, size_t size) {
+  if (!isValidAlignment(align)) {
+    errno = EINVAL;
+    return nullptr;
+  }
+  void* ptr = alignedAllocate(align, size);
+  if (!ptr) errno = ENOMEM;
+  return ptr;
+}
+
+void* memalign(size_t align, size_t size) { return aligned_alloc(align, size); }
+
+void* valloc(size_t size) { return aligned_alloc(PageCache::PAGE_SIZE, size); }
+
+void* pvalloc(size_t size) {
+  size_t pageSize = PageCache::PAGE_SIZE;
+  return aligned_alloc(pageSize, (size + pageSize - 1) & ~(pageSize - 1));
+}
+
+size_t malloc_usable_size(void* ptr) {
+  return ptr ? MemoryPool::getUsableSize(ptr) : 0;
+}
+}  // extern "C"
+
+void* operator new(size_t size) { return newImpl(size); }
+void* operator new[](size_t size) { return newImpl(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return MemoryPool::allocate(size);
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return MemoryPool::allocate(size);
+}
+void* operator new(size_t size, std::align_val_t align) {
+  return newAlignedImpl(size, align);
+}
+void* operator new[](size_t size, std::align_val_t align) {
+  return newAlignedImpl(size, align);
+}
+void* operator new(size_t size, std::align_val_t align,
+                   const std::nothrow_t&) noexcept {
+  return alignedAllocate(static_cast<size_t>(align), size);
+}
+void* operator new[](size_t size, std::align_val_t align,
+                     const std::nothrow_t&) noexcept {
+  return alignedAllocate(static_cast<size_t>(align), size);
+}
+
+void operator delete(void* ptr) noexcept { MemoryPool::deallocate(ptr); }
+void operator delete[](void* ptr) noexcept { MemoryPool::deallocate(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+  MemoryPool::deallocate(ptr);
+}
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+  MemoryPool::deallocate(ptr);
+}
+// 带大小的delete可以跳过页映射查询
+void operator delete(void* ptr, size_t size) noexcept {
+  if (ptr) MemoryPool::deallocate(ptr, size);
+}
+void operator delete[](void* ptr, size_t size) noexcept {
+  if (ptr) MemoryPool::deallocate(ptr, size);
+}
+void operator delete(void* ptr, std::align_val_t) noexcept {
+  MemoryPool::deallocate(ptr);
+}
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+  MemoryPool::deallocate(ptr);
+}
+void operator delete(void* ptr, std::align_val_t,
+                     const std::nothrow_t&) noexcept {
+  MemoryPool::deallocate(ptr);
+}
+void operator delete[](void* ptr, std::align_val_t,
+                       const std::nothrow_t&) noexcept {
+  MemoryPool::deallocate(ptr);
+}
+void operator delete(void* ptr, size_t size, std::align_val_t align) noexcept {
+  if (ptr) {
+    MemoryPool::deallocateAligned(ptr, size, static_cast<size_t>(align));
+  }
+}
+void operator delete[](void* ptr, size_t size,
+                       std::align_val_t align) noexcept {
+  if (ptr) {
+    MemoryPool::deallocateAligned(ptr, size, static_cast<size_t>(align));
+  }
+}
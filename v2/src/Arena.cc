@@ -0,0 +1,104 @@
+#include "Arena.h"
+
+#include "PageCache.h"
+
+namespace memory_pool {
+namespace {
+// 每线程缓存的默认大小span 请求频繁创建销毁Arena时避免反复进出页缓存
+class ArenaSpanCache {
+ public:
+  static constexpr size_t CAPACITY = 16;
+
+  ~ArenaSpanCache() {
+    for (size_t i = 0; i < count_; i++) {
+      PageCache::getInstance().deallocateSpan(spans_[i],
+                                              Arena::DEFAULT_SPAN_PAGES);
+    }
+  }
+
+  void* pop() { return count_ > 0 ? spans_[--count_] : nullptr; }
+  bool push(void* span) {
+    if (count_ == CAPACITY) return false;
+    spans_[count_++] = span;
+    return true;
+  }
+
+ private:
+  void* spans_[CAPACITY] = {};
+  size_t count_ = 0;
+};
+
+thread_local ArenaSpanCache spanCache;
+
+void* acquireSpan(size_t numPages) {
+  if (numPages == Arena::DEFAULT_SPAN_PAGES) {
+    void* span = spanCache.pop();
+    if (span) return span;
+  }
+  return PageCache::getInstance().allocateSpan(numPages);
+}
+
+void releaseSpan(void* span, size_t numPages) {
+  if (numPages == Arena::DEFAULT_SPAN_PAGES && spanCache.push(span)) return;
+  PageCache::getInstance().deallocateSpan(span, numPages);
+}
+}  // namespace
+
+Arena::Arena(size_t spanPages)
+    : spanPages_(spanPages ? spanPages : DEFAULT_SPAN_PAGES),
+      spans_(nullptr),
+      current_(nullptr),
+      end_(nullptr),
+      bytesAllocated_(0),
+      bytesReserved_(0) {}
+
+Arena::~Arena() { reset(); }
+
+void Arena::reset() {
+  SpanHeader* span = spans_;
+  while (span) {
+    SpanHeader* next = span->next;
+    releaseSpan(span, span->numPages);
+    span = next;
+  }
+  spans_ = nullptr;
+  current_ = nullptr;
+  end_ = nullptr;
+  bytesAllocated_ = 0;
+  bytesReserved_ = 0;
+}
+
+void* Arena::allocateSlow(size_t size, size_t align) {
+  // 当前span剩余空间不足 取新的span, 超大请求单独占用足够页数的span
+  // 加上span头、对齐与页取整后溢出的请求直接失败
+  size_t limit = SIZE_MAX - sizeof(SpanHeader) - PageCache::PAGE_SIZE;
+  if (align > limit || size > limit - align) return nullptr;
+  size_t needed = sizeof(SpanHeader) + align + size;
+  size_t numPages = spanPages_;
+  if (needed > numPages * PageCache::PAGE_SIZE) {
+    numPages = (needed + PageCache::PAGE_SIZE - 1) / PageCache::PAGE_SIZE;
+  }
+  void* memory = acquireSpan(numPages);
+  if (!memory) return nullptr;
+
+  SpanHeader* span = static_cast<SpanHeader*>(memory);
+  span->next = spans_;
+  span->numPages = numPages;
+  spans_ = span;
+  bytesReserved_ += numPages * PageCache::PAGE_SIZE;
+
+  char* begin = static_cast<char*>(memory) + sizeof(SpanHeader);
+  char* end = static_cast<char*>(memory) + numPages * PageCache::PAGE_SIZE;
+  // 单独的大span剩余空间更少时保留原span继续分配
+  if (numPages == spanPages_ || end - (begin + size) > end_ - current_) {
+    current_ = begin;
+    end_ = end;
+    return allocate(size, align);
+  }
+  uintptr_t aligned =
+      (reinterpret_cast<uintptr_t>(begin) + align - 1) & ~(uintptr_t(align) - 1);
+  bytesAllocated_ += size;
+  return reinterpret_cast<void*>(aligned);
+}
+
+}  // namespace memory_pool
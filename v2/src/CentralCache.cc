@@ -1,9 +1,11 @@
 #include "CentralCache.h"
 
+#include <algorithm>
+#include <cassert>
 #include <chrono>
 #include <thread>
-#include <unordered_map>
 
+#include "LockProfiler.h"
 #include "PageCache.h"
 namespace memory_pool {
 const std::chrono::milliseconds CentralCache::DELAY_INTERVAL{1000};
@@ -11,7 +13,7 @@ const std::chrono::milliseconds CentralCache::DELAY_INTERVAL{1000};
 // 每次从PageCache获取Span的Page数量
 static const size_t SPAN_PAGES = 8;
 
-CentralCache::CentralCache() {
+CentralCache::CentralCache(PageCache &pageCache) : pageCache_(pageCache) {
   for (auto &ptr : centralFreeList_) {
     ptr.store(nullptr, std::memory_order_relaxed);
   }
@@ -27,87 +29,164 @@ CentralCache::CentralCache() {
   spanCount_.store(0, std::memory_order_relaxed);
 }
 
-void *CentralCache::fetchRange(size_t index) {
-  // 索引检查，申请内存过大时应该直接向系统申请
-  if (index >= FREE_LIST_SIZE) return nullptr;
+uint64_t CentralCache::lock(size_t index) {
+  std::atomic_flag &flag = locks_[index];
+  return LockProfiler::acquire(
+      index, [&flag] { return !flag.test_and_set(std::memory_order_acquire); },
+      [&flag] {
+        while (flag.test_and_set(std::memory_order_acquire)) {
+          std::this_thread::yield();  // 添加线程让步，避免忙等待
+        }
+      });
+}
+
+void CentralCache::unlock(size_t index, uint64_t lockedAt) {
+  std::atomic_flag &flag = locks_[index];
+  LockProfiler::release(index, lockedAt, [&flag] {
+    flag.clear(std::memory_order_release);
+  });
+}
+
+void CentralCache::prepareFork() {
+  for (std::atomic_flag &flag : locks_) {
+    while (flag.test_and_set(std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
+  }
+}
 
-  while (locks_[index].test_and_set(std::memory_order_acquire)) {
-    std::this_thread::yield();  // 添加线程让步，避免忙等待
+void CentralCache::afterFork() {
+  for (std::atomic_flag &flag : locks_) {
+    flag.clear(std::memory_order_release);
   }
+}
+
+void *CentralCache::fetchRange(size_t index) { return fetchRange(index, 1); }
+
+// 批量获取恰好batchNum个内存块, 返回以nullptr结尾的链表
+void *CentralCache::fetchRange(size_t index, size_t batchNum) {
+  // 索引检查，申请内存过大时应该直接向系统申请
+  if (index >= FREE_LIST_SIZE || batchNum == 0) return nullptr;
+  MEMORY_POOL_LATENCY_TIER(TIER_CENTRAL_CACHE);
+
+  uint64_t lockedAt = lock(index);
 
-  void *result = nullptr;
+  void *head = nullptr;
+  void **tail = &head;
+  size_t fetched = 0;
+  SpanTracker *tracker = nullptr;
   try {
-    result = centralFreeList_[index].load(std::memory_order_relaxed);
-    if (!result) {
-      // 中心缓存为空 从页缓存获取新的内存块
-      size_t size = (index + 1) * ALIGNMENT;
-      result = fetchFromPageCache(size);
-      if (!result) {
-        locks_[index].clear(std::memory_order_release);
-        return nullptr;
+    while (fetched < batchNum) {
+      void *current = centralFreeList_[index].load(std::memory_order_relaxed);
+      if (!current) {
+        // 中心缓存为空 从页缓存获取新的span并切分
+        current = refillFromPageCache(index);
+        if (!current) break;
       }
-
-      char *start = static_cast<char *>(result);
-      size_t numPages =
-          (size <= SPAN_PAGES * PageCache::PAGE_SIZE)
-              ? SPAN_PAGES
-              : (size + PageCache::PAGE_SIZE - 1) / PageCache::PAGE_SIZE;
-      // 计算实际块数
-      size_t blockNum = (numPages * PageCache::PAGE_SIZE) / size;
-      if (blockNum > 1) {  // 确保有超过两个块来构造链表
-        for (size_t i = 1; i < blockNum; i++) {
-          void *current = start + (i - 1) * size;
-          void *next = start + i * size;
-          *reinterpret_cast<void **>(current) = next;
+      // 从链头摘下一段连续的块
+      while (current && fetched < batchNum) {
+        *tail = current;
+        tail = reinterpret_cast<void **>(current);
+        // 相邻的块通常属于同一个span, 避免每块都线性查找
+        if (!tracker || !spanContains(tracker, current)) {
+          tracker = getSpanTracker(current);
         }
-        *reinterpret_cast<void **>(start + (blockNum - 1) * size) = nullptr;
-
-        void *next = *reinterpret_cast<void **>(result);
-        // 将result与链表断开
-        *reinterpret_cast<void **>(result) = nullptr;
-        centralFreeList_[index].store(next, std::memory_order_release);
-
-        size_t trackrIndex = spanCount_++;
-        if (trackrIndex < spanTrackers_.size()) {
-          spanTrackers_[trackrIndex].spandAddr.store(start,
-                                                     std::memory_order_release);
-          spanTrackers_[trackrIndex].numPages.store(numPages,
-                                                    std::memory_order_release);
-          spanTrackers_[trackrIndex].blockCount.store(
-              blockNum, std::memory_order_release);
-          spanTrackers_[trackrIndex].freeCount.store(
-              blockNum - 1, std::memory_order::memory_order_release);
+        if (tracker) {
+          tracker->freeCount.fetch_sub(1, std::memory_order_relaxed);
         }
+        current = *reinterpret_cast<void **>(current);
+        fetched++;
       }
-    } else {
-      void *next = *reinterpret_cast<void **>(result);
-      *reinterpret_cast<void **>(result) = nullptr;
-      centralFreeList_[index].store(next, std::memory_order_release);
-
-      SpanTracker *tracker = getSpanTracker(result);
-      if (tracker) {
-        tracker->freeCount.fetch_sub(1, std::memory_order_release);
+      centralFreeList_[index].store(current, std::memory_order_release);
+    }
+    *tail = nullptr;
+
+    // 内存不足时不返回部分结果 已摘下的块放回中心缓存
+    if (fetched < batchNum && head) {
+      *tail = centralFreeList_[index].load(std::memory_order_relaxed);
+      centralFreeList_[index].store(head, std::memory_order_release);
+      for (void *p = head; fetched > 0; p = *reinterpret_cast<void **>(p)) {
+        tracker = getSpanTracker(p);
+        if (tracker) {
+          tracker->freeCount.fetch_add(1, std::memory_order_relaxed);
+        }
+        fetched--;
       }
+      head = nullptr;
     }
   } catch (...) {
-    locks_[index].clear(std::memory_order_release);
+    unlock(index, lockedAt);
     throw;
   }
-  // 释放锁
-  locks_[index].clear(std::memory_order_release);
-  return result;
+  unlock(index, lockedAt);
+  return head;
+}
+
+// 从页缓存获取一个span, 切分成块后挂到中心缓存链表头部 需持有locks_[index]
+void *CentralCache::refillFromPageCache(size_t index) {
+  size_t size = (index + 1) * ALIGNMENT;
+  void *span = fetchFromPageCache(size);
+  if (!span) return nullptr;
+
+  char *start = static_cast<char *>(span);
+  // 块从页对齐的首地址开始切分 保证16/64等倍数大小的块天然对齐
+  assert(reinterpret_cast<uintptr_t>(start) % PageCache::PAGE_SIZE == 0);
+  size_t numPages = spanPages(size);
+  // 计算实际块数
+  size_t blockNum = (numPages * PageCache::PAGE_SIZE) / size;
+  // 块地址按固定步长递增, 循环体只有独立的写操作
+  for (size_t i = 0; i + 1 < blockNum; i++) {
+    *reinterpret_cast<void **>(start + i * size) = start + (i + 1) * size;
+  }
+  // 复用的span中可能残留旧数据 链尾必须显式写入原有的链表(通常为空)
+  *reinterpret_cast<void **>(start + (blockNum - 1) * size) =
+      centralFreeList_[index].load(std::memory_order_relaxed);
+  centralFreeList_[index].store(start, std::memory_order_release);
+
+  SpanTracker *tracker = claimSpanTracker(numPages);
+  if (tracker) {
+    tracker->spandAddr.store(start, std::memory_order_release);
+    tracker->blockCount.store(blockNum, std::memory_order_release);
+    tracker->freeCount.store(blockNum, std::memory_order_release);
+  }
+  return start;
+}
+
+// 占用一个空闲的tracker 优先复用已归还span留下的位置
+SpanTracker *CentralCache::claimSpanTracker(size_t numPages) {
+  while (true) {
+    size_t count = std::min(spanCount_.load(std::memory_order_relaxed),
+                            spanTrackers_.size());
+    for (size_t i = 0; i < count; i++) {
+      size_t expected = 0;
+      if (spanTrackers_[i].numPages.compare_exchange_strong(
+              expected, numPages, std::memory_order_acq_rel)) {
+        return &spanTrackers_[i];
+      }
+    }
+    if (spanCount_.load(std::memory_order_relaxed) >= spanTrackers_.size()) {
+      return nullptr;
+    }
+    // 新位置也可能被并发的扫描抢先占用 失败时重试
+    size_t trackrIndex = spanCount_++;
+    if (trackrIndex >= spanTrackers_.size()) return nullptr;
+    size_t expected = 0;
+    if (spanTrackers_[trackrIndex].numPages.compare_exchange_strong(
+            expected, numPages, std::memory_order_acq_rel)) {
+      return &spanTrackers_[trackrIndex];
+    }
+  }
 }
 
 void CentralCache::returnRange(void *start, size_t size, size_t index) {
   if (!start || index >= FREE_LIST_SIZE) {
     return;
   }
+  MEMORY_POOL_LATENCY_TIER(TIER_CENTRAL_CACHE);
 
   size_t blockSize = (index + 1) * ALIGNMENT;
   size_t blockCount = size / blockSize;
-  while (locks_[index].test_and_set(std::memory_order_acquire)) {
-    std::this_thread::yield();
-  }
+  uint64_t lockedAt = lock(index);
 
   try {
     // 将归还的链表插入中心缓存
@@ -133,10 +212,23 @@ void CentralCache::returnRange(void *start, size_t size, size_t index) {
     }
 
   } catch (...) {
-    locks_[index].clear(std::memory_order_release);
+    unlock(index, lockedAt);
     throw;
   }
-  locks_[index].clear(std::memory_order_release);
+  unlock(index, lockedAt);
+}
+
+size_t CentralCache::getFreeBlockCount(size_t index) {
+  if (index >= FREE_LIST_SIZE) return 0;
+  if (!centralFreeList_[index].load(std::memory_order_relaxed)) return 0;
+  uint64_t lockedAt = lock(index);
+  size_t count = 0;
+  for (void *p = centralFreeList_[index].load(std::memory_order_relaxed); p;
+       p = *reinterpret_cast<void **>(p)) {
+    count++;
+  }
+  unlock(index, lockedAt);
+  return count;
 }
 
 // 检查是否需要延迟归还
@@ -155,19 +247,26 @@ void CentralCache::performDelayedReturn(size_t index) {
   lastReturnTimes_[index] = std::chrono::steady_clock::now();
 
   // 统计每个span的空闲块数
-  std::unordered_map<SpanTracker *, size_t> SpanFreeCounts;
+  // 计数暂存在SpanTracker中 避免在持锁时分配内存(会回调到malloc)
+  SpanTracker *touched[MAX_SPAN_TRACKERS];
+  size_t touchedCount = 0;
+  SpanTracker *tracker = nullptr;
   void *currentBlcok = centralFreeList_[index].load(std::memory_order_relaxed);
   while (currentBlcok) {
-    SpanTracker *tracker = getSpanTracker(currentBlcok);
-    if (tracker) {
-      SpanFreeCounts[tracker]++;
+    if (!tracker || !spanContains(tracker, currentBlcok)) {
+      tracker = getSpanTracker(currentBlcok);
+    }
+    if (tracker && tracker->scanCount++ == 0) {
+      touched[touchedCount++] = tracker;
     }
     currentBlcok = *reinterpret_cast<void **>(currentBlcok);
   }
 
   // 更新每个span的空闲计数并检查是否可以归还
-  for (const auto &[tracker, newFreeBlocks] : SpanFreeCounts) {
-    updateSpanFreeCount(tracker, newFreeBlocks, index);
+  for (size_t i = 0; i < touchedCount; i++) {
+    size_t newFreeBlocks = touched[i]->scanCount;
+    touched[i]->scanCount = 0;
+    updateSpanFreeCount(touched[i], newFreeBlocks, index);
   }
 }
 
@@ -183,7 +282,7 @@ void CentralCache::updateSpanFreeCount(SpanTracker *trakcer,
     size_t numPages = trakcer->numPages.load(std::memory_order_relaxed);
 
     void *head = centralFreeList_[index].load(std::memory_order_relaxed);
-    void *newHead = nullptr;
+    void *newHead = head;
     void *prev = nullptr;
     void *current = head;
     while (current) {
@@ -205,34 +304,68 @@ void CentralCache::updateSpanFreeCount(SpanTracker *trakcer,
     }
 
     centralFreeList_[index].store(newHead, std::memory_order_release);
-    PageCache::getInstance().deallocateSpan(spanAddr, numPages);
+    // 作废tracker 避免同一地址被复用后匹配到旧的span信息
+    trakcer->spandAddr.store(nullptr, std::memory_order_release);
+    trakcer->numPages.store(0, std::memory_order_release);
+    pageCache_.deallocateSpan(spanAddr, numPages);
   }
 }
 
 void *CentralCache::fetchFromPageCache(size_t size) {
-  size_t numPages = (size + PageCache::PAGE_SIZE - 1) / PageCache::PAGE_SIZE;
+  return pageCache_.allocateSpan(spanPages(size), size);
+}
+
+size_t CentralCache::spanPages(size_t size) {
   if (size <= SPAN_PAGES * PageCache::PAGE_SIZE) {
     // 小于32k 固定分配8页
-    return PageCache::getInstance().allocateSpan(SPAN_PAGES);
-  } else {
-    // 大于32k 按需分配
-    return PageCache::getInstance().allocateSpan(numPages);
+    return SPAN_PAGES;
   }
+  // 大于32k 按需分配
+  return (size + PageCache::PAGE_SIZE - 1) / PageCache::PAGE_SIZE;
+}
+
+size_t CentralCache::reserve(size_t index, size_t count) {
+  if (index >= FREE_LIST_SIZE || count == 0) return 0;
+  size_t size = (index + 1) * ALIGNMENT;
+  size_t numPages = spanPages(size);
+  size_t blocksPerSpan = numPages * PageCache::PAGE_SIZE / size;
+  size_t spans = (count + blocksPerSpan - 1) / blocksPerSpan;
+  // 所需的页一次映射并预先缺页 失败时下面照常逐个span向系统申请
+  pageCache_.reserve(spans * numPages);
+
+  size_t carved = 0;
+  uint64_t lockedAt = lock(index);
+  while (carved < spans && refillFromPageCache(index)) carved++;
+  unlock(index, lockedAt);
+  return carved * blocksPerSpan;
+}
+
+void CentralCache::releaseFreeSpans() {
+  for (size_t index = 0; index < FREE_LIST_SIZE; index++) {
+    if (!centralFreeList_[index].load(std::memory_order_relaxed)) continue;
+    uint64_t lockedAt = lock(index);
+    performDelayedReturn(index);
+    unlock(index, lockedAt);
+  }
+}
+
+bool CentralCache::spanContains(SpanTracker *tracker, void *blockAddr) {
+  void *addr = tracker->spandAddr.load(std::memory_order_relaxed);
+  size_t numPages = tracker->numPages.load(std::memory_order_relaxed);
+  return blockAddr >= addr &&
+         blockAddr < static_cast<char *>(addr) + numPages * PageCache::PAGE_SIZE;
 }
 
 SpanTracker *CentralCache::getSpanTracker(void *blockAddr) {
-  for (size_t i = 0; i < spanCount_.load(std::memory_order_relaxed); i++) {
-    void *addr = spanTrackers_[i].spandAddr.load(std::memory_order_relaxed);
-    size_t numPages = spanTrackers_[i].numPages.load(std::memory_order_relaxed);
-    if (blockAddr >= addr && blockAddr < static_cast<char *>(addr) +
-                                             numPages * PageCache::PAGE_SIZE) {
+  // spanCount_会超过数组容量 超出部分的span不被跟踪
+  size_t count = std::min(spanCount_.load(std::memory_order_relaxed),
+                          spanTrackers_.size());
+  for (size_t i = 0; i < count; i++) {
+    if (spanContains(&spanTrackers_[i], blockAddr)) {
       return &spanTrackers_[i];
     }
   }
   return nullptr;
 }
 
-// TODO
-void *CentralCache::fetchRange(size_t index, size_t batchNum) {}
-
 }  // namespace memory_pool
\ No newline at end of file
@@ -0,0 +1,67 @@
+#include "ForkHandler.h"
+
+#include <pthread.h>
+
+#include "CentralCache.h"
+#include "GuardedPool.h"
+#include "Heap.h"
+#include "HeapProfiler.h"
+#include "LockProfiler.h"
+#include "MetadataAllocator.h"
+#include "PageCache.h"
+#include "PoolStats.h"
+#include "RealTimePool.h"
+#include "ThreadCache.h"
+#include "TraceRecorder.h"
+
+namespace memory_pool {
+namespace {
+// 早于main中任何fork完成登记 作为预加载库时在库加载时登记
+const bool installed = [] {
+  return pthread_atfork(ForkHandler::prepare, ForkHandler::parent,
+                        ForkHandler::child) == 0;
+}();
+}  // namespace
+
+void ForkHandler::prepare() {
+  GuardedPool::prepareFork();
+  Heap::prepareFork();
+  HeapProfiler::prepareFork();
+  LockProfiler::prepareFork();
+  TraceRecorder::prepareFork();
+  StatsRegistry::prepareFork();
+  CentralCache::getInstance().prepareFork();
+  PageCache::getInstance().prepareFork();
+  MetadataAllocator::prepareFork();
+}
+
+// 与prepare的顺序相反
+void ForkHandler::unlockPool() {
+  MetadataAllocator::afterFork();
+  PageCache::getInstance().afterFork();
+  CentralCache::getInstance().afterFork();
+  StatsRegistry::afterFork();
+}
+
+void ForkHandler::parent() {
+  unlockPool();
+  TraceRecorder::afterFork();
+  LockProfiler::afterFork();
+  HeapProfiler::afterFork();
+  Heap::afterFork();
+  GuardedPool::afterFork();
+}
+
+void ForkHandler::child() {
+  unlockPool();
+  TraceRecorder::childAfterFork();
+  LockProfiler::afterFork();
+  HeapProfiler::afterFork();
+  Heap::childAfterFork();
+  GuardedPool::afterFork();
+  RealTimePool::childAfterFork();
+  // 所有锁都已释放后才归还 归还时需要重新加锁
+  ThreadCache::reclaimAfterFork();
+}
+
+}  // namespace memory_pool
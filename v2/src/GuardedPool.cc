@@ -0,0 +1,277 @@
+#include "GuardedPool.h"
+
+#include <execinfo.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#include "MetadataAllocator.h"
+#include "PageCache.h"
+#include "PageMap.h"
+#include "ThreadCache.h"
+
+namespace memory_pool {
+namespace {
+constexpr size_t PAGE_SIZE = PageCache::PAGE_SIZE;
+
+enum SlotState { SLOT_UNUSED, SLOT_ALLOCATED, SLOT_FREED };
+
+// 一个槽位 已分配时页映射指向span, getObjectSize据此返回可用大小
+struct Slot {
+  uintptr_t ptr;
+  size_t size;
+  int state;
+  int allocTid;
+  int freeTid;
+  int allocDepth;
+  int freeDepth;
+  void* allocStack[GuardedPool::MAX_DEPTH];
+  void* freeStack[GuardedPool::MAX_DEPTH];
+  Span span;
+};
+
+// 以下状态受slotMutex保护 区域与槽位表建立后不再释放
+std::mutex slotMutex;
+uintptr_t region = 0;
+Slot* slotTable = nullptr;
+size_t slotCount = 0;
+// 空闲槽位的先进先出队列 刚释放的槽位最晚被复用
+size_t* freeQueue = nullptr;
+size_t queueHead = 0;
+size_t queueSize = 0;
+
+std::atomic<size_t> sampleRate{GuardedPool::DEFAULT_SAMPLE_RATE};
+struct sigaction previousSegv;
+struct sigaction previousBus;
+
+thread_local uint64_t rngState MEMORY_POOL_TLS_MODEL = 0;
+
+int currentTid() { return static_cast<int>(syscall(SYS_gettid)); }
+
+// 第0页是保护页 之后槽位与保护页交替
+char* slotPage(size_t index) {
+  return reinterpret_cast<char*>(region + (2 * index + 1) * PAGE_SIZE);
+}
+
+// 信号处理函数中也会调用 不经过stdio的缓冲区
+void writeError(const char* format, ...) {
+  char buf[512];
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+  if (n <= 0) return;
+  size_t len = std::min(static_cast<size_t>(n), sizeof(buf) - 1);
+  ssize_t written = write(STDERR_FILENO, buf, len);
+  (void)written;
+}
+
+void printStack(const char* title, int tid, void* const* stack, int depth) {
+  writeError("%s by thread %d:\n", title, tid);
+  backtrace_symbols_fd(stack, depth, STDERR_FILENO);
+}
+
+void report(const char* kind, uintptr_t addr, const Slot* slot) {
+  writeError("==%d== GuardedPool: %s at address %#zx\n",
+             static_cast<int>(getpid()), kind, static_cast<size_t>(addr));
+  if (!slot || slot->state == SLOT_UNUSED) return;
+  if (addr < slot->ptr) {
+    writeError("%zu bytes before", static_cast<size_t>(slot->ptr - addr));
+  } else if (addr >= slot->ptr + slot->size) {
+    writeError("%zu bytes after",
+               static_cast<size_t>(addr - slot->ptr - slot->size));
+  } else {
+    writeError("%zu bytes inside", static_cast<size_t>(addr - slot->ptr));
+  }
+  writeError(" the %zu-byte block at %#zx\n", slot->size,
+             static_cast<size_t>(slot->ptr));
+  printStack("allocated", slot->allocTid, slot->allocStack, slot->allocDepth);
+  if (slot->state == SLOT_FREED) {
+    printStack("freed", slot->freeTid, slot->freeStack, slot->freeDepth);
+  }
+}
+
+// 诊断保护区域内的一次访问 不加锁, 槽位状态可能正在变化
+void describeFault(uintptr_t addr) {
+  size_t page = (addr - region) / PAGE_SIZE;
+  if (page % 2 == 1) {
+    const Slot& slot = slotTable[page / 2];
+    report(slot.state == SLOT_FREED ? "use-after-free" : "wild-access", addr,
+           &slot);
+    return;
+  }
+  // 保护页: 离左侧槽位的块尾更近时为上溢, 否则为右侧槽位的下溢
+  // 块在槽位中右对齐, 上溢通常紧接着落在下一页的开头
+  size_t right = page / 2;
+  const Slot* leftSlot = right > 0 ? &slotTable[right - 1] : nullptr;
+  const Slot* rightSlot = right < slotCount ? &slotTable[right] : nullptr;
+  if (leftSlot && leftSlot->state == SLOT_UNUSED) leftSlot = nullptr;
+  if (rightSlot && rightSlot->state == SLOT_UNUSED) rightSlot = nullptr;
+  bool nearLeft = (addr - region) % PAGE_SIZE < PAGE_SIZE / 2;
+  if (leftSlot && (nearLeft || !rightSlot)) {
+    report("buffer-overflow", addr, leftSlot);
+  } else if (rightSlot) {
+    report("buffer-underflow", addr, rightSlot);
+  } else {
+    report("wild-access", addr, nullptr);
+  }
+}
+
+void onFault(int signum, siginfo_t* info, void* context) {
+  uintptr_t addr = reinterpret_cast<uintptr_t>(info->si_addr);
+  struct sigaction* previous =
+      signum == SIGSEGV ? &previousSegv : &previousBus;
+  if (GuardedPool::contains(info->si_addr)) {
+    describeFault(addr);
+    // 恢复原处理方式后返回 再次触发的错误按原方式终止进程
+    sigaction(signum, previous, nullptr);
+    return;
+  }
+  // 不是保护区域的错误 交给原来的处理函数
+  if (previous->sa_flags & SA_SIGINFO) {
+    previous->sa_sigaction(signum, info, context);
+  } else if (previous->sa_handler != SIG_DFL &&
+             previous->sa_handler != SIG_IGN) {
+    previous->sa_handler(signum);
+  } else {
+    sigaction(signum, previous, nullptr);
+  }
+}
+}  // namespace
+
+bool GuardedPool::enable(size_t rate, size_t slots) {
+  std::lock_guard<std::mutex> lock(slotMutex);
+  sampleRate.store(rate ? rate : 1, std::memory_order_relaxed);
+  if (!slotTable) {
+    if (slots == 0) return false;
+    size_t size = (2 * slots + 1) * PAGE_SIZE;
+    void* memory = mmap(nullptr, size, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED) return false;
+    Slot* table = static_cast<Slot*>(
+        MetadataAllocator::allocate(slots * sizeof(Slot)));
+    size_t* queue = static_cast<size_t*>(
+        MetadataAllocator::allocate(slots * sizeof(size_t)));
+    if (!table || !queue) {
+      MetadataAllocator::deallocate(table, slots * sizeof(Slot));
+      MetadataAllocator::deallocate(queue, slots * sizeof(size_t));
+      munmap(memory, size);
+      return false;
+    }
+    memset(table, 0, slots * sizeof(Slot));
+    for (size_t i = 0; i < slots; i++) queue[i] = i;
+
+    // 首次调用backtrace会加载libgcc并分配内存 提前在采样路径之外完成
+    void* frames[1];
+    backtrace(frames, 1);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = onFault;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigaction(SIGSEGV, &action, &previousSegv);
+    sigaction(SIGBUS, &action, &previousBus);
+
+    region = reinterpret_cast<uintptr_t>(memory);
+    slotTable = table;
+    slotCount = slots;
+    freeQueue = queue;
+    queueHead = 0;
+    queueSize = slots;
+    regionBegin_.store(region, std::memory_order_relaxed);
+    regionSize_.store(size, std::memory_order_release);
+  }
+  enabled_.store(true, std::memory_order_release);
+  ThreadCache::getInstance()->guardCountdown_ = nextSampleCountdown();
+  return true;
+}
+
+void GuardedPool::disable() {
+  enabled_.store(false, std::memory_order_relaxed);
+}
+
+size_t GuardedPool::nextSampleCountdown() {
+  size_t rate = sampleRate.load(std::memory_order_relaxed);
+  if (rate <= 1) return 0;
+  // xorshift64 每线程独立 以线程状态变量的地址作种子
+  if (rngState == 0) {
+    rngState = reinterpret_cast<uintptr_t>(&rngState) | 1;
+  }
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 7;
+  rngState ^= rngState << 17;
+  // [0, 2 * rate - 2]上的均匀分布 平均每rate次分配采样一次
+  return rngState % (2 * rate - 1);
+}
+
+void* GuardedPool::allocate(size_t size) {
+  if (size == 0 || size > MAX_SIZE) return nullptr;
+  // 在锁外取调用栈
+  void* stack[MAX_DEPTH];
+  int depth = backtrace(stack, MAX_DEPTH);
+
+  std::lock_guard<std::mutex> lock(slotMutex);
+  if (queueSize == 0) return nullptr;
+  size_t index = freeQueue[queueHead];
+  char* page = slotPage(index);
+  if (mprotect(page, PAGE_SIZE, PROT_READ | PROT_WRITE) != 0) return nullptr;
+  queueHead = (queueHead + 1) % slotCount;
+  queueSize--;
+
+  // 与大小类的块相同 可用大小按ALIGNMENT取整, 块尾紧贴下一个保护页
+  size_t usable = SizeClass::roundUp(size);
+  Slot& slot = slotTable[index];
+  slot.ptr = reinterpret_cast<uintptr_t>(page + PAGE_SIZE - usable);
+  slot.size = size;
+  slot.state = SLOT_ALLOCATED;
+  slot.allocTid = currentTid();
+  slot.allocDepth = depth;
+  memcpy(slot.allocStack, stack, depth * sizeof(void*));
+  slot.freeDepth = 0;
+  slot.span = Span{page, 1, usable, false, nullptr};
+  PageMap::getInstance().set(page, 1, &slot.span);
+  return reinterpret_cast<void*>(slot.ptr);
+}
+
+void GuardedPool::deallocate(void* ptr) {
+  void* stack[MAX_DEPTH];
+  int depth = backtrace(stack, MAX_DEPTH);
+
+  std::lock_guard<std::mutex> lock(slotMutex);
+  uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+  size_t page = (addr - region) / PAGE_SIZE;
+  Slot* slot = page % 2 == 1 ? &slotTable[page / 2] : nullptr;
+  if (!slot || slot->state != SLOT_ALLOCATED || slot->ptr != addr) {
+    bool doubleFree = slot && slot->state == SLOT_FREED && slot->ptr == addr;
+    report(doubleFree ? "double-free" : "invalid-free", addr, slot);
+    printStack("this free", currentTid(), stack, depth);
+    abort();
+  }
+
+  // 整页不可访问 物理页同时归还系统
+  char* slotAddr = slotPage(page / 2);
+  PageMap::getInstance().set(slotAddr, 1, nullptr);
+  mprotect(slotAddr, PAGE_SIZE, PROT_NONE);
+  madvise(slotAddr, PAGE_SIZE, MADV_DONTNEED);
+  slot->state = SLOT_FREED;
+  slot->freeTid = currentTid();
+  slot->freeDepth = depth;
+  memcpy(slot->freeStack, stack, depth * sizeof(void*));
+  freeQueue[(queueHead + queueSize) % slotCount] = page / 2;
+  queueSize++;
+}
+
+void GuardedPool::prepareFork() { slotMutex.lock(); }
+
+void GuardedPool::afterFork() { slotMutex.unlock(); }
+
+}  // namespace memory_pool
@@ -0,0 +1,273 @@
+#include "Heap.h"
+
+#include <new>
+
+#include "CentralCache.h"
+#include "MetadataAllocator.h"
+#include "PageCache.h"
+#include "ThreadCache.h"
+
+namespace memory_pool {
+// 每个线程为每个堆持有一个线程缓存 计数由线程缓存写入stats
+struct Heap::LocalCache {
+  ThreadCache cache;
+  ThreadStats stats;
+  LocalCache* next;      // 堆的全部线程缓存链表
+  LocalCache* nextFree;  // 可复用链表
+
+  LocalCache(CentralCache* central, PageCache* pageCache)
+      : cache(central, pageCache, &stats),
+        stats(),
+        next(nullptr),
+        nextFree(nullptr) {}
+};
+
+namespace {
+// 存活堆的登记表 线程退出时据此判断线程缓存所属的堆是否已销毁
+std::mutex registryMutex;
+Heap* liveHeaps = nullptr;
+// 堆id不复用 新堆落在旧堆的地址上也不会误用旧的线程缓存
+std::atomic<uint64_t> nextHeapId{1};
+}  // namespace
+
+// 线程到各个堆的线程缓存的小表 同时使用的堆超过容量时轮流替换
+struct HeapCacheTable {
+  static constexpr size_t CAPACITY = 8;
+  struct Slot {
+    uint64_t heapId;  // 0表示空槽
+    Heap::LocalCache* cache;
+  };
+
+  ~HeapCacheTable() {
+    for (Slot& slot : slots) {
+      if (slot.heapId != 0) Heap::releaseLocalCache(slot.heapId, slot.cache);
+    }
+  }
+
+  Slot slots[CAPACITY] = {};
+  size_t nextVictim = 0;
+};
+
+namespace {
+thread_local HeapCacheTable heapCaches;
+}  // namespace
+
+Heap::Heap(size_t memoryLimit)
+    : id_(nextHeapId.fetch_add(1, std::memory_order_relaxed)),
+      pageCache_(new PageCache()),
+      central_(new CentralCache(*pageCache_)),
+      caches_(nullptr),
+      freeCaches_(nullptr),
+      cacheCount_(0),
+      nextLive_(nullptr) {
+  pageCache_->setMemoryLimit(memoryLimit);
+  std::lock_guard<std::mutex> lock(registryMutex);
+  nextLive_ = liveHeaps;
+  liveHeaps = this;
+}
+
+Heap::~Heap() { destroy(); }
+
+void* Heap::allocate(size_t size) {
+  LocalCache* local = getLocalCache();
+  if (!local) return nullptr;
+  return local->cache.allocate(size);
+}
+
+void Heap::deallocate(void* ptr, size_t size) {
+  if (!ptr) return;
+  if (LocalCache* local = getLocalCache()) {
+    local->cache.deallocate(ptr, size);
+    return;
+  }
+  // 无法创建线程缓存时直接归还中心缓存或页缓存 不计入统计
+  if (size > MAX_BYTES) {
+    pageCache_->deallocateSpan(
+        ptr, (size + PageCache::PAGE_SIZE - 1) / PageCache::PAGE_SIZE);
+    return;
+  }
+  if (size == 0) size = ALIGNMENT;
+  *reinterpret_cast<void**>(ptr) = nullptr;
+  central_->returnRange(ptr, SizeClass::roundUp(size),
+                        SizeClass::getIndex(size));
+}
+
+void Heap::deallocate(void* ptr) {
+  if (!ptr) return;
+  deallocate(ptr, PageCache::getObjectSize(ptr));
+}
+
+bool Heap::reserve(size_t size, size_t count, bool fillThreadCache) {
+  LocalCache* local = getLocalCache();
+  if (!local) return false;
+  return local->cache.reserve(size, count, fillThreadCache);
+}
+
+void Heap::setMemoryLimit(size_t bytes) { pageCache_->setMemoryLimit(bytes); }
+
+HeapStats Heap::getStats() {
+  HeapStats stats = {};
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (LocalCache* local = caches_; local; local = local->next) {
+    const ThreadStats& counts = local->stats;
+    for (size_t i = 0; i < FREE_LIST_SIZE; i++) {
+      size_t allocs = counts.allocCount[i].load(std::memory_order_relaxed);
+      size_t frees = counts.freeCount[i].load(std::memory_order_relaxed);
+      stats.allocCount += allocs;
+      stats.freeCount += frees;
+      stats.allocatedBytes += allocs * (i + 1) * ALIGNMENT;
+      stats.freedBytes += frees * (i + 1) * ALIGNMENT;
+    }
+    stats.allocCount += counts.largeAllocCount.load(std::memory_order_relaxed);
+    stats.freeCount += counts.largeFreeCount.load(std::memory_order_relaxed);
+    stats.allocatedBytes +=
+        counts.largeAllocBytes.load(std::memory_order_relaxed);
+    stats.freedBytes += counts.largeFreeBytes.load(std::memory_order_relaxed);
+  }
+  // 各线程计数不同步 读到的释放可能先于分配
+  stats.liveBytes = stats.allocatedBytes > stats.freedBytes
+                        ? stats.allocatedBytes - stats.freedBytes
+                        : 0;
+  stats.mappedBytes = pageCache_->getMappedBytes();
+  stats.memoryLimit = pageCache_->memoryLimit_;
+  stats.threadCaches = cacheCount_;
+  return stats;
+}
+
+void Heap::destroy() {
+  // 持有登记表锁 保证没有退出中的线程正在向本堆归还线程缓存
+  std::lock_guard<std::mutex> lock(registryMutex);
+  if (!pageCache_) return;
+  for (Heap** link = &liveHeaps; *link; link = &(*link)->nextLive_) {
+    if (*link == this) {
+      *link = nextLive_;
+      break;
+    }
+  }
+  // 当前线程的槽位直接清空 其他线程的槽位在替换或退出时发现堆已销毁
+  for (HeapCacheTable::Slot& slot : heapCaches.slots) {
+    if (slot.heapId == id_) slot = HeapCacheTable::Slot{};
+  }
+  pageCache_->releaseAll();
+  // 其他线程的缓存表在发现堆已销毁后不再访问这些线程缓存
+  while (caches_) {
+    LocalCache* local = caches_;
+    caches_ = local->next;
+    local->~LocalCache();
+    MetadataAllocator::deallocate(local, sizeof(LocalCache));
+  }
+  delete central_;
+  delete pageCache_;
+  central_ = nullptr;
+  pageCache_ = nullptr;
+  caches_ = nullptr;
+  freeCaches_ = nullptr;
+}
+
+Heap::LocalCache* Heap::getLocalCache() {
+  for (HeapCacheTable::Slot& slot : heapCaches.slots) {
+    if (slot.heapId == id_) return slot.cache;
+  }
+  return attachLocalCache();
+}
+
+Heap::LocalCache* Heap::attachLocalCache() {
+  LocalCache* local = acquireLocalCache();
+  if (!local) return nullptr;
+
+  HeapCacheTable::Slot* target = nullptr;
+  for (HeapCacheTable::Slot& slot : heapCaches.slots) {
+    if (slot.heapId == 0) {
+      target = &slot;
+      break;
+    }
+  }
+  if (!target) {
+    target = &heapCaches.slots[heapCaches.nextVictim];
+    heapCaches.nextVictim =
+        (heapCaches.nextVictim + 1) % HeapCacheTable::CAPACITY;
+    releaseLocalCache(target->heapId, target->cache);
+  }
+  target->heapId = id_;
+  target->cache = local;
+  return local;
+}
+
+Heap::LocalCache* Heap::acquireLocalCache() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (freeCaches_) {
+    LocalCache* local = freeCaches_;
+    freeCaches_ = local->nextFree;
+    local->nextFree = nullptr;
+    return local;
+  }
+  // 线程缓存约1.3MB 不计入堆的内存上限, 否则小上限的堆无法分配
+  void* memory = MetadataAllocator::allocate(sizeof(LocalCache));
+  if (!memory) return nullptr;
+  LocalCache* local = new (memory) LocalCache(central_, pageCache_);
+  local->next = caches_;
+  caches_ = local;
+  cacheCount_++;
+  return local;
+}
+
+void Heap::releaseLocalCache(uint64_t heapId, LocalCache* cache) {
+  std::lock_guard<std::mutex> registryLock(registryMutex);
+  for (Heap* heap = liveHeaps; heap; heap = heap->nextLive_) {
+    if (heap->id_ != heapId) continue;
+    // 空闲块归还中心缓存 供其他线程使用, 计数保留在线程缓存中
+    cache->cache.flushAll();
+    std::lock_guard<std::mutex> lock(heap->mutex_);
+    cache->nextFree = heap->freeCaches_;
+    heap->freeCaches_ = cache;
+    return;
+  }
+}
+
+void Heap::prepareFork() {
+  registryMutex.lock();
+  for (Heap* heap = liveHeaps; heap; heap = heap->nextLive_) {
+    heap->mutex_.lock();
+    heap->central_->prepareFork();
+    heap->pageCache_->prepareFork();
+  }
+}
+
+void Heap::afterFork() {
+  for (Heap* heap = liveHeaps; heap; heap = heap->nextLive_) {
+    heap->pageCache_->afterFork();
+    heap->central_->afterFork();
+    heap->mutex_.unlock();
+  }
+  registryMutex.unlock();
+}
+
+void Heap::childAfterFork() {
+  afterFork();
+  std::lock_guard<std::mutex> registryLock(registryMutex);
+  for (Heap* heap = liveHeaps; heap; heap = heap->nextLive_) {
+    // 当前线程仍在使用的线程缓存留在自己的缓存表中
+    auto ownedByCurrent = [heap](const LocalCache* local) {
+      for (const HeapCacheTable::Slot& slot : heapCaches.slots) {
+        if (slot.heapId == heap->id_ && slot.cache == local) return true;
+      }
+      return false;
+    };
+    std::lock_guard<std::mutex> lock(heap->mutex_);
+    for (LocalCache* local = heap->caches_; local; local = local->next) {
+      if (ownedByCurrent(local) || heap->isFreeCache(local)) continue;
+      local->cache.flushAll();
+      local->nextFree = heap->freeCaches_;
+      heap->freeCaches_ = local;
+    }
+  }
+}
+
+bool Heap::isFreeCache(const LocalCache* local) const {
+  for (LocalCache* free = freeCaches_; free; free = free->nextFree) {
+    if (free == local) return true;
+  }
+  return false;
+}
+
+}  // namespace memory_pool
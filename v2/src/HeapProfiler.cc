@@ -0,0 +1,328 @@
+#include "HeapProfiler.h"
+
+#include <execinfo.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+#include "MetadataAllocator.h"
+#include "ThreadCache.h"
+#include "common.h"
+
+namespace memory_pool {
+namespace {
+// 同一调用栈的采样汇总
+struct StackBucket {
+  uintptr_t hash;
+  StackBucket* next;
+  size_t allocCount;
+  size_t allocBytes;
+  size_t liveCount;
+  size_t liveBytes;
+  int depth;
+  void* stack[HeapProfiler::MAX_DEPTH];
+};
+
+// 尚未释放的采样
+struct LiveSample {
+  void* ptr;
+  size_t size;
+  StackBucket* bucket;
+  LiveSample* next;
+};
+
+constexpr size_t STACK_TABLE_SIZE = 1024;
+constexpr size_t LIVE_TABLE_SIZE = 4096;
+// 栈底的两层是recordAlloc与ThreadCache::allocateSampled
+constexpr int SKIP_FRAMES = 2;
+
+// 以下表项都受profilerMutex保护 节点来自元数据分配器, 不会回调malloc
+std::mutex profilerMutex;
+StackBucket* stackTable[STACK_TABLE_SIZE];
+LiveSample* liveTable[LIVE_TABLE_SIZE];
+size_t liveSamples = 0;
+
+std::atomic<size_t> sampleInterval{HeapProfiler::DEFAULT_SAMPLE_INTERVAL};
+std::atomic<bool> dumpRequested{false};
+std::atomic<int> dumpSequence{0};
+char dumpPrefix[256];
+
+// 采样与输出期间本线程的分配不再采样 避免重入
+thread_local bool inProfiler MEMORY_POOL_TLS_MODEL = false;
+thread_local uint64_t rngState MEMORY_POOL_TLS_MODEL = 0;
+
+uintptr_t hashStack(void* const* stack, int depth) {
+  uintptr_t hash = 0;
+  for (int i = 0; i < depth; i++) {
+    hash = hash * 31 + reinterpret_cast<uintptr_t>(stack[i]);
+    hash ^= hash >> 17;
+  }
+  return hash;
+}
+
+size_t liveIndex(const void* ptr) {
+  // 采样的内存都是整页 低12位没有区分度
+  return (reinterpret_cast<uintptr_t>(ptr) >> 12) % LIVE_TABLE_SIZE;
+}
+
+// 需持有profilerMutex
+StackBucket* findBucket(void* const* stack, int depth) {
+  uintptr_t hash = hashStack(stack, depth);
+  StackBucket*& head = stackTable[hash % STACK_TABLE_SIZE];
+  for (StackBucket* bucket = head; bucket; bucket = bucket->next) {
+    if (bucket->hash == hash && bucket->depth == depth &&
+        memcmp(bucket->stack, stack, depth * sizeof(void*)) == 0) {
+      return bucket;
+    }
+  }
+  StackBucket* bucket = static_cast<StackBucket*>(
+      MetadataAllocator::allocate(sizeof(StackBucket)));
+  if (!bucket) return nullptr;
+  memset(bucket, 0, sizeof(StackBucket));
+  bucket->hash = hash;
+  bucket->depth = depth;
+  memcpy(bucket->stack, stack, depth * sizeof(void*));
+  bucket->next = head;
+  head = bucket;
+  return bucket;
+}
+
+// 带缓冲的文件描述符输出 格式化不经过stdio的堆缓冲区
+class FdWriter {
+ public:
+  explicit FdWriter(int fd) : fd_(fd), len_(0), ok_(true) {}
+  ~FdWriter() { flush(); }
+
+  void print(const char* format, ...) {
+    if (sizeof(buf_) - len_ < 256) flush();
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf_ + len_, sizeof(buf_) - len_, format, args);
+    va_end(args);
+    if (n > 0) {
+      len_ += std::min(static_cast<size_t>(n), sizeof(buf_) - len_ - 1);
+    }
+  }
+  void write(const char* data, size_t size) {
+    flush();
+    writeAll(data, size);
+  }
+  void flush() {
+    writeAll(buf_, len_);
+    len_ = 0;
+  }
+  bool ok() const { return ok_; }
+
+ private:
+  void writeAll(const char* data, size_t size) {
+    while (ok_ && size > 0) {
+      ssize_t n = ::write(fd_, data, size);
+      if (n <= 0) {
+        ok_ = false;
+        break;
+      }
+      data += n;
+      size -= n;
+    }
+  }
+
+  int fd_;
+  char buf_[4096];
+  size_t len_;
+  bool ok_;
+};
+
+void onDumpSignal(int) {
+  dumpRequested.store(true, std::memory_order_relaxed);
+}
+}  // namespace
+
+void HeapProfiler::start(size_t interval) {
+  sampleInterval.store(interval ? interval : 1, std::memory_order_relaxed);
+  // 首次调用backtrace会加载libgcc并分配内存 提前在采样路径之外完成
+  inProfiler = true;
+  void* frames[1];
+  backtrace(frames, 1);
+  inProfiler = false;
+
+  {
+    std::lock_guard<std::mutex> lock(profilerMutex);
+    tracking_.store(true, std::memory_order_relaxed);
+    enabled_.store(true, std::memory_order_relaxed);
+  }
+  ThreadCache::getInstance()->bytesUntilSample_ = nextSampleDistance();
+}
+
+void HeapProfiler::stop() {
+  std::lock_guard<std::mutex> lock(profilerMutex);
+  enabled_.store(false, std::memory_order_relaxed);
+  tracking_.store(liveSamples > 0, std::memory_order_relaxed);
+}
+
+bool HeapProfiler::shouldSample() {
+  return enabled_.load(std::memory_order_relaxed) && !inProfiler;
+}
+
+size_t HeapProfiler::nextSampleDistance() {
+  // xorshift64 每线程独立 以线程状态变量的地址作种子
+  if (rngState == 0) {
+    rngState = reinterpret_cast<uintptr_t>(&rngState) | 1;
+  }
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 7;
+  rngState ^= rngState << 17;
+  // 均匀分布变换为均值为sampleInterval的指数分布
+  double u = static_cast<double>(rngState >> 11) / 9007199254740992.0;
+  double distance = -std::log(1.0 - u) *
+                    sampleInterval.load(std::memory_order_relaxed);
+  if (distance < 1) return 1;
+  if (distance > DISABLED_RECHECK_BYTES * 64.0) {
+    return DISABLED_RECHECK_BYTES * 64;
+  }
+  return static_cast<size_t>(distance);
+}
+
+void HeapProfiler::recordAlloc(void* ptr, size_t size) {
+  inProfiler = true;
+  void* frames[MAX_DEPTH + SKIP_FRAMES];
+  int depth = backtrace(frames, MAX_DEPTH + SKIP_FRAMES);
+  int skip = depth > SKIP_FRAMES ? SKIP_FRAMES : 0;
+
+  LiveSample* sample = static_cast<LiveSample*>(
+      MetadataAllocator::allocate(sizeof(LiveSample)));
+  std::lock_guard<std::mutex> lock(profilerMutex);
+  StackBucket* bucket = findBucket(frames + skip, depth - skip);
+  if (!bucket || !sample) {
+    MetadataAllocator::deallocate(sample, sizeof(LiveSample));
+    inProfiler = false;
+    return;
+  }
+  bucket->allocCount++;
+  bucket->allocBytes += size;
+  bucket->liveCount++;
+  bucket->liveBytes += size;
+
+  sample->ptr = ptr;
+  sample->size = size;
+  sample->bucket = bucket;
+  LiveSample*& head = liveTable[liveIndex(ptr)];
+  sample->next = head;
+  head = sample;
+  liveSamples++;
+  // 与stop()同在锁内更新 保证已记录的采样释放时一定会被检查
+  tracking_.store(true, std::memory_order_relaxed);
+  inProfiler = false;
+}
+
+void HeapProfiler::recordFree(void* ptr) {
+  LiveSample* found = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(profilerMutex);
+    for (LiveSample** link = &liveTable[liveIndex(ptr)]; *link;
+         link = &(*link)->next) {
+      if ((*link)->ptr == ptr) {
+        found = *link;
+        *link = found->next;
+        break;
+      }
+    }
+    if (!found) return;
+    found->bucket->liveCount--;
+    found->bucket->liveBytes -= found->size;
+    liveSamples--;
+    if (liveSamples == 0 && !enabled_.load(std::memory_order_relaxed)) {
+      tracking_.store(false, std::memory_order_relaxed);
+    }
+  }
+  MetadataAllocator::deallocate(found, sizeof(LiveSample));
+}
+
+bool HeapProfiler::dump(const char* path) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) return false;
+  bool ok = dump(fd);
+  return close(fd) == 0 && ok;
+}
+
+bool HeapProfiler::dump(int fd) {
+  bool wasInProfiler = inProfiler;
+  inProfiler = true;
+  FdWriter out(fd);
+  {
+    std::lock_guard<std::mutex> lock(profilerMutex);
+    size_t liveCount = 0, liveBytes = 0, allocCount = 0, allocBytes = 0;
+    for (StackBucket* head : stackTable) {
+      for (StackBucket* bucket = head; bucket; bucket = bucket->next) {
+        liveCount += bucket->liveCount;
+        liveBytes += bucket->liveBytes;
+        allocCount += bucket->allocCount;
+        allocBytes += bucket->allocBytes;
+      }
+    }
+    // 记录的是采样值 pprof按采样间隔换算为估计值
+    out.print("heap profile: %6zu: %8zu [%6zu: %8zu] @ heap_v2/%zu\n",
+              liveCount, liveBytes, allocCount, allocBytes,
+              sampleInterval.load(std::memory_order_relaxed));
+    for (StackBucket* head : stackTable) {
+      for (StackBucket* bucket = head; bucket; bucket = bucket->next) {
+        out.print("%6zu: %8zu [%6zu: %8zu] @", bucket->liveCount,
+                  bucket->liveBytes, bucket->allocCount, bucket->allocBytes);
+        for (int i = 0; i < bucket->depth; i++) {
+          out.print(" %p", bucket->stack[i]);
+        }
+        out.print("\n");
+      }
+    }
+  }
+
+  // pprof据此把地址对应到各个映像
+  out.print("\nMAPPED_LIBRARIES:\n");
+  int maps = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+  if (maps >= 0) {
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(maps, buf, sizeof(buf))) > 0) {
+      out.write(buf, n);
+    }
+    close(maps);
+  }
+  out.flush();
+  inProfiler = wasInProfiler;
+  return out.ok();
+}
+
+bool HeapProfiler::dumpOnSignal(int signum, const char* pathPrefix) {
+  snprintf(dumpPrefix, sizeof(dumpPrefix), "%s", pathPrefix);
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = onDumpSignal;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  return sigaction(signum, &action, nullptr) == 0;
+}
+
+// 信号处理函数中不能加锁或写文件 只置标志, 由之后的采样路径写出
+void HeapProfiler::pollDumpRequest() {
+  if (!dumpRequested.load(std::memory_order_relaxed) ||
+      !dumpRequested.exchange(false)) {
+    return;
+  }
+  char path[320];
+  snprintf(path, sizeof(path), "%s.%d.%d.heap", dumpPrefix,
+           static_cast<int>(getpid()), dumpSequence.fetch_add(1));
+  dump(path);
+}
+
+void HeapProfiler::prepareFork() { profilerMutex.lock(); }
+
+void HeapProfiler::afterFork() { profilerMutex.unlock(); }
+
+}  // namespace memory_pool
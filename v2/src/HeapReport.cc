@@ -0,0 +1,193 @@
+#include "HeapReport.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+
+#include "CentralCache.h"
+#include "PageCache.h"
+#include "ThreadCache.h"
+
+namespace memory_pool {
+namespace {
+// 包含addr的span 不存在时返回nullptr
+SpanInfo* findSpan(PageCache::SpanList& spans, uintptr_t addr) {
+  auto it = std::upper_bound(
+      spans.begin(), spans.end(), addr,
+      [](uintptr_t a, const SpanInfo& span) { return a < span.address; });
+  if (it == spans.begin()) return nullptr;
+  --it;
+  if (addr >= it->address + it->numPages * PageCache::PAGE_SIZE) {
+    return nullptr;
+  }
+  return &*it;
+}
+
+// 统计span中驻留物理内存的页数 映射已失效时返回0
+size_t residentPages(const SpanInfo& span) {
+  unsigned char vec[256];
+  size_t resident = 0;
+  for (size_t done = 0; done < span.numPages; done += sizeof(vec)) {
+    size_t pages = std::min(span.numPages - done, sizeof(vec));
+    void* addr =
+        reinterpret_cast<void*>(span.address + done * PageCache::PAGE_SIZE);
+    if (mincore(addr, pages * PageCache::PAGE_SIZE, vec) != 0) break;
+    for (size_t i = 0; i < pages; i++) resident += vec[i] & 1;
+  }
+  return resident;
+}
+}  // namespace
+
+HeapReport HeapReport::collect() {
+  HeapReport report = {};
+  PageCache::SpanList spans;
+  PageCache::getInstance().getSpans(&spans);
+
+  // 按大小类逐个遍历中心缓存与当前线程缓存的空闲块 归入所在span
+  CentralCache& central = CentralCache::getInstance();
+  ThreadCache* cache = ThreadCache::getInstance();
+  std::vector<size_t> indexes;
+  for (const SpanInfo& span : spans) {
+    if (!span.free && span.objSize && !span.sampled) {
+      indexes.push_back(SizeClass::getIndex(span.objSize));
+    }
+  }
+  std::sort(indexes.begin(), indexes.end());
+  indexes.erase(std::unique(indexes.begin(), indexes.end()), indexes.end());
+  auto countFree = [&spans](void* block) {
+    SpanInfo* span = findSpan(spans, reinterpret_cast<uintptr_t>(block));
+    if (span && span->objSize) span->freeBlocks++;
+  };
+  for (size_t index : indexes) {
+    central.forEachFreeBlock(index, countFree);
+    cache->forEachFreeBlock(index, countFree);
+  }
+
+  // sizeClasses与已排序的indexes一一对应
+  report.sizeClasses.resize(indexes.size());
+  for (size_t i = 0; i < indexes.size(); i++) {
+    report.sizeClasses[i].size = (indexes[i] + 1) * ALIGNMENT;
+  }
+  for (SpanInfo& span : spans) {
+    // 快照之间不同步 空闲块数可能超过span的块数
+    span.freeBlocks = std::min(span.freeBlocks, span.blockCount);
+    span.liveBlocks = span.blockCount - span.freeBlocks;
+    span.residentPages = residentPages(span);
+    span.released = span.residentPages == 0;
+    size_t bytes = span.numPages * PageCache::PAGE_SIZE;
+
+    if (span.free) {
+      report.freeSpans++;
+      report.freeSpanBytes += bytes;
+      report.largestFreeSpanBytes = std::max(report.largestFreeSpanBytes,
+                                             bytes);
+      if (span.released) report.releasedBytes += bytes;
+      continue;
+    }
+    if (!span.objSize || span.sampled) continue;
+
+    size_t index = SizeClass::getIndex(span.objSize);
+    size_t slot = std::lower_bound(indexes.begin(), indexes.end(), index) -
+                  indexes.begin();
+    SizeClassFragmentation& cls = report.sizeClasses[slot];
+    cls.spans++;
+    cls.spanBytes += bytes;
+    cls.blocks += span.blockCount;
+    cls.liveBlocks += span.liveBlocks;
+    cls.tailBytes += bytes - span.blockCount * span.objSize;
+    cls.freeBytes += span.freeBlocks * span.objSize;
+    if (span.liveBlocks == 0) {
+      cls.emptySpans++;
+    } else if (span.liveBlocks < span.blockCount) {
+      cls.partialSpans++;
+    }
+    report.utilization[span.liveBlocks * (UTILIZATION_BUCKETS - 1) /
+                       span.blockCount]++;
+  }
+  if (report.freeSpanBytes) {
+    report.externalFragmentation =
+        1.0 - static_cast<double>(report.largestFreeSpanBytes) /
+                  report.freeSpanBytes;
+  }
+  report.spans.assign(spans.begin(), spans.end());
+  return report;
+}
+
+void HeapReport::dumpText(FILE* out) const {
+  fprintf(out, "%18s %8s %8s %8s %8s %8s %8s %s\n", "address", "pages",
+          "size", "blocks", "live", "free", "resident", "state");
+  for (const SpanInfo& span : spans) {
+    const char* state = "in_use";
+    if (span.free) {
+      state = span.released ? "free,released" : "free";
+    } else if (span.sampled) {
+      state = "sampled";
+    }
+    fprintf(out, "%#18zx %8zu %8zu %8zu %8zu %8zu %8zu %s\n",
+            static_cast<size_t>(span.address), span.numPages, span.objSize,
+            span.blockCount, span.liveBlocks, span.freeBlocks,
+            span.residentPages, state);
+  }
+
+  fprintf(out, "\n%8s %8s %12s %10s %10s %12s %12s %8s %8s %8s\n", "size",
+          "spans", "span_bytes", "blocks", "live", "tail_bytes", "free_bytes",
+          "waste%", "partial", "empty");
+  for (const SizeClassFragmentation& cls : sizeClasses) {
+    double waste = cls.spanBytes ? 100.0 * (cls.tailBytes + cls.freeBytes) /
+                                       cls.spanBytes
+                                 : 0;
+    fprintf(out, "%8zu %8zu %12zu %10zu %10zu %12zu %12zu %8.1f %8zu %8zu\n",
+            cls.size, cls.spans, cls.spanBytes, cls.blocks, cls.liveBlocks,
+            cls.tailBytes, cls.freeBytes, waste, cls.partialSpans,
+            cls.emptySpans);
+  }
+
+  fprintf(out, "\nspan utilization:");
+  for (size_t i = 0; i < UTILIZATION_BUCKETS; i++) {
+    fprintf(out, " %zu%%:%zu", i * 10, utilization[i]);
+  }
+  fprintf(out,
+          "\nfree spans: %zu bytes %zu largest %zu released %zu "
+          "external_fragmentation %.3f\n",
+          freeSpans, freeSpanBytes, largestFreeSpanBytes, releasedBytes,
+          externalFragmentation);
+}
+
+void HeapReport::dumpJson(FILE* out) const {
+  fprintf(out, "{\"spans\":[");
+  for (size_t i = 0; i < spans.size(); i++) {
+    const SpanInfo& span = spans[i];
+    fprintf(out,
+            "%s{\"address\":%zu,\"pages\":%zu,\"size\":%zu,\"blocks\":%zu,"
+            "\"live\":%zu,\"free_blocks\":%zu,\"resident_pages\":%zu,"
+            "\"free\":%s,\"released\":%s,\"sampled\":%s}",
+            i ? "," : "", static_cast<size_t>(span.address), span.numPages,
+            span.objSize, span.blockCount, span.liveBlocks, span.freeBlocks,
+            span.residentPages, span.free ? "true" : "false",
+            span.released ? "true" : "false",
+            span.sampled ? "true" : "false");
+  }
+  fprintf(out, "],\"size_classes\":[");
+  for (size_t i = 0; i < sizeClasses.size(); i++) {
+    const SizeClassFragmentation& cls = sizeClasses[i];
+    fprintf(out,
+            "%s{\"size\":%zu,\"spans\":%zu,\"span_bytes\":%zu,"
+            "\"blocks\":%zu,\"live\":%zu,\"tail_bytes\":%zu,"
+            "\"free_bytes\":%zu,\"partial_spans\":%zu,\"empty_spans\":%zu}",
+            i ? "," : "", cls.size, cls.spans, cls.spanBytes, cls.blocks,
+            cls.liveBlocks, cls.tailBytes, cls.freeBytes, cls.partialSpans,
+            cls.emptySpans);
+  }
+  fprintf(out, "],\"utilization\":[");
+  for (size_t i = 0; i < UTILIZATION_BUCKETS; i++) {
+    fprintf(out, "%s%zu", i ? "," : "", utilization[i]);
+  }
+  fprintf(out,
+          "],\"free_spans\":{\"count\":%zu,\"bytes\":%zu,"
+          "\"largest_bytes\":%zu,\"released_bytes\":%zu,"
+          "\"external_fragmentation\":%.4f}}\n",
+          freeSpans, freeSpanBytes, largestFreeSpanBytes, releasedBytes,
+          externalFragmentation);
+}
+
+}  // namespace memory_pool
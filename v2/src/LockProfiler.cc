@@ -0,0 +1,113 @@
+#include "LockProfiler.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "MetadataAllocator.h"
+
+namespace memory_pool {
+namespace {
+// 一把锁的计数 同一位置可能对应多个Heap实例的锁, 用原子加
+struct LockCounters {
+  std::atomic<uint64_t> acquisitions;
+  std::atomic<uint64_t> contended;
+  std::atomic<uint64_t> waitNs;
+  std::atomic<uint64_t> holdNs;
+  std::atomic<uint64_t> waitHistogram[LockContentionStats::BUCKETS];
+  std::atomic<uint64_t> holdHistogram[LockContentionStats::BUCKETS];
+};
+
+constexpr size_t SITE_COUNT = LockProfiler::PAGE_CACHE_SITE + 1;
+
+std::mutex startMutex;
+// 计数表约17MB, 来自mmap的零页, 只有用到的大小类占用物理内存
+std::atomic<LockCounters*> counterTable{nullptr};
+
+size_t bucketOf(uint64_t ns) {
+  if (ns == 0) return 0;
+  size_t bucket = 64 - __builtin_clzll(ns);
+  return std::min(bucket, LockContentionStats::BUCKETS - 1);
+}
+
+void readCounters(const LockCounters& counters, size_t size,
+                  LockContentionStats* stats) {
+  stats->size = size;
+  stats->acquisitions = counters.acquisitions.load(std::memory_order_relaxed);
+  stats->contended = counters.contended.load(std::memory_order_relaxed);
+  stats->waitNs = counters.waitNs.load(std::memory_order_relaxed);
+  stats->holdNs = counters.holdNs.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < LockContentionStats::BUCKETS; i++) {
+    stats->waitHistogram[i] =
+        counters.waitHistogram[i].load(std::memory_order_relaxed);
+    stats->holdHistogram[i] =
+        counters.holdHistogram[i].load(std::memory_order_relaxed);
+  }
+}
+}  // namespace
+
+bool LockProfiler::start() {
+  std::lock_guard<std::mutex> lock(startMutex);
+  if (!counterTable.load(std::memory_order_relaxed)) {
+    LockCounters* table = static_cast<LockCounters*>(
+        MetadataAllocator::allocate(SITE_COUNT * sizeof(LockCounters)));
+    if (!table) return false;
+    counterTable.store(table, std::memory_order_release);
+  }
+  enabled_.store(true, std::memory_order_release);
+  return true;
+}
+
+void LockProfiler::stop() { enabled_.store(false, std::memory_order_relaxed); }
+
+uint64_t LockProfiler::now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void LockProfiler::recordWait(size_t site, uint64_t ns, bool contended) {
+  LockCounters* table = counterTable.load(std::memory_order_acquire);
+  if (!table) return;
+  LockCounters& counters = table[site];
+  counters.acquisitions.fetch_add(1, std::memory_order_relaxed);
+  if (contended) {
+    counters.contended.fetch_add(1, std::memory_order_relaxed);
+    counters.waitNs.fetch_add(ns, std::memory_order_relaxed);
+  }
+  counters.waitHistogram[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void LockProfiler::recordHold(size_t site, uint64_t ns) {
+  LockCounters* table = counterTable.load(std::memory_order_acquire);
+  if (!table) return;
+  LockCounters& counters = table[site];
+  counters.holdNs.fetch_add(ns, std::memory_order_relaxed);
+  counters.holdHistogram[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void LockProfiler::collect(LockContentionStats* pageCache,
+                           std::vector<LockContentionStats>* central) {
+  *pageCache = LockContentionStats{};
+  central->clear();
+  LockCounters* table = counterTable.load(std::memory_order_acquire);
+  if (!table) return;
+
+  readCounters(table[PAGE_CACHE_SITE], 0, pageCache);
+  for (size_t i = 0; i < FREE_LIST_SIZE; i++) {
+    // 未用到的大小类只读到共享零页
+    if (table[i].acquisitions.load(std::memory_order_relaxed) == 0) continue;
+    LockContentionStats stats;
+    readCounters(table[i], (i + 1) * ALIGNMENT, &stats);
+    central->push_back(stats);
+  }
+  std::sort(central->begin(), central->end(),
+            [](const LockContentionStats& a, const LockContentionStats& b) {
+              return a.waitNs > b.waitNs;
+            });
+}
+
+void LockProfiler::prepareFork() { startMutex.lock(); }
+
+void LockProfiler::afterFork() { startMutex.unlock(); }
+
+}  // namespace memory_pool
@@ -0,0 +1,101 @@
+#include "MemoryPressure.h"
+
+#include "CentralCache.h"
+#include "PageCache.h"
+#include "ThreadCache.h"
+
+namespace memory_pool {
+namespace {
+struct PressureCounters {
+  std::atomic<size_t> limitHits;
+  std::atomic<size_t> threadCacheFlushes;
+  std::atomic<size_t> centralReleases;
+  std::atomic<size_t> pageReleases;
+  std::atomic<size_t> pageReleasedBytes;
+  std::atomic<size_t> callbacks;
+  std::atomic<size_t> failures;
+};
+
+PressureCounters counters;
+// 先写context再写callback 读到callback时context已可见
+std::atomic<MemoryPressure::Callback> pressureCallback{nullptr};
+std::atomic<void*> pressureContext{nullptr};
+// 回调或各阶段中的分配失败不再递归进入回收
+thread_local bool inRelieve MEMORY_POOL_TLS_MODEL = false;
+
+void bump(std::atomic<size_t>& counter, size_t n = 1) {
+  counter.fetch_add(n, std::memory_order_relaxed);
+}
+
+size_t read(const std::atomic<size_t>& counter) {
+  return counter.load(std::memory_order_relaxed);
+}
+}  // namespace
+
+void MemoryPressure::setCallback(Callback callback, void* context) {
+  pressureCallback.store(nullptr, std::memory_order_release);
+  pressureContext.store(context, std::memory_order_release);
+  pressureCallback.store(callback, std::memory_order_release);
+}
+
+MemoryPressureStats MemoryPressure::getStats() {
+  MemoryPressureStats stats = {};
+  stats.memoryLimit = PageCache::getInstance().getMemoryLimit();
+  stats.limitHits = read(counters.limitHits);
+  stats.threadCacheFlushes = read(counters.threadCacheFlushes);
+  stats.centralReleases = read(counters.centralReleases);
+  stats.pageReleases = read(counters.pageReleases);
+  stats.pageReleasedBytes = read(counters.pageReleasedBytes);
+  stats.callbacks = read(counters.callbacks);
+  stats.failures = read(counters.failures);
+  return stats;
+}
+
+bool MemoryPressure::begin() {
+  if (inRelieve || !PageCache::getInstance().getMemoryLimit()) return false;
+  inRelieve = true;
+  bump(counters.limitHits);
+  return true;
+}
+
+void MemoryPressure::end(bool succeeded) {
+  if (!succeeded) bump(counters.failures);
+  inRelieve = false;
+}
+
+bool MemoryPressure::runStage(Stage stage, size_t bytes) {
+  switch (stage) {
+    case FLUSH_THREAD_CACHES: {
+      flushEpoch_.fetch_add(1, std::memory_order_relaxed);
+      ThreadCache* cache = ThreadCache::getInstance();
+      cache->pressureEpoch_ = flushEpoch();
+      cache->flushAll();
+      bump(counters.threadCacheFlushes);
+      return true;
+    }
+    case RELEASE_CENTRAL_SPANS:
+      CentralCache::getInstance().releaseFreeSpans();
+      bump(counters.centralReleases);
+      return true;
+    case RELEASE_PAGES:
+      bump(counters.pageReleasedBytes,
+           PageCache::getInstance().releaseFreeSpans());
+      bump(counters.pageReleases);
+      return true;
+    case CALL_CALLBACK: {
+      Callback callback = pressureCallback.load(std::memory_order_acquire);
+      if (!callback) return false;
+      callback(bytes, pressureContext.load(std::memory_order_acquire));
+      bump(counters.callbacks);
+      // 回调释放的内存可能还停留在各级缓存中
+      runStage(FLUSH_THREAD_CACHES, bytes);
+      runStage(RELEASE_CENTRAL_SPANS, bytes);
+      runStage(RELEASE_PAGES, bytes);
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+}  // namespace memory_pool
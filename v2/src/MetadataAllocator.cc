@@ -0,0 +1,94 @@
+#include "MetadataAllocator.h"
+
+#include <sys/mman.h>
+
+#include <atomic>
+#include <thread>
+
+namespace memory_pool {
+namespace {
+constexpr size_t NUM_META_CLASSES =
+    MetadataAllocator::MAX_META_SIZE / MetadataAllocator::META_ALIGNMENT;
+
+// 只包含常量初始化的成员 在任何构造函数运行前即可使用
+struct MetadataState {
+  std::atomic_flag lock = ATOMIC_FLAG_INIT;
+  void* freeLists[NUM_META_CLASSES] = {};
+  char* current = nullptr;
+  char* end = nullptr;
+};
+MetadataState state;
+
+size_t metaIndex(size_t size) {
+  return (size + MetadataAllocator::META_ALIGNMENT - 1) /
+             MetadataAllocator::META_ALIGNMENT -
+         1;
+}
+
+void* mapPages(size_t size) {
+  void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return memory == MAP_FAILED ? nullptr : memory;
+}
+
+class SpinLockGuard {
+ public:
+  SpinLockGuard() {
+    while (state.lock.test_and_set(std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
+  }
+  ~SpinLockGuard() { state.lock.clear(std::memory_order_release); }
+};
+}  // namespace
+
+void* MetadataAllocator::allocate(size_t size) {
+  if (size == 0) size = META_ALIGNMENT;
+  if (size > MAX_META_SIZE) return mapPages(size);
+
+  size_t index = metaIndex(size);
+  size_t blockSize = (index + 1) * META_ALIGNMENT;
+
+  SpinLockGuard guard;
+  void* ptr = state.freeLists[index];
+  if (ptr) {
+    state.freeLists[index] = *reinterpret_cast<void**>(ptr);
+    return ptr;
+  }
+  if (state.current + blockSize > state.end) {
+    // 剩余的零头直接丢弃 元数据总量很小
+    char* chunk = static_cast<char*>(mapPages(CHUNK_SIZE));
+    if (!chunk) return nullptr;
+    state.current = chunk;
+    state.end = chunk + CHUNK_SIZE;
+  }
+  ptr = state.current;
+  state.current += blockSize;
+  return ptr;
+}
+
+void MetadataAllocator::deallocate(void* ptr, size_t size) {
+  if (!ptr) return;
+  if (size == 0) size = META_ALIGNMENT;
+  if (size > MAX_META_SIZE) {
+    munmap(ptr, size);
+    return;
+  }
+
+  size_t index = metaIndex(size);
+  SpinLockGuard guard;
+  *reinterpret_cast<void**>(ptr) = state.freeLists[index];
+  state.freeLists[index] = ptr;
+}
+
+void MetadataAllocator::prepareFork() {
+  while (state.lock.test_and_set(std::memory_order_acquire)) {
+    std::this_thread::yield();
+  }
+}
+
+void MetadataAllocator::afterFork() {
+  state.lock.clear(std::memory_order_release);
+}
+
+}  // namespace memory_pool
@@ -5,15 +5,23 @@
 #include <cstring>
 
 #include "CentralCache.h"
+#include "LockProfiler.h"
 namespace memory_pool {
-void* PageCache::allocateSpan(size_t numPages) {
-  std::lock_guard<std::mutex> lock(mutex_);
+static_assert(PageCache::PAGE_SIZE == 4096, "PageMap assumes 4KB pages");
+
+void* PageCache::allocateSpan(size_t numPages, size_t objSize) {
+  MEMORY_POOL_LATENCY_TIER(TIER_PAGE_CACHE);
+  // 0页会匹配任意空闲span
+  if (numPages == 0) return nullptr;
+  ProfiledLockGuard lock(mutex_, LockProfiler::PAGE_CACHE_SITE);
 
   auto it = freeSpans_.lower_bound(numPages);
   // 将取出的span从原有的空闲链表freeSpans_[it->first]中移除
 
   if (it != freeSpans_.end()) {
     Span* span = it->second;
+    // 已归还的页重新使用时再次占用内存 同样受内存上限约束
+    if (span->released && !withinLimit(numPages * PAGE_SIZE)) return nullptr;
 
     if (span->next) {
       freeSpans_[it->first] = span->next;
@@ -23,20 +31,36 @@ void* PageCache::allocateSpan(size_t numPages) {
     span->next = nullptr;
     // 如果span大于需要的numPages则进行分割
     if (span->numPages > numPages) {
-      Span* newSpan = new Span;
-      newSpan->pageAddr =
-          static_cast<char*>(span->pageAddr) + numPages * PAGE_SIZE;
-      newSpan->numPages = span->numPages - numPages;
-      newSpan->next = nullptr;
+      Span* rest =
+          newSpan(static_cast<char*>(span->pageAddr) + numPages * PAGE_SIZE,
+                  span->numPages - numPages);
+      if (!rest) {
+        // 元数据不足 整块放回
+        auto& list = freeSpans_[span->numPages];
+        span->next = list;
+        list = span;
+        return nullptr;
+      }
 
-      auto& list = freeSpans_[newSpan->numPages];
-      newSpan->next = list;
-      list = newSpan;
+      auto& list = freeSpans_[rest->numPages];
+      rest->next = list;
+      list = rest;
+      rest->released = span->released;
+      // 记录剩余部分 使其释放后能与相邻span合并
+      spanMap_[rest->pageAddr] = rest;
 
       span->numPages = numPages;
       span->next = nullptr;
     }
+    // 已归还的页在使用时由内核重新分配 不再计入releasedBytes_
+    if (span->released) {
+      releasedBytes_ -= span->numPages * PAGE_SIZE;
+      span->released = false;
+    }
+    span->objSize = objSize;
+    span->sampled = false;
     spanMap_[span->pageAddr] = span;
+    PageMap::getInstance().set(span->pageAddr, span->numPages, span);
     return span->pageAddr;
   }
 
@@ -44,68 +68,366 @@ void* PageCache::allocateSpan(size_t numPages) {
   void* memory = systemAlloc(numPages);
   if (!memory) return nullptr;
 
-  Span* span = new Span;
-  span->pageAddr = memory;
-  span->numPages = numPages;
-  span->next = nullptr;
+  Span* span = newSpan(memory, numPages);
+  if (!span) {
+    munmap(memory, numPages * PAGE_SIZE);
+    return nullptr;
+  }
+  span->objSize = objSize;
 
   spanMap_[memory] = span;
+  PageMap::getInstance().set(memory, numPages, span);
   return memory;
 }
+void* PageCache::allocateAlignedSpan(size_t numPages, size_t align) {
+  size_t extraPages = align / PAGE_SIZE - 1;
+  if (numPages == 0 || numPages > SIZE_MAX / PAGE_SIZE - extraPages) {
+    return nullptr;
+  }
+  char* memory = static_cast<char*>(allocateSpan(numPages + extraPages));
+  if (!memory) return nullptr;
+  char* aligned = reinterpret_cast<char*>(
+      SizeClass::roundUp(reinterpret_cast<uintptr_t>(memory), align));
+  if (aligned != memory) {
+    ProfiledLockGuard lock(mutex_, LockProfiler::PAGE_CACHE_SITE);
+    Span* head = spanMap_[memory];
+    size_t headPages = (aligned - memory) / PAGE_SIZE;
+    Span* span = newSpan(aligned, head->numPages - headPages);
+    if (!span) {
+      releaseSpan(head);
+      return nullptr;
+    }
+    head->numPages = headPages;
+    spanMap_[aligned] = span;
+    PageMap::getInstance().set(aligned, span->numPages, span);
+    // 对齐点之后的span尚未放入空闲链表 头部释放时不会与之合并
+    releaseSpan(head);
+  }
+  shrinkSpan(aligned, numPages);
+  return aligned;
+}
+
 void PageCache::deallocateSpan(void* ptr, size_t numPages) {
-  std::lock_guard<std::mutex> lock(mutex_);
+  MEMORY_POOL_LATENCY_TIER(TIER_PAGE_CACHE);
+  ProfiledLockGuard lock(mutex_, LockProfiler::PAGE_CACHE_SITE);
 
   auto it = spanMap_.find(ptr);
   if (it == spanMap_.end()) return;
+  releaseSpan(it->second);
+}
+
+// 将已分配的span放回空闲链表 并尝试与后一块空闲span合并 需持有mutex_
+void PageCache::releaseSpan(Span* span) {
+  // 释放后的页不再属于任何块
+  PageMap::getInstance().set(span->pageAddr, span->numPages, nullptr);
+  span->objSize = 0;
+  span->sampled = false;
 
   // 查找下一块span
-  Span* span = it->second;
-  void* nextAddr = static_cast<char*>(ptr) + numPages * PAGE_SIZE;
+  void* nextAddr =
+      static_cast<char*>(span->pageAddr) + span->numPages * PAGE_SIZE;
   auto nextIt = spanMap_.find(nextAddr);
 
   // 当下一块span在空闲span链表中 从中拿出
   if (nextIt != spanMap_.end()) {
     Span* nextSpan = nextIt->second;
 
-    bool found = false;
-    auto& nextList = freeSpans_[nextSpan->numPages];
-
-    // 下一块span为链头 直接拿出
-    if (nextList == nextSpan) {
-      nextList = nextSpan->next;
-      found = true;
-    } else if (nextList) {
-      // 下一块span在链中间
-      Span* prev = nextList;
-      while (prev->next) {
-        if (prev->next == nextSpan) {
-          prev->next = nextSpan->next;
-          found = true;
-          break;
-        }
-        prev = prev->next;
-      }
-    }
+    bool found = removeFreeSpan(nextSpan);
 
     // 在空闲链表中找到nextSpan 才对齐进行合并
     if (found) {
+      // 合并后的span按未归还计 之后的releaseFreeSpans会再次整体归还
+      if (nextSpan->released) {
+        releasedBytes_ -= nextSpan->numPages * PAGE_SIZE;
+      }
       span->numPages += nextSpan->numPages;
       spanMap_.erase(nextAddr);
-      delete nextSpan;
+      deleteSpan(nextSpan);
     }
+  }
+
+  // 无论是否合并 都放回空闲链表
+  auto& list = freeSpans_[span->numPages];
+  span->next = list;
+  list = span;
+}
+bool PageCache::growSpan(void* ptr, size_t numPages) {
+  ProfiledLockGuard lock(mutex_, LockProfiler::PAGE_CACHE_SITE);
+
+  auto it = spanMap_.find(ptr);
+  if (it == spanMap_.end()) return false;
+  Span* span = it->second;
+  if (span->numPages >= numPages) return true;
+
+  // 只有紧邻的下一块span空闲且足够大时才能原地扩展
+  void* nextAddr =
+      static_cast<char*>(span->pageAddr) + span->numPages * PAGE_SIZE;
+  auto nextIt = spanMap_.find(nextAddr);
+  if (nextIt == spanMap_.end()) return false;
+  Span* nextSpan = nextIt->second;
+  size_t extraPages = numPages - span->numPages;
+  if (nextSpan->numPages < extraPages || !removeFreeSpan(nextSpan)) {
+    return false;
+  }
+  spanMap_.erase(nextIt);
+  if (nextSpan->released) releasedBytes_ -= extraPages * PAGE_SIZE;
+
+  // 多出的部分重新作为空闲span
+  if (nextSpan->numPages > extraPages) {
+    nextSpan->pageAddr = static_cast<char*>(nextAddr) + extraPages * PAGE_SIZE;
+    nextSpan->numPages -= extraPages;
+    spanMap_[nextSpan->pageAddr] = nextSpan;
+    auto& list = freeSpans_[nextSpan->numPages];
+    nextSpan->next = list;
+    list = nextSpan;
+  } else {
+    deleteSpan(nextSpan);
+  }
+
+  span->numPages = numPages;
+  PageMap::getInstance().set(nextAddr, extraPages, span);
+  return true;
+}
+
+void PageCache::shrinkSpan(void* ptr, size_t numPages) {
+  ProfiledLockGuard lock(mutex_, LockProfiler::PAGE_CACHE_SITE);
+
+  auto it = spanMap_.find(ptr);
+  if (it == spanMap_.end()) return;
+  Span* span = it->second;
+  if (numPages == 0 || span->numPages <= numPages) return;
+
+  Span* tail = newSpan(static_cast<char*>(ptr) + numPages * PAGE_SIZE,
+                       span->numPages - numPages);
+  if (!tail) return;  // 元数据不足时保持原大小
+  span->numPages = numPages;
+  spanMap_[tail->pageAddr] = tail;
+  releaseSpan(tail);
+}
+
+void* PageCache::remapSpan(void* ptr, size_t numPages) {
+  ProfiledLockGuard lock(mutex_, LockProfiler::PAGE_CACHE_SITE);
+
+  auto it = spanMap_.find(ptr);
+  if (it == spanMap_.end()) return nullptr;
+  Span* span = it->second;
+  if (numPages <= span->numPages) return ptr;
+
+  size_t extra = (numPages - span->numPages) * PAGE_SIZE;
+  if (!withinLimit(extra)) return nullptr;
+
+  // 合并过的span可能跨越多次mmap的区域 此时mremap会失败 由调用方复制
+  void* memory = mremap(ptr, span->numPages * PAGE_SIZE, numPages * PAGE_SIZE,
+                        MREMAP_MAYMOVE);
+  if (memory == MAP_FAILED) return nullptr;
+
+  // 旧地址范围已不再映射 从记录中移除
+  PageMap::getInstance().set(ptr, span->numPages, nullptr);
+  forgetMapping(ptr, span->numPages * PAGE_SIZE);
+  recordMapping(memory, numPages * PAGE_SIZE);
+  spanMap_.erase(it);
+  span->pageAddr = memory;
+  span->numPages = numPages;
+  spanMap_[memory] = span;
+  PageMap::getInstance().set(memory, numPages, span);
+  return memory;
+}
+
+Span* PageCache::newSpan(void* pageAddr, size_t numPages) {
+  Span* span =
+      static_cast<Span*>(MetadataAllocator::allocate(sizeof(Span)));
+  if (!span) return nullptr;
+  span->pageAddr = pageAddr;
+  span->numPages = numPages;
+  span->objSize = 0;
+  span->sampled = false;
+  span->next = nullptr;
+  span->released = false;
+  return span;
+}
 
-    auto& list = freeSpans_[span->numPages];
-    span->next = list;
-    list = span;
+void PageCache::deleteSpan(Span* span) {
+  MetadataAllocator::deallocate(span, sizeof(Span));
+}
+
+// 从空闲链表中摘除span 不在空闲链表中时返回false
+bool PageCache::removeFreeSpan(Span* target) {
+  auto it = freeSpans_.find(target->numPages);
+  if (it == freeSpans_.end()) return false;
+
+  bool found = false;
+  // 目标span为链头 直接拿出
+  if (it->second == target) {
+    it->second = target->next;
+    found = true;
+  } else {
+    // 目标span在链中间
+    Span* prev = it->second;
+    while (prev->next) {
+      if (prev->next == target) {
+        prev->next = target->next;
+        found = true;
+        break;
+      }
+      prev = prev->next;
+    }
+  }
+  // 不保留空链表 allocateSpan依赖每个链表非空
+  if (!it->second) {
+    freeSpans_.erase(it);
   }
+  target->next = nullptr;
+  return found;
 }
-void* PageCache::systemAlloc(size_t numPages) {
+
+void* PageCache::systemAlloc(size_t numPages, bool populate) {
+  MEMORY_POOL_LATENCY_TIER(TIER_SYSTEM);
   size_t size = numPages * PAGE_SIZE;
-  void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
-                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (!withinLimit(size)) return nullptr;
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS | (populate ? MAP_POPULATE : 0);
+  void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
 
   if (memory == MAP_FAILED) return nullptr;
-  memset(memory, 0, size);
+  // 内核已一次建立好全部页 不必再逐页写入
+  if (!populate) memset(memory, 0, size);
+  recordMapping(memory, size);
   return memory;
 }
+
+bool PageCache::reserve(size_t numPages) {
+  if (numPages == 0) return true;
+  ProfiledLockGuard lock(mutex_, LockProfiler::PAGE_CACHE_SITE);
+  void* memory = systemAlloc(numPages, true);
+  if (!memory) return false;
+  Span* span = newSpan(memory, numPages);
+  if (!span) {
+    forgetMapping(memory, numPages * PAGE_SIZE);
+    munmap(memory, numPages * PAGE_SIZE);
+    return false;
+  }
+  spanMap_[memory] = span;
+  releaseSpan(span);
+  return true;
+}
+
+void PageCache::setMemoryLimit(size_t bytes) {
+  ProfiledLockGuard lock(mutex_, LockProfiler::PAGE_CACHE_SITE);
+  memoryLimit_ = bytes;
+}
+
+size_t PageCache::getMemoryLimit() {
+  ProfiledLockGuard lock(mutex_, LockProfiler::PAGE_CACHE_SITE);
+  return memoryLimit_;
+}
+
+size_t PageCache::releaseFreeSpans() {
+  ProfiledLockGuard lock(mutex_, LockProfiler::PAGE_CACHE_SITE);
+  size_t released = 0;
+  for (auto& [pages, head] : freeSpans_) {
+    for (Span* span = head; span; span = span->next) {
+      if (span->released) continue;
+      size_t bytes = span->numPages * PAGE_SIZE;
+      // 映射保留 之后访问得到清零的新页
+      if (madvise(span->pageAddr, bytes, MADV_DONTNEED) != 0) continue;
+      span->released = true;
+      released += bytes;
+    }
+  }
+  releasedBytes_ += released;
+  return released;
+}
+
+size_t PageCache::getMappedBytes() {
+  ProfiledLockGuard lock(mutex_, LockProfiler::PAGE_CACHE_SITE);
+  return mappedBytes_;
+}
+
+PageCacheStats PageCache::getStats(size_t* spanBytes) {
+  ProfiledLockGuard lock(mutex_, LockProfiler::PAGE_CACHE_SITE);
+  PageCacheStats stats = {};
+  stats.releasedBytes = releasedBytes_;
+  stats.mappedBytes = mappedBytes_;
+  for (auto& [pages, head] : freeSpans_) {
+    for (Span* span = head; span; span = span->next) {
+      stats.freeBytes += span->numPages * PAGE_SIZE;
+    }
+  }
+  if (spanBytes) {
+    for (size_t i = 0; i < FREE_LIST_SIZE; i++) {
+      spanBytes[i] = 0;
+    }
+    for (auto& [addr, span] : spanMap_) {
+      if (span->objSize == 0 || span->objSize > MAX_BYTES) continue;
+      spanBytes[SizeClass::getIndex(span->objSize)] +=
+          span->numPages * PAGE_SIZE;
+    }
+  }
+  return stats;
+}
+
+void PageCache::getSpans(SpanList* spans) {
+  ProfiledLockGuard lock(mutex_, LockProfiler::PAGE_CACHE_SITE);
+  spans->clear();
+  spans->reserve(spanMap_.size());
+  for (auto& [addr, span] : spanMap_) {
+    SpanInfo info = {};
+    info.address = reinterpret_cast<uintptr_t>(addr);
+    info.numPages = span->numPages;
+    info.objSize = span->objSize;
+    // 空闲span不在页映射中 在用span的页都映射到自身
+    info.free = PageMap::getInstance().get(addr) != span;
+    if (!info.free) {
+      info.blockCount = span->objSize && !span->sampled
+                            ? span->numPages * PAGE_SIZE / span->objSize
+                            : 1;
+    }
+    info.sampled = span->sampled;
+    spans->push_back(info);
+  }
+}
+
+// 需持有mutex_
+void PageCache::recordMapping(void* addr, size_t size) {
+  mappings_[addr] = size;
+  mappedBytes_ += size;
+}
+
+// 从记录中扣除[addr, addr + size) 该范围可能只是某次映射的一部分 需持有mutex_
+void PageCache::forgetMapping(void* addr, size_t size) {
+  auto it = mappings_.upper_bound(addr);
+  if (it == mappings_.begin()) return;
+  --it;
+  char* begin = static_cast<char*>(it->first);
+  char* end = begin + it->second;
+  char* cutBegin = static_cast<char*>(addr);
+  char* cutEnd = cutBegin + size;
+  if (cutBegin >= end) return;
+
+  mappings_.erase(it);
+  if (begin < cutBegin) mappings_[begin] = cutBegin - begin;
+  if (cutEnd < end) mappings_[cutEnd] = end - cutEnd;
+  mappedBytes_ -= size;
+}
+
+void PageCache::releaseAll() {
+  ProfiledLockGuard lock(mutex_, LockProfiler::PAGE_CACHE_SITE);
+  for (auto& [addr, span] : spanMap_) {
+    deleteSpan(span);
+  }
+  spanMap_.clear();
+  freeSpans_.clear();
+  for (auto& [addr, size] : mappings_) {
+    PageMap::getInstance().set(addr, size / PAGE_SIZE, nullptr);
+    munmap(addr, size);
+  }
+  mappings_.clear();
+  mappedBytes_ = 0;
+  releasedBytes_ = 0;
+}
+
+// 需持有mutex_
+bool PageCache::withinLimit(size_t extra) const {
+  return !memoryLimit_ || mappedBytes_ - releasedBytes_ + extra <= memoryLimit_;
+}
+
 }  // namespace memory_pool
@@ -0,0 +1,426 @@
+#include "PoolStats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <mutex>
+
+#include "CentralCache.h"
+#include "LockProfiler.h"
+#include "MemoryPressure.h"
+#include "MetadataAllocator.h"
+#include "PageCache.h"
+#include "RealTimePool.h"
+
+namespace memory_pool {
+namespace {
+std::mutex registryMutex;
+ThreadStats* liveThreads = nullptr;
+// 已退出线程的计数汇总 第一次有线程退出时分配
+ThreadStats* retired = nullptr;
+
+void accumulate(ThreadStats* total, const ThreadStats& stats) {
+  for (size_t i = 0; i < FREE_LIST_SIZE; i++) {
+    // 只写非零项 未使用的大小类不会触及total的零页
+    size_t allocs = stats.allocCount[i].load(std::memory_order_relaxed);
+    size_t frees = stats.freeCount[i].load(std::memory_order_relaxed);
+    size_t net = stats.centralNet[i].load(std::memory_order_relaxed);
+    if (allocs == 0 && frees == 0 && net == 0) continue;
+    ThreadStats::add(total->allocCount[i], allocs);
+    ThreadStats::add(total->freeCount[i], frees);
+    ThreadStats::add(total->centralNet[i], net);
+  }
+  ThreadStats::add(total->largeAllocCount,
+                   stats.largeAllocCount.load(std::memory_order_relaxed));
+  ThreadStats::add(total->largeFreeCount,
+                   stats.largeFreeCount.load(std::memory_order_relaxed));
+  ThreadStats::add(total->largeAllocBytes,
+                   stats.largeAllocBytes.load(std::memory_order_relaxed));
+  ThreadStats::add(total->largeFreeBytes,
+                   stats.largeFreeBytes.load(std::memory_order_relaxed));
+#ifdef MEMORY_POOL_LATENCY_STATS
+  auto addHistogram = [](LatencyHistogram& total,
+                         const LatencyHistogram& histogram) {
+    for (size_t i = 0; i < LatencyHistogram::BUCKETS; i++) {
+      size_t count = histogram.counts[i].load(std::memory_order_relaxed);
+      if (count) ThreadStats::add(total.counts[i], count);
+    }
+  };
+  for (size_t op = 0; op < OP_COUNT; op++) {
+    for (size_t tier = 0; tier < TIER_COUNT; tier++) {
+      addHistogram(total->latency.byTier[op][tier],
+                   stats.latency.byTier[op][tier]);
+    }
+    for (size_t group = 0; group < LATENCY_SIZE_GROUPS; group++) {
+      addHistogram(total->latency.bySize[op][group],
+                   stats.latency.bySize[op][group]);
+    }
+  }
+#endif
+}
+
+#ifdef MEMORY_POOL_LATENCY_STATS
+void summarize(const LatencyHistogram& histogram, LatencySummary* summary) {
+  summary->histogram.resize(LatencyHistogram::BUCKETS);
+  summary->count = 0;
+  for (size_t i = 0; i < LatencyHistogram::BUCKETS; i++) {
+    summary->histogram[i] = histogram.counts[i].load(std::memory_order_relaxed);
+    summary->count += summary->histogram[i];
+  }
+  // 分位数取第一个累计计数达到该比例的桶的上界
+  uint64_t* targets[] = {&summary->p50, &summary->p99, &summary->p999};
+  const uint64_t permille[] = {500, 990, 999};
+  uint64_t seen = 0;
+  size_t next = 0;
+  for (size_t i = 0; i < LatencyHistogram::BUCKETS && next < 3; i++) {
+    seen += summary->histogram[i];
+    while (next < 3 && summary->count &&
+           seen * 1000 >= summary->count * permille[next]) {
+      *targets[next++] = LatencyHistogram::lowerBound(i + 1);
+    }
+  }
+}
+
+// 用稳定时钟校准每纳秒的周期数 只在第一次读取统计时测量约10ms
+double cyclesPerNs() {
+  static const double ratio = [] {
+    auto begin = std::chrono::steady_clock::now();
+    uint64_t beginCycles = readCycles();
+    auto end = begin;
+    while (end - begin < std::chrono::milliseconds(10)) {
+      end = std::chrono::steady_clock::now();
+    }
+    uint64_t cycles = readCycles() - beginCycles;
+    auto ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin);
+    return static_cast<double>(cycles) / ns.count();
+  }();
+  return ratio;
+}
+#endif
+
+const char* const TIER_NAMES[TIER_COUNT] = {"thread_cache", "central_cache",
+                                             "page_cache", "system"};
+const char* const OP_NAMES[OP_COUNT] = {"allocate", "deallocate"};
+
+// 大小分组的上界 大块分组返回0
+size_t sizeGroupLimit(size_t group) {
+  return group + 1 < LATENCY_SIZE_GROUPS ? ALIGNMENT << group : 0;
+}
+
+void dumpLatencyText(FILE* out, const char* name, const LatencySummary& stats,
+                     uint64_t opCount) {
+  fprintf(out,
+          "  %-16s count %10" PRIu64 " (%5.1f%%) p50 %8" PRIu64
+          " p99 %8" PRIu64 " p99.9 %8" PRIu64 "\n",
+          name, stats.count,
+          opCount ? 100.0 * stats.count / opCount : 0.0, stats.p50, stats.p99,
+          stats.p999);
+}
+
+void dumpLatencyJson(FILE* out, const LatencySummary& stats) {
+  fprintf(out,
+          "{\"count\":%" PRIu64 ",\"p50\":%" PRIu64 ",\"p99\":%" PRIu64
+          ",\"p999\":%" PRIu64 ",\"histogram\":[",
+          stats.count, stats.p50, stats.p99, stats.p999);
+  // 只输出非零的桶 每项为[桶下界, 次数]
+  bool first = true;
+  for (size_t i = 0; i < stats.histogram.size(); i++) {
+    if (stats.histogram[i] == 0) continue;
+    fprintf(out, "%s[%" PRIu64 ",%" PRIu64 "]", first ? "" : ",",
+            LatencyHistogram::lowerBound(i), stats.histogram[i]);
+    first = false;
+  }
+  fprintf(out, "]}");
+}
+
+void dumpLockText(FILE* out, const char* name,
+                  const LockContentionStats& stats) {
+  fprintf(out,
+          "%s: acquisitions %" PRIu64 " contended %" PRIu64 " wait_ns %" PRIu64
+          " hold_ns %" PRIu64 "\n",
+          name, stats.acquisitions, stats.contended, stats.waitNs,
+          stats.holdNs);
+  // 只输出非零的桶 格式为 桶下界ns:次数
+  const char* labels[] = {"  wait", "  hold"};
+  const std::array<uint64_t, LockContentionStats::BUCKETS>* histograms[] = {
+      &stats.waitHistogram, &stats.holdHistogram};
+  for (int h = 0; h < 2; h++) {
+    fprintf(out, "%s", labels[h]);
+    for (size_t i = 0; i < LockContentionStats::BUCKETS; i++) {
+      uint64_t count = (*histograms[h])[i];
+      if (count == 0) continue;
+      fprintf(out, " %" PRIu64 ":%" PRIu64, i ? uint64_t{1} << (i - 1) : 0,
+              count);
+    }
+    fprintf(out, "\n");
+  }
+}
+
+void dumpHistogramJson(
+    FILE* out,
+    const std::array<uint64_t, LockContentionStats::BUCKETS>& histogram) {
+  for (size_t i = 0; i < histogram.size(); i++) {
+    fprintf(out, "%s%" PRIu64, i ? "," : "", histogram[i]);
+  }
+}
+
+void dumpLockJson(FILE* out, const LockContentionStats& stats) {
+  fprintf(out,
+          "{\"size\":%zu,\"acquisitions\":%" PRIu64
+          ",\"contended\":%" PRIu64 ",\"wait_ns\":%" PRIu64
+          ",\"hold_ns\":%" PRIu64 ",\"wait_histogram\":[",
+          stats.size, stats.acquisitions, stats.contended, stats.waitNs,
+          stats.holdNs);
+  dumpHistogramJson(out, stats.waitHistogram);
+  fprintf(out, "],\"hold_histogram\":[");
+  dumpHistogramJson(out, stats.holdHistogram);
+  fprintf(out, "]}");
+}
+}  // namespace
+
+ThreadStats* StatsRegistry::attach(ThreadCache* cache) {
+  // mmap得到的内存全为零 即所有计数为零
+  ThreadStats* stats = static_cast<ThreadStats*>(
+      MetadataAllocator::allocate(sizeof(ThreadStats)));
+  if (!stats) return nullptr;
+  stats->cache = cache;
+  std::lock_guard<std::mutex> lock(registryMutex);
+  stats->next = liveThreads;
+  liveThreads = stats;
+  return stats;
+}
+
+void StatsRegistry::detach(ThreadStats* stats) {
+  {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (ThreadStats** link = &liveThreads; *link; link = &(*link)->next) {
+      if (*link == stats) {
+        *link = stats->next;
+        break;
+      }
+    }
+    if (!retired) {
+      retired = static_cast<ThreadStats*>(
+          MetadataAllocator::allocate(sizeof(ThreadStats)));
+    }
+    // 无法分配汇总时丢弃该线程的计数
+    if (retired) accumulate(retired, *stats);
+  }
+  MetadataAllocator::deallocate(stats, sizeof(ThreadStats));
+}
+
+void StatsRegistry::sum(ThreadStats* total) {
+  std::lock_guard<std::mutex> lock(registryMutex);
+  for (ThreadStats* stats = liveThreads; stats; stats = stats->next) {
+    accumulate(total, *stats);
+  }
+  if (retired) accumulate(total, *retired);
+}
+
+ThreadStats* StatsRegistry::findOther(const ThreadStats* keep) {
+  std::lock_guard<std::mutex> lock(registryMutex);
+  for (ThreadStats* stats = liveThreads; stats; stats = stats->next) {
+    if (stats != keep) return stats;
+  }
+  return nullptr;
+}
+
+void StatsRegistry::prepareFork() { registryMutex.lock(); }
+
+void StatsRegistry::afterFork() { registryMutex.unlock(); }
+
+PoolStats PoolStats::collect() {
+  PoolStats result = {};
+  // 汇总用的大数组来自mmap 不在持有内存池的锁时分配内存
+  ThreadStats* total = static_cast<ThreadStats*>(
+      MetadataAllocator::allocate(sizeof(ThreadStats)));
+  size_t* spanBytes = static_cast<size_t*>(
+      MetadataAllocator::allocate(FREE_LIST_SIZE * sizeof(size_t)));
+  if (!total || !spanBytes) {
+    MetadataAllocator::deallocate(total, sizeof(ThreadStats));
+    MetadataAllocator::deallocate(spanBytes, FREE_LIST_SIZE * sizeof(size_t));
+    return result;
+  }
+
+  // 先读锁计数 不包含下面统计自身的加锁
+  LockProfiler::collect(&result.pageCacheLock, &result.centralLocks);
+  StatsRegistry::sum(total);
+  result.pageCache = PageCache::getInstance().getStats(spanBytes);
+  result.pressure = MemoryPressure::getStats();
+  result.realTime = RealTimePool::getStats();
+  CentralCache& central = CentralCache::getInstance();
+  for (size_t i = 0; i < FREE_LIST_SIZE; i++) {
+    size_t allocs = total->allocCount[i].load(std::memory_order_relaxed);
+    size_t frees = total->freeCount[i].load(std::memory_order_relaxed);
+    size_t net = total->centralNet[i].load(std::memory_order_relaxed);
+    if (allocs == 0 && frees == 0 && net == 0 && spanBytes[i] == 0) continue;
+
+    SizeClassStats stats;
+    stats.size = (i + 1) * ALIGNMENT;
+    stats.allocCount = allocs;
+    stats.freeCount = frees;
+    // 各线程计数不同步 可能短暂出现负值
+    size_t cached = net - allocs + frees;
+    stats.threadCacheBytes =
+        static_cast<ptrdiff_t>(cached) > 0 ? cached * stats.size : 0;
+    stats.centralCacheBytes = central.getFreeBlockCount(i) * stats.size;
+    stats.spanBytes = spanBytes[i];
+    result.sizeClasses.push_back(stats);
+  }
+  result.largeAllocCount =
+      total->largeAllocCount.load(std::memory_order_relaxed);
+  result.largeFreeCount = total->largeFreeCount.load(std::memory_order_relaxed);
+  result.largeAllocBytes =
+      total->largeAllocBytes.load(std::memory_order_relaxed);
+  result.largeFreeBytes = total->largeFreeBytes.load(std::memory_order_relaxed);
+
+#ifdef MEMORY_POOL_LATENCY_STATS
+  result.latency.enabled = true;
+  result.latency.cyclesPerNs = cyclesPerNs();
+  for (size_t op = 0; op < OP_COUNT; op++) {
+    for (size_t tier = 0; tier < TIER_COUNT; tier++) {
+      summarize(total->latency.byTier[op][tier],
+                &result.latency.byTier[op][tier]);
+    }
+    for (size_t group = 0; group < LATENCY_SIZE_GROUPS; group++) {
+      summarize(total->latency.bySize[op][group],
+                &result.latency.bySize[op][group]);
+    }
+  }
+#endif
+
+  MetadataAllocator::deallocate(total, sizeof(ThreadStats));
+  MetadataAllocator::deallocate(spanBytes, FREE_LIST_SIZE * sizeof(size_t));
+  return result;
+}
+
+void PoolStats::dumpText(FILE* out) const {
+  fprintf(out, "%8s %12s %12s %14s %14s %14s\n", "size", "allocs", "frees",
+          "thread_cache", "central_cache", "spans");
+  for (const SizeClassStats& stats : sizeClasses) {
+    fprintf(out, "%8zu %12zu %12zu %14zu %14zu %14zu\n", stats.size,
+            stats.allocCount, stats.freeCount, stats.threadCacheBytes,
+            stats.centralCacheBytes, stats.spanBytes);
+  }
+  fprintf(out, "large: allocs %zu frees %zu alloc_bytes %zu free_bytes %zu\n",
+          largeAllocCount, largeFreeCount, largeAllocBytes, largeFreeBytes);
+  fprintf(out, "page cache: free %zu released %zu mapped %zu\n",
+          pageCache.freeBytes, pageCache.releasedBytes, pageCache.mappedBytes);
+  if (pressure.memoryLimit || pressure.limitHits) {
+    fprintf(out,
+            "memory limit %zu: hits %zu thread_cache_flushes %zu "
+            "central_releases %zu page_releases %zu released_bytes %zu "
+            "callbacks %zu failures %zu\n",
+            pressure.memoryLimit, pressure.limitHits,
+            pressure.threadCacheFlushes, pressure.centralReleases,
+            pressure.pageReleases, pressure.pageReleasedBytes,
+            pressure.callbacks, pressure.failures);
+  }
+  if (realTime.regionBytes) {
+    fprintf(out, "real time: region %zu used %zu threads %zu failures %zu\n",
+            realTime.regionBytes, realTime.usedBytes, realTime.threads,
+            realTime.failures);
+  }
+  if (latency.enabled) {
+    fprintf(out, "latency (cycles, %.2f cycles/ns):\n", latency.cyclesPerNs);
+    for (size_t op = 0; op < OP_COUNT; op++) {
+      uint64_t opCount = 0;
+      for (const LatencySummary& tier : latency.byTier[op]) {
+        opCount += tier.count;
+      }
+      fprintf(out, "%s:\n", OP_NAMES[op]);
+      for (size_t tier = 0; tier < TIER_COUNT; tier++) {
+        dumpLatencyText(out, TIER_NAMES[tier], latency.byTier[op][tier],
+                        opCount);
+      }
+      for (size_t group = 0; group < LATENCY_SIZE_GROUPS; group++) {
+        if (latency.bySize[op][group].count == 0) continue;
+        char name[32];
+        size_t limit = sizeGroupLimit(group);
+        if (limit) {
+          snprintf(name, sizeof(name), "size<=%zu", limit);
+        } else {
+          snprintf(name, sizeof(name), "size>%zu", MAX_BYTES);
+        }
+        dumpLatencyText(out, name, latency.bySize[op][group], opCount);
+      }
+    }
+  }
+  if (pageCacheLock.acquisitions == 0 && centralLocks.empty()) return;
+  dumpLockText(out, "page cache lock", pageCacheLock);
+  size_t top = std::min(centralLocks.size(), TOP_CONTENDED_LOCKS);
+  for (size_t i = 0; i < top; i++) {
+    char name[48];
+    snprintf(name, sizeof(name), "central lock %zu", centralLocks[i].size);
+    dumpLockText(out, name, centralLocks[i]);
+  }
+}
+
+void PoolStats::dumpJson(FILE* out) const {
+  fprintf(out, "{\"size_classes\":[");
+  for (size_t i = 0; i < sizeClasses.size(); i++) {
+    const SizeClassStats& stats = sizeClasses[i];
+    fprintf(out,
+            "%s{\"size\":%zu,\"allocs\":%zu,\"frees\":%zu,"
+            "\"thread_cache_bytes\":%zu,\"central_cache_bytes\":%zu,"
+            "\"span_bytes\":%zu}",
+            i ? "," : "", stats.size, stats.allocCount, stats.freeCount,
+            stats.threadCacheBytes, stats.centralCacheBytes, stats.spanBytes);
+  }
+  fprintf(out,
+          "],\"large\":{\"allocs\":%zu,\"frees\":%zu,\"alloc_bytes\":%zu,"
+          "\"free_bytes\":%zu},",
+          largeAllocCount, largeFreeCount, largeAllocBytes, largeFreeBytes);
+  fprintf(out,
+          "\"page_cache\":{\"free_bytes\":%zu,\"released_bytes\":%zu,"
+          "\"mapped_bytes\":%zu},",
+          pageCache.freeBytes, pageCache.releasedBytes, pageCache.mappedBytes);
+  fprintf(out,
+          "\"memory_pressure\":{\"memory_limit\":%zu,\"limit_hits\":%zu,"
+          "\"thread_cache_flushes\":%zu,\"central_releases\":%zu,"
+          "\"page_releases\":%zu,\"page_released_bytes\":%zu,"
+          "\"callbacks\":%zu,\"failures\":%zu},",
+          pressure.memoryLimit, pressure.limitHits, pressure.threadCacheFlushes,
+          pressure.centralReleases, pressure.pageReleases,
+          pressure.pageReleasedBytes, pressure.callbacks, pressure.failures);
+  fprintf(out,
+          "\"real_time\":{\"region_bytes\":%zu,\"used_bytes\":%zu,"
+          "\"threads\":%zu,\"failures\":%zu},",
+          realTime.regionBytes, realTime.usedBytes, realTime.threads,
+          realTime.failures);
+  fprintf(out, "\"locks\":{\"page_cache\":");
+  dumpLockJson(out, pageCacheLock);
+  fprintf(out, ",\"central\":[");
+  for (size_t i = 0; i < centralLocks.size(); i++) {
+    if (i) fprintf(out, ",");
+    dumpLockJson(out, centralLocks[i]);
+  }
+  fprintf(out, "]}");
+  if (latency.enabled) {
+    fprintf(out, ",\"latency\":{\"cycles_per_ns\":%.4f", latency.cyclesPerNs);
+    for (size_t op = 0; op < OP_COUNT; op++) {
+      fprintf(out, ",\"%s\":{\"tiers\":{", OP_NAMES[op]);
+      for (size_t tier = 0; tier < TIER_COUNT; tier++) {
+        fprintf(out, "%s\"%s\":", tier ? "," : "", TIER_NAMES[tier]);
+        dumpLatencyJson(out, latency.byTier[op][tier]);
+      }
+      // max_size为0表示超过MAX_BYTES的大块
+      fprintf(out, "},\"sizes\":[");
+      bool first = true;
+      for (size_t group = 0; group < LATENCY_SIZE_GROUPS; group++) {
+        if (latency.bySize[op][group].count == 0) continue;
+        fprintf(out, "%s{\"max_size\":%zu,\"latency\":", first ? "" : ",",
+                sizeGroupLimit(group));
+        dumpLatencyJson(out, latency.bySize[op][group]);
+        fprintf(out, "}");
+        first = false;
+      }
+      fprintf(out, "]}");
+    }
+    fprintf(out, "}");
+  }
+  fprintf(out, "}\n");
+}
+
+}  // namespace memory_pool
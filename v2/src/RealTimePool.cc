@@ -0,0 +1,260 @@
+#include "RealTimePool.h"
+
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <new>
+
+#include "PageCache.h"
+#include "ThreadCache.h"
+
+namespace memory_pool {
+namespace {
+constexpr size_t PAGE_SIZE = PageCache::PAGE_SIZE;
+// 块大小为2^MIN_SHIFT到2^(MIN_SHIFT + CLASS_COUNT - 1)
+constexpr size_t MIN_SHIFT = 4;
+constexpr size_t CLASS_COUNT = 44;
+
+// 块头紧贴在返回的地址之前 块起始地址为ptr - offset
+struct BlockTag {
+  uint32_t offset;
+  uint16_t owner;      // 分配该块的实时状态下标
+  uint16_t sizeClass;  // 块大小为2^(sizeClass + MIN_SHIFT)
+};
+static_assert(sizeof(BlockTag) == ALIGNMENT, "header keeps alignment");
+}  // namespace
+
+// 一个实时线程的状态 线程退出后保留, 由之后进入的线程接管
+struct alignas(64) RealTimeThread {
+  std::atomic<bool> inUse;
+  uint16_t index;
+  // 当前块中尚未切分的部分
+  char* chunkPos;
+  char* chunkEnd;
+  // 以下链表的节点为块起始地址 下一节点存放在块的前8字节
+  void* freeList[CLASS_COUNT];
+  // 其他线程释放的块
+  std::atomic<void*> remoteFree[CLASS_COUNT];
+};
+
+namespace {
+// 区域建立后不再释放 状态表位于区域开头, 同样被锁定
+std::atomic<bool> initialized{false};
+RealTimeThread* threads = nullptr;
+char* chunkBase = nullptr;
+size_t chunkCount = 0;
+std::atomic<size_t> nextChunk{0};
+std::atomic<size_t> failures{0};
+pthread_key_t exitKey;
+
+size_t classOf(size_t bytes) {
+  if (bytes <= (size_t(1) << MIN_SHIFT)) return 0;
+  return 64 - __builtin_clzll(bytes - 1) - MIN_SHIFT;
+}
+
+void*& nextOf(void* block) { return *reinterpret_cast<void**>(block); }
+
+// 从未分出的块中取连续n块 用尽时返回nullptr
+char* claimChunks(size_t n) {
+  size_t next = nextChunk.load(std::memory_order_relaxed);
+  do {
+    if (n > chunkCount - next) return nullptr;
+  } while (!nextChunk.compare_exchange_weak(next, next + n,
+                                            std::memory_order_relaxed));
+  return chunkBase + next * RealTimePool::CHUNK_SIZE;
+}
+
+// 当前块剩余的部分按2的幂拆开放入空闲链表 最多CLASS_COUNT次
+void retireChunk(RealTimeThread* thread) {
+  size_t rest = thread->chunkEnd - thread->chunkPos;
+  while (rest >= (size_t(1) << MIN_SHIFT)) {
+    size_t shift = 63 - __builtin_clzll(rest);
+    void* block = thread->chunkPos;
+    nextOf(block) = thread->freeList[shift - MIN_SHIFT];
+    thread->freeList[shift - MIN_SHIFT] = block;
+    thread->chunkPos += size_t(1) << shift;
+    rest -= size_t(1) << shift;
+  }
+}
+
+// 取一个该大小的空闲块 依次查找私有链表、远程链表、当前块、新的块
+void* takeBlock(RealTimeThread* thread, size_t sizeClass) {
+  if (void* block = thread->freeList[sizeClass]) {
+    thread->freeList[sizeClass] = nextOf(block);
+    return block;
+  }
+  if (thread->remoteFree[sizeClass].load(std::memory_order_relaxed)) {
+    void* block = thread->remoteFree[sizeClass].exchange(
+        nullptr, std::memory_order_acquire);
+    if (block) {
+      thread->freeList[sizeClass] = nextOf(block);
+      return block;
+    }
+  }
+  size_t blockSize = size_t(1) << (sizeClass + MIN_SHIFT);
+  // 大于一块的请求独占连续的若干块
+  if (blockSize > RealTimePool::CHUNK_SIZE) {
+    return claimChunks(blockSize / RealTimePool::CHUNK_SIZE);
+  }
+  if (static_cast<size_t>(thread->chunkEnd - thread->chunkPos) < blockSize) {
+    char* chunk = claimChunks(1);
+    if (!chunk) return nullptr;
+    retireChunk(thread);
+    thread->chunkPos = chunk;
+    thread->chunkEnd = chunk + RealTimePool::CHUNK_SIZE;
+  }
+  void* block = thread->chunkPos;
+  thread->chunkPos += blockSize;
+  return block;
+}
+
+void releaseThread(RealTimeThread* thread) {
+  thread->inUse.store(false, std::memory_order_release);
+}
+}  // namespace
+
+void RealTimePool::onThreadExit(void* thread) {
+  // 之后其他线程局部变量析构时的释放按远程释放处理
+  ThreadCache::getInstance()->realTime_ = nullptr;
+  releaseThread(static_cast<RealTimeThread*>(thread));
+}
+
+bool RealTimePool::init(size_t bytes) {
+  if (initialized.exchange(true)) return false;
+  size_t tableBytes = (MAX_THREADS * sizeof(RealTimeThread) + PAGE_SIZE - 1) &
+                      ~(PAGE_SIZE - 1);
+  size_t chunks = bytes > tableBytes ? (bytes - tableBytes) / CHUNK_SIZE : 0;
+  size_t size = tableBytes + chunks * CHUNK_SIZE;
+  void* memory = chunks ? mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,
+                               -1, 0)
+                        : MAP_FAILED;
+  if (memory == MAP_FAILED) {
+    initialized.store(false);
+    return false;
+  }
+  // 锁定后不会因换出而缺页
+  if (mlock(memory, size) != 0) {
+    munmap(memory, size);
+    initialized.store(false);
+    return false;
+  }
+  if (pthread_key_create(&exitKey, onThreadExit) != 0) {
+    munlock(memory, size);
+    munmap(memory, size);
+    initialized.store(false);
+    return false;
+  }
+
+  threads = static_cast<RealTimeThread*>(memory);
+  for (size_t i = 0; i < MAX_THREADS; i++) {
+    RealTimeThread* thread = new (&threads[i]) RealTimeThread();
+    thread->index = static_cast<uint16_t>(i);
+  }
+  chunkBase = static_cast<char*>(memory) + tableBytes;
+  chunkCount = chunks;
+  regionBegin_.store(reinterpret_cast<uintptr_t>(chunkBase),
+                     std::memory_order_relaxed);
+  regionSize_.store(chunks * CHUNK_SIZE, std::memory_order_release);
+  return true;
+}
+
+bool RealTimePool::enter() {
+  ThreadCache* cache = ThreadCache::getInstance();
+  if (cache->realTime_) return true;
+  if (regionSize_.load(std::memory_order_acquire) == 0) return false;
+  for (size_t i = 0; i < MAX_THREADS; i++) {
+    bool expected = false;
+    if (threads[i].inUse.compare_exchange_strong(expected, true,
+                                                 std::memory_order_acquire)) {
+      cache->realTime_ = &threads[i];
+      pthread_setspecific(exitKey, &threads[i]);
+      return true;
+    }
+  }
+  return false;
+}
+
+void RealTimePool::leave() {
+  ThreadCache* cache = ThreadCache::getInstance();
+  if (!cache->realTime_) return;
+  pthread_setspecific(exitKey, nullptr);
+  releaseThread(cache->realTime_);
+  cache->realTime_ = nullptr;
+  // 实时模式中释放的普通块推迟到这里归还
+  cache->returnExcess();
+}
+
+void* RealTimePool::allocate(RealTimeThread* thread, size_t size,
+                             size_t align) {
+  // 对齐超过ALIGNMENT时多取align - ALIGNMENT字节 在块内向后对齐
+  size_t extra = align > ALIGNMENT ? align - ALIGNMENT : 0;
+  // 超过区域大小的请求直接失败 同时避免下面的加法溢出
+  size_t sizeClass = CLASS_COUNT;
+  if (size < chunkCount * CHUNK_SIZE) {
+    sizeClass = classOf(size + sizeof(BlockTag) + extra);
+  }
+  void* block =
+      sizeClass < CLASS_COUNT ? takeBlock(thread, sizeClass) : nullptr;
+  if (!block) {
+    failures.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  uintptr_t begin = reinterpret_cast<uintptr_t>(block);
+  uintptr_t ptr = (begin + sizeof(BlockTag) + align - 1) & ~(align - 1);
+  BlockTag* header = reinterpret_cast<BlockTag*>(ptr) - 1;
+  header->offset = static_cast<uint32_t>(ptr - begin);
+  header->owner = thread->index;
+  header->sizeClass = static_cast<uint16_t>(sizeClass);
+  return reinterpret_cast<void*>(ptr);
+}
+
+void RealTimePool::deallocate(RealTimeThread* thread, void* ptr) {
+  const BlockTag* header = static_cast<BlockTag*>(ptr) - 1;
+  void* block = static_cast<char*>(ptr) - header->offset;
+  size_t sizeClass = header->sizeClass;
+  RealTimeThread* owner = &threads[header->owner];
+  if (owner == thread) {
+    nextOf(block) = owner->freeList[sizeClass];
+    owner->freeList[sizeClass] = block;
+    return;
+  }
+  // 只有压入没有单个弹出 不存在ABA问题
+  void* head = owner->remoteFree[sizeClass].load(std::memory_order_relaxed);
+  do {
+    nextOf(block) = head;
+  } while (!owner->remoteFree[sizeClass].compare_exchange_weak(
+      head, block, std::memory_order_release, std::memory_order_relaxed));
+}
+
+size_t RealTimePool::getUsableSize(const void* ptr) {
+  const BlockTag* header = static_cast<const BlockTag*>(ptr) - 1;
+  return (size_t(1) << (header->sizeClass + MIN_SHIFT)) - header->offset;
+}
+
+RealTimeStats RealTimePool::getStats() {
+  RealTimeStats stats = {};
+  stats.regionBytes = regionSize_.load(std::memory_order_acquire);
+  if (!stats.regionBytes) return stats;
+  stats.usedBytes = nextChunk.load(std::memory_order_relaxed) * CHUNK_SIZE;
+  for (size_t i = 0; i < MAX_THREADS; i++) {
+    if (threads[i].inUse.load(std::memory_order_relaxed)) stats.threads++;
+  }
+  stats.failures = failures.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void RealTimePool::childAfterFork() {
+  if (!isEnabled()) return;
+  RealTimeThread* current = ThreadCache::getInstance()->realTime_;
+  for (size_t i = 0; i < MAX_THREADS; i++) {
+    if (&threads[i] != current) releaseThread(&threads[i]);
+  }
+  // 子进程不继承内存锁定 调用fork的线程处于实时模式时重新锁定
+  if (current) {
+    mlock(threads, chunkBase - reinterpret_cast<char*>(threads) +
+                       chunkCount * CHUNK_SIZE);
+  }
+}
+
+}  // namespace memory_pool
@@ -1,67 +1,496 @@
 #include "ThreadCache.h"
 
+#include <pthread.h>
+
+#include <algorithm>
+#include <cstring>
+
 #include "CentralCache.h"
+#include "GuardedPool.h"
+#include "HeapProfiler.h"
+#include "MemoryPressure.h"
+#include "PageCache.h"
+#include "RealTimePool.h"
 namespace memory_pool {
+#ifdef MEMORY_POOL_LATENCY_STATS
+class ThreadCache::LatencyTimer {
+ public:
+  LatencyTimer(ThreadCache* cache, LatencyOp op, size_t size)
+      : cache_(cache), op_(op), size_(size) {
+    latencyTier() = TIER_THREAD_CACHE;
+    start_ = readCycles();
+  }
+  ~LatencyTimer() {
+    uint64_t cycles = readCycles() - start_;
+    ThreadStats* stats = cache_->getStats();
+    if (!stats) return;
+    size_t bucket = LatencyHistogram::bucketOf(cycles);
+    ThreadLatency& latency = stats->latency;
+    ThreadStats::add(latency.byTier[op_][latencyTier()].counts[bucket], 1);
+    ThreadStats::add(
+        latency.bySize[op_][ThreadLatency::sizeGroup(size_)].counts[bucket],
+        1);
+  }
+
+ private:
+  ThreadCache* cache_;
+  LatencyOp op_;
+  size_t size_;
+  uint64_t start_;
+};
+#define LATENCY_SCOPE(op, size) LatencyTimer latencyTimer(this, op, size)
+#else
+#define LATENCY_SCOPE(op, size) ((void)0)
+#endif
+
 void* ThreadCache::allocate(size_t size) {
   if (size == 0) {
     size = ALIGNMENT;  // 至少分配一个对齐大小
   }
-  if (size > MAX_BYTES) {
-    return malloc(size);
+  LATENCY_SCOPE(OP_ALLOCATE, size);
+  // 实时模式不经过采样与各级缓存 没有系统调用与锁
+  if (realTime_) return RealTimePool::allocate(realTime_, size, ALIGNMENT);
+  // 未到保护页采样点时只多一次比较与自减
+  if (guardCountdown_ == 0) {
+    void* ptr = allocateGuarded(size);
+    if (ptr) return ptr;
+  } else {
+    guardCountdown_--;
   }
-  size_t index = SizeClass::getIndex(size);
-  // if (freeListSize_[index] == 0) return fetchFromCentralCache(index);
-  // 这里在没有判断分配成功的情况下先自减了数据
-  // 如果没有分配成功 会从中心缓存取数据
-  // 会返回fetchFromCentralCache 这里会补回这里的一次自减
-  freeListSize_[index]--;
-  void* ptr = freeList_[index];
-  // 检查线程本地空闲链表, 若不为空, 则直接分配
-  if (ptr != nullptr) {
-    freeList_[index] =
-        *reinterpret_cast<void**>(ptr);  // 空闲链表指向下一块空闲地址
+  // 未到采样点时只多一次减法
+  if (bytesUntilSample_ < size) {
+    void* ptr = allocateSampled(size);
+    if (ptr) return ptr;
+  } else {
+    bytesUntilSample_ -= size;
+  }
+  if (size > MAX_BYTES) {
+    if (size > MAX_ALLOC_BYTES) return nullptr;
+    // 大块直接从页缓存分配 不经过malloc
+    size_t numPages = pagesForSize(size);
+    void* ptr = pageCache().allocateSpan(numPages);
+    if (!ptr && !central_) {
+      ptr = MemoryPressure::relieve(numPages * PageCache::PAGE_SIZE, [&] {
+        return pageCache().allocateSpan(numPages);
+      });
+    }
+    if (ptr) countLargeAlloc(numPages * PageCache::PAGE_SIZE);
     return ptr;
   }
-  return fetchFromCentralCache(index);
+  return allocateByIndex(SizeClass::getIndex(size));
 }
 
 void ThreadCache::deallocate(void* ptr, size_t size) {
+  LATENCY_SCOPE(OP_DEALLOCATE, size);
+  if (RealTimePool::contains(ptr)) {
+    RealTimePool::deallocate(realTime_, ptr);
+    return;
+  }
+  if (GuardedPool::contains(ptr)) {
+    deallocateGuarded(ptr);
+    return;
+  }
+  if (HeapProfiler::isTracking() && deallocateSampled(ptr)) return;
   if (size > MAX_BYTES) {
-    free(ptr);
+    // 原地扩展或收缩过的大块以span的实际大小为准
+    countLargeFree(PageCache::getObjectSize(ptr));
+    pageCache().deallocateSpan(ptr, pagesForSize(size));
     return;
   }
-  size_t index = SizeClass::getIndex(size);
+  if (size == 0) {
+    size = ALIGNMENT;  // 与allocate保持一致
+  }
+  deallocateByIndex(ptr, SizeClass::getIndex(size));
+}
 
-  // 插入对应空闲链表首位
-  *reinterpret_cast<void**>(ptr) = freeList_[index];
-  freeList_[index] = ptr;
-  // 同时更新空闲链表长度
-  freeListSize_[index]++;
-  if (shouldReturnToCentralCache(index)) {
-    returnToCentralCache(freeList_[index], size);
+void ThreadCache::deallocate(void* ptr) {
+  if (!ptr) return;
+  // 实时区域的块不在页映射中
+  if (RealTimePool::contains(ptr)) {
+    RealTimePool::deallocate(realTime_, ptr);
+    return;
+  }
+  // 已释放的槽位不在页映射中 需在查询大小之前识别, 才能报告重复释放
+  if (GuardedPool::contains(ptr)) {
+    deallocateGuarded(ptr);
+    return;
+  }
+  // 由页映射查出块大小 不属于内存池的指针直接忽略
+  size_t size = PageCache::getObjectSize(ptr);
+  if (size == 0) return;
+  deallocate(ptr, size);
+}
+
+void* ThreadCache::reallocate(void* ptr, size_t oldSize, size_t newSize) {
+  if (!ptr) return allocate(newSize);
+  if (newSize == 0) {
+    deallocate(ptr, oldSize);
+    return nullptr;
+  }
+  // 超出上限时失败 原块保持不变
+  if (newSize > MAX_ALLOC_BYTES) return nullptr;
+  if (oldSize == 0) oldSize = ALIGNMENT;
+
+  if (RealTimePool::contains(ptr)) {
+    // 实时区域的块仍放得下时原地返回
+    if (newSize <= RealTimePool::getUsableSize(ptr)) return ptr;
+  } else if (realTime_) {
+    // 实时线程不调整普通块 下面从实时区域分配新块后复制
+  } else if (oldSize <= MAX_BYTES) {
+    // 仍落在同一大小类 块本身就放得下
+    if (newSize <= MAX_BYTES &&
+        SizeClass::getIndex(newSize) == SizeClass::getIndex(oldSize)) {
+      return ptr;
+    }
+  } else if (newSize > MAX_BYTES) {
+    // 大块按页管理 deallocate时以span记录的页数为准
+    size_t oldPages = pagesForSize(oldSize);
+    size_t newPages = pagesForSize(newSize);
+    PageCache& pages = pageCache();
+    size_t oldBytes = PageCache::getObjectSize(ptr);
+    if (newPages <= oldPages) {
+      pages.shrinkSpan(ptr, newPages);
+      countLargeFree(oldBytes - PageCache::getObjectSize(ptr));
+      return ptr;
+    }
+    if (pages.growSpan(ptr, newPages)) {
+      countLargeAlloc(PageCache::getObjectSize(ptr) - oldBytes);
+      return ptr;
+    }
+    if (newSize >= MREMAP_THRESHOLD) {
+      void* newPtr = pages.remapSpan(ptr, newPages);
+      if (newPtr) {
+        countLargeAlloc(PageCache::getObjectSize(newPtr) - oldBytes);
+        return newPtr;
+      }
+    }
+  }
+
+  void* newPtr = allocate(newSize);
+  if (!newPtr) return nullptr;
+  memcpy(newPtr, ptr, std::min(oldSize, newSize));
+  deallocate(ptr, oldSize);
+  return newPtr;
+}
+
+CentralCache& ThreadCache::central() {
+  return central_ ? *central_ : CentralCache::getInstance();
+}
+
+PageCache& ThreadCache::pageCache() {
+  return pageCache_ ? *pageCache_ : PageCache::getInstance();
+}
+
+void ThreadCache::flushAll() {
+  for (size_t index = 0; index < FREE_LIST_SIZE; index++) {
+    if (freeList_[index] == nullptr) continue;
+    size_t blockSize = (index + 1) * ALIGNMENT;
+    central().returnRange(freeList_[index], freeListSize_[index] * blockSize,
+                          index);
+    countReturned(index, freeListSize_[index]);
+    freeList_[index] = nullptr;
+    freeListSize_[index] = 0;
+  }
+}
+
+void ThreadCache::returnExcess() {
+  for (size_t index = 0; index < FREE_LIST_SIZE; index++) {
+    if (shouldReturnToCentralCache(index)) {
+      returnToCentralCache(freeList_[index], (index + 1) * ALIGNMENT);
+    }
+  }
+}
+
+ThreadStats* ThreadCache::attachStats() {
+  // 独立堆的线程缓存由堆提供统计
+  if (central_) return nullptr;
+  // 线程退出时回调onThreadExit 键值为该线程的统计
+  // pthread_key_create与前32个键的setspecific都不会调用malloc
+  static pthread_key_t exitKey = [] {
+    pthread_key_t key;
+    pthread_key_create(&key, onThreadExit);
+    return key;
+  }();
+  stats_ = StatsRegistry::attach(this);
+  if (stats_) pthread_setspecific(exitKey, stats_);
+  return stats_;
+}
+
+void ThreadCache::onThreadExit(void* stats) {
+  ThreadCache* cache = getInstance();
+  // 缓存的块归还中心缓存 供其他线程使用
+  cache->flushAll();
+  cache->stats_ = nullptr;
+  StatsRegistry::detach(static_cast<ThreadStats*>(stats));
+}
+
+void ThreadCache::reclaimAfterFork() {
+  // 线程局部存储随线程栈一起保留在子进程中 在创建新线程之前仍可读取
+  const ThreadStats* current = getInstance()->stats_;
+  while (ThreadStats* stats = StatsRegistry::findOther(current)) {
+    ThreadCache* cache = stats->cache;
+    cache->flushAll();
+    cache->stats_ = nullptr;
+    StatsRegistry::detach(stats);
+  }
+}
+
+void ThreadCache::countFetched(size_t index, size_t n) {
+  if (ThreadStats* stats = getStats()) {
+    ThreadStats::add(stats->centralNet[index], n);
+  }
+}
+
+void ThreadCache::countReturned(size_t index, size_t n) {
+  if (ThreadStats* stats = getStats()) {
+    ThreadStats::sub(stats->centralNet[index], n);
+  }
+}
+
+void ThreadCache::countLargeAlloc(size_t bytes) {
+  if (ThreadStats* stats = getStats()) {
+    ThreadStats::add(stats->largeAllocCount, 1);
+    ThreadStats::add(stats->largeAllocBytes, bytes);
+  }
+}
+
+void ThreadCache::countLargeFree(size_t bytes) {
+  if (ThreadStats* stats = getStats()) {
+    ThreadStats::add(stats->largeFreeCount, 1);
+    ThreadStats::add(stats->largeFreeBytes, bytes);
+  }
+}
+
+void* ThreadCache::allocateSampled(size_t size) {
+  if (central_ || !HeapProfiler::shouldSample()) {
+    // 线程的零初始倒计数也在这里第一次设定
+    bytesUntilSample_ =
+        central_ ? SIZE_MAX : HeapProfiler::DISABLED_RECHECK_BYTES;
+    return nullptr;
   }
+  bytesUntilSample_ = HeapProfiler::nextSampleDistance();
+  HeapProfiler::pollDumpRequest();
+
+  // 采样的分配独占span 释放时由页映射识别
+  if (size > MAX_ALLOC_BYTES) return nullptr;
+  size_t numPages = pagesForSize(size);
+  void* ptr = pageCache().allocateSpan(numPages);
+  if (!ptr) return nullptr;
+  PageMap::getInstance().get(ptr)->sampled = true;
+  countLargeAlloc(numPages * PageCache::PAGE_SIZE);
+  HeapProfiler::recordAlloc(ptr, size);
+  return ptr;
+}
+
+bool ThreadCache::deallocateSampled(void* ptr) {
+  Span* span = PageMap::getInstance().get(ptr);
+  if (!span || !span->sampled) return false;
+  HeapProfiler::recordFree(ptr);
+  countLargeFree(span->numPages * PageCache::PAGE_SIZE);
+  PageCache::getInstance().deallocateSpan(ptr, span->numPages);
+  return true;
+}
+
+void* ThreadCache::allocateGuarded(size_t size) {
+  if (central_ || !GuardedPool::isEnabled()) {
+    // 线程的零初始倒计数也在这里第一次设定
+    guardCountdown_ =
+        central_ ? SIZE_MAX : GuardedPool::DISABLED_RECHECK_COUNT;
+    return nullptr;
+  }
+  guardCountdown_ = GuardedPool::nextSampleCountdown();
+  void* ptr = GuardedPool::allocate(size);
+  if (ptr) countLargeAlloc(PageCache::PAGE_SIZE);
+  return ptr;
+}
+
+void ThreadCache::deallocateGuarded(void* ptr) {
+  GuardedPool::deallocate(ptr);
+  countLargeFree(PageCache::PAGE_SIZE);
+}
+
+size_t ThreadCache::pagesForSize(size_t size) {
+  return (size + PageCache::PAGE_SIZE - 1) / PageCache::PAGE_SIZE;
 }
 
 // 判断是否需要将内存回收给中心缓存
 bool ThreadCache::shouldReturnToCentralCache(size_t index) {
   return (freeListSize_[index] > THREAD_HOLD);
 }
+void* ThreadCache::allocateAligned(size_t size, size_t align) {
+  // 对齐要求必须是2的幂
+  if (align == 0 || (align & (align - 1)) != 0) {
+    return nullptr;
+  }
+  if (align <= ALIGNMENT) {
+    return allocate(size);
+  }
+  // 取整到align的倍数时会溢出
+  if (size > MAX_ALLOC_BYTES) return nullptr;
+  if (align > PageCache::PAGE_SIZE) {
+    // 实时区域只支持不超过页大小的对齐
+    if (realTime_) return nullptr;
+    return allocateLargeAligned(size, align);
+  }
+  if (realTime_) return RealTimePool::allocate(realTime_, size, align);
+  // 大块来自按页对齐的span 同样满足对齐要求
+  return allocate(SizeClass::alignedSize(size, align));
+}
+
+void* ThreadCache::allocateLargeAligned(size_t size, size_t align) {
+  // 至少占用大块的页数 不带大小的释放由span大小识别为大块
+  size_t numPages = pagesForSize(std::max(size, MAX_BYTES + 1));
+  void* ptr = pageCache().allocateAlignedSpan(numPages, align);
+  if (!ptr && !central_) {
+    ptr = MemoryPressure::relieve(numPages * PageCache::PAGE_SIZE, [&] {
+      return pageCache().allocateAlignedSpan(numPages, align);
+    });
+  }
+  if (ptr) countLargeAlloc(numPages * PageCache::PAGE_SIZE);
+  return ptr;
+}
+
+void ThreadCache::deallocateAligned(void* ptr, size_t size, size_t align) {
+  if (!ptr) return;
+  if (align <= ALIGNMENT || RealTimePool::contains(ptr)) {
+    deallocate(ptr, size);
+    return;
+  }
+  if (align > PageCache::PAGE_SIZE) {
+    deallocate(ptr, std::max(size, MAX_BYTES + 1));
+    return;
+  }
+  deallocate(ptr, SizeClass::alignedSize(size, align));
+}
+
+size_t ThreadCache::allocateBatch(size_t size, size_t n, void** out) {
+  if (size == 0) {
+    size = ALIGNMENT;
+  }
+  if (size > MAX_BYTES || realTime_) {
+    for (size_t i = 0; i < n; i++) {
+      out[i] = allocate(size);
+      if (!out[i]) return i;
+    }
+    return n;
+  }
+  size_t index = SizeClass::getIndex(size);
+
+  // 先整段取走线程本地空闲链表
+  size_t count = 0;
+  void* current = freeList_[index];
+  while (current != nullptr && count < n) {
+    out[count++] = current;
+    current = *reinterpret_cast<void**>(current);
+  }
+  freeList_[index] = current;
+  freeListSize_[index] -= count;
+  if (count == n) {
+    countAlloc(index, n);
+    return n;
+  }
+
+  // 缺少的部分一次性从中心缓存获取
+  void* start = central().fetchRange(index, n - count);
+  if (start) {
+    countFetched(index, n - count);
+    for (current = start; current != nullptr;
+         current = *reinterpret_cast<void**>(current)) {
+      out[count++] = current;
+    }
+  }
+  countAlloc(index, count);
+  return count;
+}
+
+void ThreadCache::deallocateBatch(void** ptrs, size_t n, size_t size) {
+  if (n == 0) return;
+  // 开启实时模式后其中可能有实时区域的块 逐个释放
+  bool oneByOne = size > MAX_BYTES || RealTimePool::isEnabled();
+  // 采样的分配须记录释放并归还整个span
+  oneByOne = oneByOne || HeapProfiler::isTracking();
+  // 保护页槽位须经过GuardedPool释放 不能链入空闲链表
+  for (size_t i = 0; i < n && !oneByOne; i++) {
+    oneByOne = GuardedPool::contains(ptrs[i]);
+  }
+  if (oneByOne) {
+    for (size_t i = 0; i < n; i++) {
+      deallocate(ptrs[i], size);
+    }
+    return;
+  }
+  if (size == 0) {
+    size = ALIGNMENT;
+  }
+  size_t index = SizeClass::getIndex(size);
+
+  // 将ptrs串成链表后整段插入空闲链表首位
+  for (size_t i = 0; i + 1 < n; i++) {
+    *reinterpret_cast<void**>(ptrs[i]) = ptrs[i + 1];
+  }
+  *reinterpret_cast<void**>(ptrs[n - 1]) = freeList_[index];
+  freeList_[index] = ptrs[0];
+  freeListSize_[index] += n;
+  countFree(index, n);
+  if (shouldReturnToCentralCache(index)) {
+    returnToCentralCache(freeList_[index], size);
+  }
+}
+
+bool ThreadCache::reserve(size_t size, size_t count, bool fillThreadCache) {
+  if (count == 0) return true;
+  if (size == 0) {
+    size = ALIGNMENT;
+  }
+  if (size > MAX_BYTES) {
+    return pageCache().reserve(pagesForSize(size) * count);
+  }
+  size_t index = SizeClass::getIndex(size);
+  if (central().reserve(index, count) < count) return false;
+  if (!fillThreadCache || freeListSize_[index] >= THREAD_HOLD) return true;
+
+  // 超过THREAD_HOLD会触发归还 只填到该上限
+  size_t n = std::min(count, THREAD_HOLD - freeListSize_[index]);
+  void* start = central().fetchRange(index, n);
+  if (!start) return false;
+  void* end = start;
+  while (*reinterpret_cast<void**>(end) != nullptr) {
+    end = *reinterpret_cast<void**>(end);
+  }
+  *reinterpret_cast<void**>(end) = freeList_[index];
+  freeList_[index] = start;
+  freeListSize_[index] += n;
+  countFetched(index, n);
+  return true;
+}
+
 void* ThreadCache::fetchFromCentralCache(size_t index) {
+  // 其他线程因内存上限清空过线程缓存 本线程也归还缓存的块
+  if (!central_ && pressureEpoch_ != MemoryPressure::flushEpoch()) {
+    pressureEpoch_ = MemoryPressure::flushEpoch();
+    flushAll();
+  }
   // 从中心缓存批量获取内存
-  void* start = CentralCache::getInstance().fetchRange(index);
-  if (!start) return nullptr;
+  size_t blockSize = (index + 1) * ALIGNMENT;
+  size_t batchNum = getBatchNum(blockSize);
+  void* start = central().fetchRange(index, batchNum);
+  if (!start && !central_) {
+    start = MemoryPressure::relieve(batchNum * blockSize, [&] {
+      return central().fetchRange(index, batchNum);
+    });
+  }
+  if (!start) {
+    // 补回allocateByIndex中的自减 内存上限下分配失败后计数仍保持准确
+    freeListSize_[index]++;
+    return nullptr;
+  }
 
   // 取一个返回, 其余的放回空闲链表
   void* result = start;
   freeList_[index] = *reinterpret_cast<void**>(start);
-  size_t batchNum = 0;
-  void* current = start;
-
-  while (current != nullptr) {
-    batchNum++;
-    current = *reinterpret_cast<void**>(current);
-  }
   freeListSize_[index] += batchNum;
+  countFetched(index, batchNum);
+  countAlloc(index);
   return result;
 }
 
@@ -98,8 +527,9 @@ void ThreadCache::returnToCentralCache(void* start, size_t size) {
     // 更新自由链表大小
     freeListSize_[index] = keepNum;
     if (returnNum > 0 && nextNode != nullptr) {
-      CentralCache::getInstance().returnRange(nextNode, returnNum * alignedSize,
+      central().returnRange(nextNode, returnNum * alignedSize,
                                               index);
+      countReturned(index, returnNum);
     }
   }
 }
@@ -129,6 +559,6 @@ size_t ThreadCache::getBatchNum(size_t size) {
   size_t maxNum = std::max(size_t(1), MAX_BATCH_SIZE / size);
 
   // 取最小值，但确保至少返回1
-  return std::max(sizeof(1), std::min(maxNum, baseNum));
+  return std::max(size_t(1), std::min(maxNum, baseNum));
 }
 }  // namespace memory_pool
\ No newline at end of file
@@ -0,0 +1,321 @@
+#include "TraceRecorder.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+#include "MetadataAllocator.h"
+#include "common.h"
+
+namespace memory_pool {
+namespace {
+// 一个线程的记录缓冲区 写入与写出都在lock内进行
+struct ThreadBuffer {
+  std::atomic_flag lock;
+  uint32_t thread;
+  uint32_t count;
+  ThreadBuffer* prev;
+  ThreadBuffer* next;
+  TraceRecord records[TraceRecorder::BUFFER_RECORDS];
+};
+
+// 加锁顺序: listMutex -> ThreadBuffer::lock -> fileMutex
+std::mutex listMutex;  // 保护缓冲区链表与线程序号
+ThreadBuffer* buffers = nullptr;
+uint32_t nextThread = 0;
+std::mutex fileMutex;  // 保护traceFd
+int traceFd = -1;
+std::atomic<uint64_t> startNs{0};
+
+// 写出与登记期间本线程的分配不再记录 避免重入
+thread_local bool inRecorder MEMORY_POOL_TLS_MODEL = false;
+thread_local ThreadBuffer* threadBuffer MEMORY_POOL_TLS_MODEL = nullptr;
+// 线程退出时释放缓冲区后 之后的分配不再登记新的缓冲区
+thread_local bool bufferReleased MEMORY_POOL_TLS_MODEL = false;
+
+uint64_t monotonicNs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void lockBuffer(ThreadBuffer* buffer) {
+  while (buffer->lock.test_and_set(std::memory_order_acquire)) {
+  }
+}
+
+void unlockBuffer(ThreadBuffer* buffer) {
+  buffer->lock.clear(std::memory_order_release);
+}
+
+bool writeAll(int fd, const void* data, size_t size) {
+  const char* p = static_cast<const char*>(data);
+  while (size > 0) {
+    ssize_t n = write(fd, p, size);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+// 需持有buffer->lock 文件已关闭时丢弃记录
+void flushBuffer(ThreadBuffer* buffer) {
+  if (buffer->count == 0) return;
+  {
+    std::lock_guard<std::mutex> lock(fileMutex);
+    if (traceFd >= 0) {
+      TraceChunkHeader header = {buffer->thread, buffer->count};
+      writeAll(traceFd, &header, sizeof(header));
+      writeAll(traceFd, buffer->records, buffer->count * sizeof(TraceRecord));
+    }
+  }
+  buffer->count = 0;
+}
+
+void releaseBuffer(void* arg) {
+  ThreadBuffer* buffer = static_cast<ThreadBuffer*>(arg);
+  inRecorder = true;
+  {
+    std::lock_guard<std::mutex> lock(listMutex);
+    lockBuffer(buffer);
+    flushBuffer(buffer);
+    unlockBuffer(buffer);
+    if (buffer->prev) {
+      buffer->prev->next = buffer->next;
+    } else {
+      buffers = buffer->next;
+    }
+    if (buffer->next) buffer->next->prev = buffer->prev;
+  }
+  MetadataAllocator::deallocate(buffer, sizeof(ThreadBuffer));
+  threadBuffer = nullptr;
+  bufferReleased = true;
+  inRecorder = false;
+}
+
+// 第一次记录时登记缓冲区 线程退出时由releaseBuffer写出并释放
+ThreadBuffer* attachBuffer() {
+  if (bufferReleased) return nullptr;
+  static pthread_key_t exitKey = [] {
+    pthread_key_t key;
+    pthread_key_create(&key, releaseBuffer);
+    return key;
+  }();
+  // 超过MAX_META_SIZE的元数据直接来自mmap 已清零
+  ThreadBuffer* buffer = static_cast<ThreadBuffer*>(
+      MetadataAllocator::allocate(sizeof(ThreadBuffer)));
+  if (!buffer) return nullptr;
+  buffer->lock.clear();
+  {
+    std::lock_guard<std::mutex> lock(listMutex);
+    buffer->thread = nextThread++;
+    buffer->next = buffers;
+    if (buffers) buffers->prev = buffer;
+    buffers = buffer;
+  }
+  pthread_setspecific(exitKey, buffer);
+  threadBuffer = buffer;
+  return buffer;
+}
+
+uint64_t pack(size_t size, TraceOp op, size_t align) {
+  uint64_t shift = align ? __builtin_ctzll(align) : 0;
+  return (static_cast<uint64_t>(size) & TraceRecord::SIZE_MASK) |
+         static_cast<uint64_t>(op) << 48 | shift << 56;
+}
+
+// 追加count条记录 两条realloc记录需写入同一块, 因此一次追加
+void append(const TraceRecord* records, size_t count) {
+  if (inRecorder) return;
+  inRecorder = true;
+  ThreadBuffer* buffer = threadBuffer ? threadBuffer : attachBuffer();
+  if (buffer) {
+    lockBuffer(buffer);
+    // 在锁内确认仍在记录 stop之后的记录不会留在缓冲区
+    if (TraceRecorder::isEnabled()) {
+      if (buffer->count + count > TraceRecorder::BUFFER_RECORDS) {
+        flushBuffer(buffer);
+      }
+      memcpy(&buffer->records[buffer->count], records,
+             count * sizeof(TraceRecord));
+      buffer->count += count;
+      if (buffer->count == TraceRecorder::BUFFER_RECORDS) flushBuffer(buffer);
+    }
+    unlockBuffer(buffer);
+  }
+  inRecorder = false;
+}
+}  // namespace
+
+bool TraceRecorder::start(const char* path) {
+  stop();
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) return false;
+  TraceFileHeader header;
+  memcpy(header.magic, TraceFileHeader::MAGIC, sizeof(header.magic));
+  header.startNs = monotonicNs();
+  if (!writeAll(fd, &header, sizeof(header))) {
+    close(fd);
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(listMutex);
+  // 已有的缓冲区重新编号 线程序号只在一个文件内有意义
+  nextThread = 0;
+  for (ThreadBuffer* buffer = buffers; buffer; buffer = buffer->next) {
+    lockBuffer(buffer);
+    buffer->thread = nextThread++;
+    buffer->count = 0;
+    unlockBuffer(buffer);
+  }
+  {
+    std::lock_guard<std::mutex> fileLock(fileMutex);
+    traceFd = fd;
+  }
+  startNs.store(header.startNs, std::memory_order_relaxed);
+  enabled_.store(true, std::memory_order_release);
+  return true;
+}
+
+void TraceRecorder::stop() {
+  std::lock_guard<std::mutex> lock(listMutex);
+  enabled_.store(false, std::memory_order_relaxed);
+  for (ThreadBuffer* buffer = buffers; buffer; buffer = buffer->next) {
+    lockBuffer(buffer);
+    flushBuffer(buffer);
+    unlockBuffer(buffer);
+  }
+  std::lock_guard<std::mutex> fileLock(fileMutex);
+  if (traceFd >= 0) {
+    close(traceFd);
+    traceFd = -1;
+  }
+}
+
+uint64_t TraceRecorder::now() {
+  return monotonicNs() - startNs.load(std::memory_order_relaxed);
+}
+
+void TraceRecorder::recordAllocate(const void* ptr, size_t size,
+                                   size_t align) {
+  if (!ptr) return;
+  TraceRecord record = {now(), reinterpret_cast<uintptr_t>(ptr),
+                        pack(size, TRACE_ALLOCATE, align)};
+  append(&record, 1);
+}
+
+void TraceRecorder::recordFree(const void* ptr, size_t size) {
+  if (!ptr) return;
+  TraceRecord record = {now(), reinterpret_cast<uintptr_t>(ptr),
+                        pack(size, TRACE_FREE, 0)};
+  append(&record, 1);
+}
+
+void TraceRecorder::recordReallocate(const void* oldPtr, size_t oldSize,
+                                     const void* newPtr, size_t newSize,
+                                     uint64_t startTime) {
+  // 与ThreadCache::reallocate的特殊情况对应
+  if (!oldPtr) {
+    recordAllocate(newPtr, newSize);
+    return;
+  }
+  if (newSize == 0) {
+    TraceRecord record = {startTime, reinterpret_cast<uintptr_t>(oldPtr),
+                          pack(oldSize, TRACE_FREE, 0)};
+    append(&record, 1);
+    return;
+  }
+  if (!newPtr) return;  // 失败时原块不变
+  TraceRecord records[2] = {
+      {startTime, reinterpret_cast<uintptr_t>(oldPtr),
+       pack(oldSize, TRACE_REALLOC_FROM, 0)},
+      {now(), reinterpret_cast<uintptr_t>(newPtr),
+       pack(newSize, TRACE_REALLOC_TO, 0)},
+  };
+  append(records, 2);
+}
+
+bool TraceRecorder::load(const char* path, std::vector<TraceEvent>* events) {
+  FILE* in = fopen(path, "rb");
+  if (!in) return false;
+  TraceFileHeader header;
+  bool ok = fread(&header, sizeof(header), 1, in) == 1 &&
+            memcmp(header.magic, TraceFileHeader::MAGIC,
+                   sizeof(header.magic)) == 0;
+  std::vector<TraceRecord> records;
+  TraceChunkHeader chunk;
+  while (ok && fread(&chunk, sizeof(chunk), 1, in) == 1) {
+    records.resize(chunk.count);
+    if (fread(records.data(), sizeof(TraceRecord), chunk.count, in) !=
+        chunk.count) {
+      ok = false;
+      break;
+    }
+    for (const TraceRecord& record : records) {
+      events->push_back({record.timestamp, record.object, record.size(),
+                         record.align(), chunk.thread, record.op()});
+    }
+  }
+  fclose(in);
+  // 块按写出顺序排列 同一线程的记录先后不变
+  std::stable_sort(events->begin(), events->end(),
+                   [](const TraceEvent& a, const TraceEvent& b) {
+                     return a.timestamp < b.timestamp;
+                   });
+  return ok;
+}
+
+void TraceRecorder::prepareFork() {
+  listMutex.lock();
+  for (ThreadBuffer* buffer = buffers; buffer; buffer = buffer->next) {
+    lockBuffer(buffer);
+  }
+  fileMutex.lock();
+}
+
+void TraceRecorder::afterFork() {
+  fileMutex.unlock();
+  for (ThreadBuffer* buffer = buffers; buffer; buffer = buffer->next) {
+    unlockBuffer(buffer);
+  }
+  listMutex.unlock();
+}
+
+void TraceRecorder::childAfterFork() {
+  enabled_.store(false, std::memory_order_relaxed);
+  // 关闭的只是子进程的文件描述符 父进程继续写入
+  if (traceFd >= 0) {
+    close(traceFd);
+    traceFd = -1;
+  }
+  fileMutex.unlock();
+
+  ThreadBuffer* buffer = buffers;
+  buffers = nullptr;
+  while (buffer) {
+    ThreadBuffer* next = buffer->next;
+    if (buffer == threadBuffer) {
+      buffer->count = 0;
+      buffer->prev = buffer->next = nullptr;
+      buffers = buffer;
+      unlockBuffer(buffer);
+    } else {
+      MetadataAllocator::deallocate(buffer, sizeof(ThreadBuffer));
+    }
+    buffer = next;
+  }
+  listMutex.unlock();
+}
+
+}  // namespace memory_pool
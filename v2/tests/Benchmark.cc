@@ -0,0 +1,818 @@
+// 参数化的分配器基准测试 对比v2、v1 HashBucket与glibc malloc
+// 每组参数重复多次试验, 输出中位数与置信区间, 可写出JSON并与基线比较
+// patterns: 同一线程分配并按LIFO/FIFO/随机顺序释放
+// pipeline: 生产者分配消息, 经队列交给消费者释放, 记录延迟与RSS的变化
+//
+// 用法: benchmark [--suite all|patterns|pipeline] [--trials N] [--ops N]
+//                 [--threads 1,4] [--pipelines 1x1,2x2] [--filter 子串]
+//                 [--json 输出文件] [--baseline 基线JSON] [--tolerance 0.05]
+// 指定基线时 中位数显著变慢的基准项会列出, 并以退出码1结束
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../v1/include/MemoryPool.h"
+#include "MemoryPool.h"
+
+namespace {
+// 被测分配器 释放时都传入申请的大小
+struct Allocator {
+  const char* name;
+  void* (*allocate)(size_t size);
+  void (*deallocate)(void* ptr, size_t size);
+  // 线程缓存与中心缓存中的空闲字节 不支持时为nullptr
+  void (*cacheBytes)(size_t* threadCache, size_t* centralCache);
+};
+
+void v2CacheBytes(size_t* threadCache, size_t* centralCache) {
+  memory_pool::PoolStats stats = memory_pool::MemoryPool::getStats();
+  *threadCache = *centralCache = 0;
+  for (const memory_pool::SizeClassStats& cls : stats.sizeClasses) {
+    *threadCache += cls.threadCacheBytes;
+    *centralCache += cls.centralCacheBytes;
+  }
+}
+
+const Allocator ALLOCATORS[] = {
+    {"v2", [](size_t size) { return memory_pool::MemoryPool::allocate(size); },
+     [](void* ptr, size_t size) {
+       memory_pool::MemoryPool::deallocate(ptr, size);
+     },
+     v2CacheBytes},
+    {"v1",
+     [](size_t size) { return memoryPool::HashBucket::useMemory(size); },
+     [](void* ptr, size_t size) {
+       memoryPool::HashBucket::freeMemory(ptr, size);
+     },
+     nullptr},
+    {"malloc", [](size_t size) { return malloc(size); },
+     [](void* ptr, size_t) { free(ptr); }, nullptr},
+};
+
+// 请求大小的分布
+struct SizeDistribution {
+  const char* name;
+  size_t (*sample)(std::mt19937_64& rng);
+};
+
+const SizeDistribution SIZE_DISTRIBUTIONS[] = {
+    {"fixed64", [](std::mt19937_64&) -> size_t { return 64; }},
+    // v1能处理的全部大小 按8字节对齐均匀分布
+    {"uniform8-512",
+     [](std::mt19937_64& rng) -> size_t { return 8 * (rng() % 64 + 1); }},
+    // 对数均匀 小块多、大块少的长尾, 超过512字节的部分v1交给new
+    {"log8-32k",
+     [](std::mt19937_64& rng) -> size_t {
+       double exponent = 3 + 12 * std::generate_canonical<double, 53>(rng);
+       return static_cast<size_t>(std::exp2(exponent));
+     }},
+};
+
+// 释放顺序
+enum Pattern {
+  PATTERN_LIFO,    // 一批分配后逆序释放
+  PATTERN_FIFO,    // 一批分配后按分配顺序释放
+  PATTERN_RANDOM,  // 保持工作集大小 每次随机释放一个再分配一个
+  PATTERN_COUNT
+};
+
+const char* const PATTERN_NAMES[PATTERN_COUNT] = {"lifo", "fifo", "random"};
+
+// 每线程同时存活的块数
+constexpr size_t BATCH = 1000;
+
+// 生产者与消费者的线程数
+struct PipelineShape {
+  size_t producers;
+  size_t consumers;
+};
+
+struct Options {
+  std::string suite = "all";
+  size_t trials = 11;
+  size_t ops = 200000;  // 每线程每次试验的分配释放对数, 或每个生产者的消息数
+  std::vector<size_t> threads = {1, 4};
+  std::vector<PipelineShape> pipelines = {{1, 1}, {2, 2}, {4, 1}, {1, 4}};
+  std::string filter;
+  std::string jsonPath;
+  std::string baselinePath;
+  double tolerance = 0.05;
+};
+
+// 一个线程的预生成负载 试验中不调用随机数生成器
+struct Workload {
+  std::vector<size_t> sizes;    // 第i次分配的大小
+  std::vector<uint32_t> slots;  // random模式下第i次替换的槽位
+};
+
+Workload makeWorkload(const SizeDistribution& dist, Pattern pattern,
+                      size_t ops, uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  Workload workload;
+  workload.sizes.resize(ops);
+  for (size_t& size : workload.sizes) size = dist.sample(rng);
+  if (pattern == PATTERN_RANDOM) {
+    workload.slots.resize(ops);
+    for (uint32_t& slot : workload.slots) slot = rng() % BATCH;
+  }
+  return workload;
+}
+
+// 写一个字节 让每次分配都触及内存, 也避免调用被优化掉
+inline void* touch(void* ptr) {
+  static_cast<volatile char*>(ptr)[0] = 1;
+  return ptr;
+}
+
+void runWorkload(const Allocator& alloc, Pattern pattern,
+                 const Workload& workload) {
+  const std::vector<size_t>& sizes = workload.sizes;
+  size_t ops = sizes.size();
+  void* ptrs[BATCH];
+  size_t ptrSizes[BATCH];
+
+  if (pattern == PATTERN_RANDOM) {
+    size_t warm = std::min(BATCH, ops);
+    for (size_t i = 0; i < warm; i++) {
+      ptrSizes[i] = sizes[i];
+      ptrs[i] = touch(alloc.allocate(sizes[i]));
+    }
+    for (size_t i = warm; i < ops; i++) {
+      uint32_t slot = workload.slots[i];
+      alloc.deallocate(ptrs[slot], ptrSizes[slot]);
+      ptrSizes[slot] = sizes[i];
+      ptrs[slot] = touch(alloc.allocate(sizes[i]));
+    }
+    for (size_t i = 0; i < warm; i++) alloc.deallocate(ptrs[i], ptrSizes[i]);
+    return;
+  }
+
+  for (size_t begin = 0; begin < ops; begin += BATCH) {
+    size_t count = std::min(BATCH, ops - begin);
+    for (size_t i = 0; i < count; i++) {
+      ptrs[i] = touch(alloc.allocate(sizes[begin + i]));
+    }
+    if (pattern == PATTERN_LIFO) {
+      for (size_t i = count; i-- > 0;) {
+        alloc.deallocate(ptrs[i], sizes[begin + i]);
+      }
+    } else {
+      for (size_t i = 0; i < count; i++) {
+        alloc.deallocate(ptrs[i], sizes[begin + i]);
+      }
+    }
+  }
+}
+
+// 一次试验 所有线程同时开始, 返回最慢线程的耗时(纳秒)
+double runTrial(const Allocator& alloc, Pattern pattern,
+                const std::vector<Workload>& workloads) {
+  using clock = std::chrono::steady_clock;
+  size_t threadCount = workloads.size();
+  std::vector<double> elapsed(threadCount);
+  std::atomic<size_t> ready{0};
+  std::atomic<bool> go{false};
+
+  auto worker = [&](size_t t) {
+    ready.fetch_add(1);
+    while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+    auto start = clock::now();
+    runWorkload(alloc, pattern, workloads[t]);
+    elapsed[t] = std::chrono::duration<double, std::nano>(clock::now() - start)
+                     .count();
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < threadCount; t++) threads.emplace_back(worker, t);
+  while (ready.load() + 1 < threadCount) std::this_thread::yield();
+  go.store(true, std::memory_order_release);
+  worker(0);
+  for (std::thread& thread : threads) thread.join();
+  return *std::max_element(elapsed.begin(), elapsed.end());
+}
+
+// 多次试验的汇总
+struct Summary {
+  double median;
+  double mean;
+  double stddev;
+  double ciLow;  // 中位数的95%置信区间
+  double ciHigh;
+  double min;
+  double max;
+};
+
+Summary summarize(std::vector<double> samples) {
+  std::sort(samples.begin(), samples.end());
+  size_t n = samples.size();
+  Summary s = {};
+  s.min = samples.front();
+  s.max = samples.back();
+  s.median = n % 2 ? samples[n / 2]
+                   : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+  for (double x : samples) s.mean += x;
+  s.mean /= n;
+  for (double x : samples) s.stddev += (x - s.mean) * (x - s.mean);
+  s.stddev = n > 1 ? std::sqrt(s.stddev / (n - 1)) : 0;
+  // 不假设分布的中位数置信区间: 按二项分布的正态近似取第j与第k个次序统计量
+  double half = 0.98 * std::sqrt(static_cast<double>(n));
+  long j = static_cast<long>(std::floor(n / 2.0 - half));
+  long k = static_cast<long>(std::ceil(1 + n / 2.0 + half));
+  j = std::max(j, 1L);
+  k = std::min(k, static_cast<long>(n));
+  s.ciLow = samples[j - 1];
+  s.ciHigh = samples[k - 1];
+  return s;
+}
+
+struct Result {
+  std::string name;  // 大小分布/模式/线程数
+  const char* allocator;
+  const char* sizes;
+  const char* pattern;
+  size_t threads;
+  Summary nsPerOp;  // 每对分配释放的纳秒数
+  double mopsPerSec;  // 按中位数计算的全部线程的吞吐
+};
+
+Result runBenchmark(const Options& options, const Allocator& alloc,
+                    const SizeDistribution& dist, Pattern pattern,
+                    size_t threadCount) {
+  std::vector<Workload> workloads;
+  for (size_t t = 0; t < threadCount; t++) {
+    workloads.push_back(makeWorkload(dist, pattern, options.ops, t + 1));
+  }
+  // 第一次试验只用于预热 不计入结果
+  runTrial(alloc, pattern, workloads);
+  std::vector<double> samples;
+  for (size_t i = 0; i < options.trials; i++) {
+    samples.push_back(runTrial(alloc, pattern, workloads) / options.ops);
+  }
+
+  Result result;
+  result.name = std::string(dist.name) + "/" + PATTERN_NAMES[pattern] + "/t" +
+                std::to_string(threadCount);
+  result.allocator = alloc.name;
+  result.sizes = dist.name;
+  result.pattern = PATTERN_NAMES[pattern];
+  result.threads = threadCount;
+  result.nsPerOp = summarize(samples);
+  result.mopsPerSec = 1e3 * threadCount / result.nsPerOp.median;
+  return result;
+}
+
+// 一条消息 消费者按size释放
+struct Message {
+  void* ptr;
+  size_t size;
+};
+
+// 单生产者单消费者的有界环形队列
+class SpscQueue {
+ public:
+  static constexpr size_t CAPACITY = 1024;
+
+  bool push(const Message& message) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == CAPACITY) return false;
+    slots_[tail % CAPACITY] = message;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+  bool pop(Message* message) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) return false;
+    *message = slots_[head % CAPACITY];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+ private:
+  alignas(64) std::atomic<size_t> head_{0};
+  alignas(64) std::atomic<size_t> tail_{0};
+  Message slots_[CAPACITY];
+};
+
+// 每隔这么多次操作计一次单次耗时 避免计时本身拖慢吞吐
+constexpr size_t LATENCY_SAMPLE_INTERVAL = 16;
+// RSS与缓存字节数的采样间隔
+constexpr auto MEMORY_SAMPLE_INTERVAL = std::chrono::milliseconds(10);
+
+// 某一时刻的内存占用 RSS相对这组参数开始运行之前
+struct MemorySample {
+  double ms;
+  long rssBytes;
+  size_t threadCacheBytes;
+  size_t centralCacheBytes;
+};
+
+long residentBytes() {
+  FILE* in = fopen("/proc/self/statm", "r");
+  if (!in) return 0;
+  long size = 0, resident = 0;
+  if (fscanf(in, "%ld %ld", &size, &resident) != 2) resident = 0;
+  fclose(in);
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+// 单次分配或释放耗时的分位数 单位纳秒
+struct Percentiles {
+  double p50;
+  double p99;
+  double p999;
+};
+
+Percentiles percentiles(std::vector<double>& samples) {
+  if (samples.empty()) return {};
+  std::sort(samples.begin(), samples.end());
+  auto at = [&samples](double q) {
+    return samples[std::min(samples.size() - 1,
+                            static_cast<size_t>(q * samples.size()))];
+  };
+  return {at(0.5), at(0.99), at(0.999)};
+}
+
+struct PipelineResult {
+  Result result;  // nsPerOp为每条消息的纳秒数, 可与基线比较
+  size_t producers;
+  size_t consumers;
+  Percentiles allocNs;
+  Percentiles freeNs;
+  // 以下来自最后一次试验
+  long peakRssBytes;
+  size_t peakCentralCacheBytes;
+  std::vector<MemorySample> memory;
+};
+
+struct PipelineTrial {
+  double elapsedNs;
+  std::vector<double> allocNs;
+  std::vector<double> freeNs;
+  std::vector<MemorySample> memory;
+};
+
+// 生产者p的第i条消息交给消费者(i + p) % consumers
+PipelineTrial runPipelineTrial(const Allocator& alloc, PipelineShape shape,
+                               const std::vector<Workload>& workloads,
+                               long baseRss) {
+  using clock = std::chrono::steady_clock;
+  size_t producers = shape.producers;
+  size_t consumers = shape.consumers;
+  std::vector<std::unique_ptr<SpscQueue>> queues;
+  for (size_t i = 0; i < producers * consumers; i++) {
+    queues.emplace_back(new SpscQueue);
+  }
+  std::vector<std::vector<double>> allocNs(producers);
+  std::vector<std::vector<double>> freeNs(consumers);
+  std::atomic<size_t> ready{0};
+  std::atomic<size_t> producersDone{0};
+  std::atomic<bool> go{false};
+  std::atomic<bool> stop{false};
+
+  auto producer = [&](size_t p) {
+    const std::vector<size_t>& sizes = workloads[p].sizes;
+    std::vector<double>& latency = allocNs[p];
+    latency.reserve(sizes.size() / LATENCY_SAMPLE_INTERVAL + 1);
+    ready.fetch_add(1);
+    while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+    for (size_t i = 0; i < sizes.size(); i++) {
+      Message message{nullptr, sizes[i]};
+      if (i % LATENCY_SAMPLE_INTERVAL == 0) {
+        auto start = clock::now();
+        message.ptr = alloc.allocate(message.size);
+        latency.push_back(
+            std::chrono::duration<double, std::nano>(clock::now() - start)
+                .count());
+      } else {
+        message.ptr = alloc.allocate(message.size);
+      }
+      touch(message.ptr);
+      SpscQueue& queue = *queues[p * consumers + (i + p) % consumers];
+      while (!queue.push(message)) std::this_thread::yield();
+    }
+    producersDone.fetch_add(1, std::memory_order_release);
+  };
+
+  auto consumer = [&](size_t c) {
+    std::vector<double>& latency = freeNs[c];
+    size_t freed = 0;
+    ready.fetch_add(1);
+    while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+    for (;;) {
+      // 先读完成数再清空队列 清空后仍无消息才说明全部处理完
+      bool finished =
+          producersDone.load(std::memory_order_acquire) == producers;
+      size_t popped = 0;
+      Message message;
+      for (size_t p = 0; p < producers; p++) {
+        SpscQueue& queue = *queues[p * consumers + c];
+        while (queue.pop(&message)) {
+          if (freed++ % LATENCY_SAMPLE_INTERVAL == 0) {
+            auto start = clock::now();
+            alloc.deallocate(message.ptr, message.size);
+            latency.push_back(
+                std::chrono::duration<double, std::nano>(clock::now() - start)
+                    .count());
+          } else {
+            alloc.deallocate(message.ptr, message.size);
+          }
+          popped++;
+        }
+      }
+      if (popped == 0) {
+        if (finished) break;
+        std::this_thread::yield();
+      }
+    }
+  };
+
+  PipelineTrial trial;
+  auto sampleMemory = [&](clock::time_point start) {
+    MemorySample sample = {};
+    sample.ms =
+        std::chrono::duration<double, std::milli>(clock::now() - start)
+            .count();
+    sample.rssBytes = residentBytes() - baseRss;
+    if (alloc.cacheBytes) {
+      alloc.cacheBytes(&sample.threadCacheBytes, &sample.centralCacheBytes);
+    }
+    trial.memory.push_back(sample);
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t p = 0; p < producers; p++) threads.emplace_back(producer, p);
+  for (size_t c = 0; c < consumers; c++) threads.emplace_back(consumer, c);
+  while (ready.load() < producers + consumers) std::this_thread::yield();
+  auto start = clock::now();
+  std::thread sampler([&] {
+    while (!stop.load(std::memory_order_relaxed)) {
+      sampleMemory(start);
+      std::this_thread::sleep_for(MEMORY_SAMPLE_INTERVAL);
+    }
+  });
+  go.store(true, std::memory_order_release);
+  for (std::thread& thread : threads) thread.join();
+  trial.elapsedNs =
+      std::chrono::duration<double, std::nano>(clock::now() - start).count();
+  stop.store(true);
+  sampler.join();
+  // 全部线程退出后再采一次 线程缓存已归还, 可看出留在中心缓存的内存
+  sampleMemory(start);
+
+  for (std::vector<double>& latency : allocNs) {
+    trial.allocNs.insert(trial.allocNs.end(), latency.begin(), latency.end());
+  }
+  for (std::vector<double>& latency : freeNs) {
+    trial.freeNs.insert(trial.freeNs.end(), latency.begin(), latency.end());
+  }
+  return trial;
+}
+
+std::string pipelineName(const SizeDistribution& dist, PipelineShape shape) {
+  return "pipeline/p" + std::to_string(shape.producers) + "c" +
+         std::to_string(shape.consumers) + "/" + dist.name;
+}
+
+PipelineResult runPipelineBenchmark(const Options& options,
+                                    const Allocator& alloc,
+                                    const SizeDistribution& dist,
+                                    PipelineShape shape) {
+  std::vector<Workload> workloads;
+  for (size_t p = 0; p < shape.producers; p++) {
+    workloads.push_back(makeWorkload(dist, PATTERN_FIFO, options.ops, p + 1));
+  }
+  size_t messages = shape.producers * options.ops;
+  long baseRss = residentBytes();
+  runPipelineTrial(alloc, shape, workloads, baseRss);
+  std::vector<double> samples;
+  std::vector<double> allocNs, freeNs;
+  PipelineTrial trial;
+  for (size_t i = 0; i < options.trials; i++) {
+    trial = runPipelineTrial(alloc, shape, workloads, baseRss);
+    samples.push_back(trial.elapsedNs / messages);
+    allocNs.insert(allocNs.end(), trial.allocNs.begin(), trial.allocNs.end());
+    freeNs.insert(freeNs.end(), trial.freeNs.begin(), trial.freeNs.end());
+  }
+
+  PipelineResult pipeline = {};
+  Result& result = pipeline.result;
+  result.name = pipelineName(dist, shape);
+  result.allocator = alloc.name;
+  result.sizes = dist.name;
+  result.pattern = "pipeline";
+  result.threads = shape.producers + shape.consumers;
+  result.nsPerOp = summarize(samples);
+  result.mopsPerSec = 1e3 / result.nsPerOp.median;
+  pipeline.producers = shape.producers;
+  pipeline.consumers = shape.consumers;
+  pipeline.allocNs = percentiles(allocNs);
+  pipeline.freeNs = percentiles(freeNs);
+  pipeline.memory = trial.memory;
+  for (const MemorySample& sample : trial.memory) {
+    pipeline.peakRssBytes = std::max(pipeline.peakRssBytes, sample.rssBytes);
+    pipeline.peakCentralCacheBytes =
+        std::max(pipeline.peakCentralCacheBytes, sample.centralCacheBytes);
+  }
+  return pipeline;
+}
+
+void writeSummary(FILE* out, const Result& r) {
+  const Summary& s = r.nsPerOp;
+  fprintf(out,
+          "{\"name\":\"%s\",\"allocator\":\"%s\",\"sizes\":\"%s\","
+          "\"pattern\":\"%s\",\"threads\":%zu,\"mops_per_sec\":%.3f,"
+          "\"ns_per_op\":{\"median\":%.3f,\"mean\":%.3f,\"stddev\":%.3f,"
+          "\"ci_low\":%.3f,\"ci_high\":%.3f,\"min\":%.3f,\"max\":%.3f}",
+          r.name.c_str(), r.allocator, r.sizes, r.pattern, r.threads,
+          r.mopsPerSec, s.median, s.mean, s.stddev, s.ciLow, s.ciHigh, s.min,
+          s.max);
+}
+
+void writePercentiles(FILE* out, const char* key, const Percentiles& p) {
+  fprintf(out, ",\"%s\":{\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f}", key,
+          p.p50, p.p99, p.p999);
+}
+
+void writeJson(FILE* out, const Options& options,
+               const std::vector<Result>& results,
+               const std::vector<PipelineResult>& pipelines) {
+  fprintf(out,
+          "{\"trials\":%zu,\"ops\":%zu,\"hardware_threads\":%u,"
+          "\"results\":[",
+          options.trials, options.ops, std::thread::hardware_concurrency());
+  for (size_t i = 0; i < results.size(); i++) {
+    fprintf(out, "%s\n", i ? "," : "");
+    writeSummary(out, results[i]);
+    fprintf(out, "}");
+  }
+  // 流水线的ns_per_op为每条消息的纳秒数 memory为最后一次试验的采样
+  fprintf(out, "\n],\"pipeline\":[");
+  for (size_t i = 0; i < pipelines.size(); i++) {
+    const PipelineResult& p = pipelines[i];
+    fprintf(out, "%s\n", i ? "," : "");
+    writeSummary(out, p.result);
+    fprintf(out, ",\"producers\":%zu,\"consumers\":%zu", p.producers,
+            p.consumers);
+    writePercentiles(out, "alloc_ns", p.allocNs);
+    writePercentiles(out, "free_ns", p.freeNs);
+    fprintf(out,
+            ",\"peak_rss_bytes\":%ld,\"peak_central_cache_bytes\":%zu,"
+            "\"memory\":[",
+            p.peakRssBytes, p.peakCentralCacheBytes);
+    for (size_t j = 0; j < p.memory.size(); j++) {
+      const MemorySample& m = p.memory[j];
+      fprintf(out,
+              "%s{\"ms\":%.1f,\"rss_bytes\":%ld,"
+              "\"thread_cache_bytes\":%zu,\"central_cache_bytes\":%zu}",
+              j ? "," : "", m.ms, m.rssBytes, m.threadCacheBytes,
+              m.centralCacheBytes);
+    }
+    fprintf(out, "]}");
+  }
+  fprintf(out, "\n]}\n");
+}
+
+// 基线中的一项 只读取比较需要的字段
+struct BaselineEntry {
+  double median;
+  double ciHigh;
+};
+
+// 从字符串中读出"key":后面的值 找不到时返回false
+bool findField(const std::string& text, size_t from, size_t to,
+               const char* key, std::string* value) {
+  std::string pattern = std::string("\"") + key + "\":";
+  size_t pos = text.find(pattern, from);
+  if (pos == std::string::npos || pos >= to) return false;
+  pos += pattern.size();
+  if (text[pos] == '"') {
+    size_t end = text.find('"', pos + 1);
+    *value = text.substr(pos + 1, end - pos - 1);
+  } else {
+    size_t end = text.find_first_of(",}", pos);
+    *value = text.substr(pos, end - pos);
+  }
+  return true;
+}
+
+// 读取writeJson写出的文件 键为"分配器 名称"
+bool loadBaseline(const std::string& path,
+                  std::map<std::string, BaselineEntry>* entries) {
+  FILE* in = fopen(path.c_str(), "r");
+  if (!in) return false;
+  std::string text;
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0) text.append(buf, n);
+  fclose(in);
+
+  // 每个结果以{"name":开头 到下一个结果之前为止
+  const char* marker = "{\"name\":";
+  for (size_t pos = text.find(marker); pos != std::string::npos;) {
+    size_t next = text.find(marker, pos + 1);
+    size_t end = next == std::string::npos ? text.size() : next;
+    std::string name, allocator, median, ciHigh;
+    if (findField(text, pos, end, "name", &name) &&
+        findField(text, pos, end, "allocator", &allocator) &&
+        findField(text, pos, end, "median", &median) &&
+        findField(text, pos, end, "ci_high", &ciHigh)) {
+      (*entries)[allocator + " " + name] = {atof(median.c_str()),
+                                            atof(ciHigh.c_str())};
+    }
+    pos = next;
+  }
+  return true;
+}
+
+// 中位数超过基线的(1 + tolerance)倍, 且置信区间与基线不重叠时算作退化
+size_t compareBaseline(const std::vector<Result>& results,
+                       const std::map<std::string, BaselineEntry>& baseline,
+                       double tolerance) {
+  size_t regressions = 0;
+  for (const Result& r : results) {
+    auto it = baseline.find(std::string(r.allocator) + " " + r.name);
+    if (it == baseline.end()) continue;
+    const BaselineEntry& base = it->second;
+    if (r.nsPerOp.median > base.median * (1 + tolerance) &&
+        r.nsPerOp.ciLow > base.ciHigh) {
+      printf("REGRESSION %-8s %-28s %9.2f -> %9.2f ns/op (%+.1f%%)\n",
+             r.allocator, r.name.c_str(), base.median, r.nsPerOp.median,
+             100.0 * (r.nsPerOp.median / base.median - 1));
+      regressions++;
+    }
+  }
+  return regressions;
+}
+
+std::vector<size_t> parseList(const char* arg) {
+  std::vector<size_t> values;
+  for (const char* p = arg; *p;) {
+    char* end;
+    size_t value = strtoul(p, &end, 10);
+    if (end == p) break;
+    if (value) values.push_back(value);
+    p = *end == ',' ? end + 1 : end;
+  }
+  return values;
+}
+
+// 形如1x1,2x4 生产者数x消费者数
+bool parsePipelines(const char* arg, std::vector<PipelineShape>* shapes) {
+  shapes->clear();
+  for (const char* p = arg; *p;) {
+    char* end;
+    PipelineShape shape;
+    shape.producers = strtoul(p, &end, 10);
+    if (*end != 'x') return false;
+    shape.consumers = strtoul(end + 1, &end, 10);
+    if (!shape.producers || !shape.consumers) return false;
+    if (*end != ',' && *end != '\0') return false;
+    shapes->push_back(shape);
+    p = *end == ',' ? end + 1 : end;
+  }
+  return !shapes->empty();
+}
+
+bool parseOptions(int argc, char** argv, Options* options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) return false;
+    const char* value = argv[++i];
+    if (arg == "--suite") {
+      options->suite = value;
+    } else if (arg == "--trials") {
+      options->trials = strtoul(value, nullptr, 10);
+    } else if (arg == "--ops") {
+      options->ops = strtoul(value, nullptr, 10);
+    } else if (arg == "--threads") {
+      options->threads = parseList(value);
+    } else if (arg == "--pipelines") {
+      if (!parsePipelines(value, &options->pipelines)) return false;
+    } else if (arg == "--filter") {
+      options->filter = value;
+    } else if (arg == "--json") {
+      options->jsonPath = value;
+    } else if (arg == "--baseline") {
+      options->baselinePath = value;
+    } else if (arg == "--tolerance") {
+      options->tolerance = atof(value);
+    } else {
+      return false;
+    }
+  }
+  return options->trials > 0 && options->ops > 0 &&
+         !options->threads.empty() &&
+         (options->suite == "all" || options->suite == "patterns" ||
+          options->suite == "pipeline");
+}
+
+bool selected(const Options& options, const std::string& name,
+              const Allocator& alloc) {
+  return options.filter.empty() ||
+         (name + "/" + alloc.name).find(options.filter) != std::string::npos;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!parseOptions(argc, argv, &options)) {
+    fprintf(stderr,
+            "usage: %s [--suite all|patterns|pipeline] [--trials N] "
+            "[--ops N] [--threads 1,4] [--pipelines 1x1,2x2] "
+            "[--filter substr] [--json out.json] [--baseline base.json] "
+            "[--tolerance 0.05]\n",
+            argv[0]);
+    return 2;
+  }
+  memoryPool::HashBucket::initMemoryPool();
+
+  std::vector<Result> results;
+  std::vector<PipelineResult> pipelines;
+  bool runPatterns = options.suite != "pipeline";
+  bool runPipelines = options.suite != "patterns";
+  if (runPatterns) {
+    printf("%-28s %-8s %10s %21s %9s %9s\n", "benchmark", "alloc", "median",
+           "95% CI", "stddev", "Mops/s");
+  }
+  for (const SizeDistribution& dist : SIZE_DISTRIBUTIONS) {
+    for (int p = 0; runPatterns && p < PATTERN_COUNT; p++) {
+      for (size_t threadCount : options.threads) {
+        for (const Allocator& alloc : ALLOCATORS) {
+          std::string name = std::string(dist.name) + "/" + PATTERN_NAMES[p] +
+                             "/t" + std::to_string(threadCount);
+          if (!selected(options, name, alloc)) continue;
+          Result r = runBenchmark(options, alloc, dist,
+                                  static_cast<Pattern>(p), threadCount);
+          printf("%-28s %-8s %10.2f [%9.2f,%9.2f] %9.2f %9.2f\n",
+                 r.name.c_str(), r.allocator, r.nsPerOp.median,
+                 r.nsPerOp.ciLow, r.nsPerOp.ciHigh, r.nsPerOp.stddev,
+                 r.mopsPerSec);
+          fflush(stdout);
+          results.push_back(r);
+        }
+      }
+    }
+  }
+
+  // 流水线: 中位数为每条消息的纳秒数, 延迟为单次分配/释放的分位数
+  if (runPipelines) {
+    printf("\n%-30s %-8s %8s %19s %8s %15s %15s %9s %9s\n", "pipeline",
+           "alloc", "ns/msg", "95% CI", "Mmsg/s", "alloc p50/p99",
+           "free p50/p99", "rss MB", "central MB");
+  }
+  for (const SizeDistribution& dist : SIZE_DISTRIBUTIONS) {
+    for (size_t s = 0; runPipelines && s < options.pipelines.size(); s++) {
+      for (const Allocator& alloc : ALLOCATORS) {
+        PipelineShape shape = options.pipelines[s];
+        if (!selected(options, pipelineName(dist, shape), alloc)) continue;
+        PipelineResult p = runPipelineBenchmark(options, alloc, dist, shape);
+        const Result& r = p.result;
+        printf("%-30s %-8s %8.2f [%8.2f,%8.2f] %8.2f %7.0f/%-7.0f "
+               "%7.0f/%-7.0f %9.1f %9.1f\n",
+               r.name.c_str(), r.allocator, r.nsPerOp.median,
+               r.nsPerOp.ciLow, r.nsPerOp.ciHigh, r.mopsPerSec,
+               p.allocNs.p50, p.allocNs.p99, p.freeNs.p50, p.freeNs.p99,
+               p.peakRssBytes / 1048576.0,
+               p.peakCentralCacheBytes / 1048576.0);
+        fflush(stdout);
+        pipelines.push_back(std::move(p));
+      }
+    }
+  }
+
+  if (!options.jsonPath.empty()) {
+    FILE* out = fopen(options.jsonPath.c_str(), "w");
+    if (!out) {
+      perror(options.jsonPath.c_str());
+      return 2;
+    }
+    writeJson(out, options, results, pipelines);
+    fclose(out);
+  }
+
+  if (!options.baselinePath.empty()) {
+    std::map<std::string, BaselineEntry> baseline;
+    if (!loadBaseline(options.baselinePath, &baseline)) {
+      perror(options.baselinePath.c_str());
+      return 2;
+    }
+    for (const PipelineResult& p : pipelines) results.push_back(p.result);
+    size_t regressions = compareBaseline(results, baseline, options.tolerance);
+    printf("%zu regression(s) against %s\n", regressions,
+           options.baselinePath.c_str());
+    if (regressions) return 1;
+  }
+  return 0;
+}
@@ -1,12 +1,29 @@
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cerrno>
 #include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <list>
+#include <map>
+#include <memory_resource>
 #include <random>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include "LockProfiler.h"
 #include "MemoryPool.h"
+#include "PoolAllocator.h"
 
 using namespace memory_pool;
 
@@ -25,6 +42,106 @@ class Timer {
            1000.0;  // 转为毫秒
   }
 };
+// 某级缓存读缺失的PERF_TYPE_HW_CACHE配置
+constexpr uint64_t cacheMiss(uint64_t cache) {
+  return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+// 通过perf_event_open统计的硬件与软件事件 计入之后创建的所有线程
+// 内核不支持或权限不足时对应事件不可用, 输出中留空
+class PerfCounters {
+ public:
+  struct Event {
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+  };
+  static constexpr size_t NUM_EVENTS = 7;
+  static constexpr Event EVENTS[NUM_EVENTS] = {
+      {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+      {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+      {"l1d_misses", PERF_TYPE_HW_CACHE, cacheMiss(PERF_COUNT_HW_CACHE_L1D)},
+      {"llc_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+      {"dtlb_misses", PERF_TYPE_HW_CACHE, cacheMiss(PERF_COUNT_HW_CACHE_DTLB)},
+      {"page_faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+      {"context_switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+  };
+
+  PerfCounters() {
+    for (size_t i = 0; i < NUM_EVENTS; i++) {
+      fds_[i] = open(EVENTS[i]);
+      errors_[i] = fds_[i] < 0 ? errno : 0;
+    }
+  }
+  ~PerfCounters() {
+    for (int fd : fds_) {
+      if (fd >= 0) close(fd);
+    }
+  }
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  bool available(size_t i) const { return fds_[i] >= 0; }
+  // 打开失败时的errno
+  int error(size_t i) const { return errors_[i]; }
+  void start() {
+    for (int fd : fds_) {
+      if (fd < 0) continue;
+      ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+  // 停止计数并读出 计数器被复用时按实际运行时间比例放大
+  void stop(std::array<double, NUM_EVENTS>* values) {
+    for (size_t i = 0; i < NUM_EVENTS; i++) {
+      (*values)[i] = 0;
+      if (fds_[i] < 0) continue;
+      ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+      uint64_t data[3];  // 计数值, 启用时间, 实际运行时间
+      if (read(fds_[i], data, sizeof(data)) != sizeof(data)) continue;
+      (*values)[i] = data[2] ? static_cast<double>(data[0]) * data[1] / data[2]
+                             : 0;
+    }
+  }
+
+ private:
+  static int open(const Event& event) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = event.type;
+    attr.config = event.config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_hv = 1;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    int fd =
+        syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (fd < 0) {
+      // perf_event_paranoid为2时只允许统计用户态
+      attr.exclude_kernel = 1;
+      fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+                   PERF_FLAG_FD_CLOEXEC);
+    }
+    return fd;
+  }
+
+  int fds_[NUM_EVENTS];
+  int errors_[NUM_EVENTS];
+};
+
+// 读取当前进程的驻留内存 单位KB
+long residentKb() {
+  FILE* in = fopen("/proc/self/statm", "r");
+  if (!in) return 0;
+  long size = 0, resident = 0;
+  if (fscanf(in, "%ld %ld", &size, &resident) != 2) resident = 0;
+  fclose(in);
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
 class PerformanceTest {
  private:
   struct TestStats {
@@ -52,75 +169,197 @@ class PerformanceTest {
     std::cout << "Warmup completed" << std::endl;
   }
 
-  // 小对象分配测试
+  // 以下工作负载供单项测试与扩展性测试共用 每次调用在当前线程内完成
+  static constexpr size_t SMALL_NUM_ALLOCS = 50000;
+  static constexpr size_t ALLOCS_PER_THREAD = 25000;
+  static constexpr size_t MIXED_NUM_ALLOCS = 100000;
 
-  static void testSmallAllocation() {
-    constexpr size_t NUM_ALLOCS = 50000;
+  // 线程私有的随机数 rand()内部加锁, 多线程下会掩盖分配器本身的扩展性
+  static std::mt19937& rng() {
+    thread_local std::mt19937 gen(std::random_device{}());
+    return gen;
+  }
+  static size_t randomIndex(size_t n) { return rng()() % n; }
+
+  static void* allocate(bool useMemPool, size_t size) {
+    return useMemPool ? MemoryPool::allocate(size) : operator new(size);
+  }
+  static void deallocate(bool useMemPool, void* ptr, size_t size) {
+    if (useMemPool) {
+      MemoryPool::deallocate(ptr, size);
+    } else {
+      operator delete(ptr);
+    }
+  }
+
+  // 固定的小块大小轮流分配 每4次随机释放一块
+  static void smallAllocationWorkload(bool useMemPool) {
     const size_t SIZES[] = {8, 16, 32, 64, 128, 256};
     const size_t NUM_SIZES = sizeof(SIZES) / sizeof(SIZES[0]);
-    std::cout << "\nTesting small allocations (" << NUM_ALLOCS
-              << " allocations of fixed sizes):" << std::endl;
-
-    // 测试内存池
-    {
-      Timer T;
-      std::array<std::vector<std::pair<void*, size_t>>, NUM_SIZES> sizePtrs;
-      for (auto& ptrs : sizePtrs) {
-        ptrs.reserve(NUM_ALLOCS / NUM_SIZES);
+    std::array<std::vector<std::pair<void*, size_t>>, NUM_SIZES> sizePtrs;
+    for (auto& ptrs : sizePtrs) {
+      ptrs.reserve(SMALL_NUM_ALLOCS / NUM_SIZES);
+    }
+    for (size_t i = 0; i < SMALL_NUM_ALLOCS; i++) {
+      size_t sizeIndex = i % NUM_SIZES;
+      size_t size = SIZES[sizeIndex];
+      void* ptr = allocate(useMemPool, size);
+      sizePtrs[sizeIndex].push_back({ptr, size});
+
+      // 部分立即释放
+      if (i % 4 == 0) {
+        size_t releaseIndex = randomIndex(NUM_SIZES);
+        auto& ptrs = sizePtrs[releaseIndex];
+        if (!ptrs.empty()) {
+          deallocate(useMemPool, ptrs.back().first, ptrs.back().second);
+          ptrs.pop_back();
+        }
+      }
+    }
+    for (auto& ptrs : sizePtrs) {
+      for (auto& ptr : ptrs) {
+        deallocate(useMemPool, ptr.first, ptr.second);
       }
-      for (size_t i = 0; i < NUM_ALLOCS; i++) {
-        size_t sizeIndex = i % NUM_SIZES;
-        size_t size = SIZES[sizeIndex];
-        void* ptr = MemoryPool::allocate(size);
-        sizePtrs[sizeIndex].push_back({ptr, size});
-
-        // 部分立即释放
-        if (i % 4 == 0) {
-          size_t releaseIndex = rand() % NUM_SIZES;
-          auto& ptrs = sizePtrs[releaseIndex];
-          if (!ptrs.empty()) {
-            MemoryPool::deallocate(ptrs.back().first, ptrs.back().second);
+    }
+  }
+
+  // 多线程测试中每个线程的负载
+  static void mutiThreadWorkload(bool useMemPool) {
+    const size_t SIZES[] = {8, 16, 32, 64, 128, 256};
+    const size_t NUM_SIZES = sizeof(SIZES) / sizeof(SIZES[0]);
+
+    std::mt19937& gen = rng();
+    std::uniform_int_distribution<size_t> dist_size_index(0, NUM_SIZES - 1);
+    std::uniform_int_distribution<size_t> dist_percent(20, 30);
+
+    std::array<std::vector<std::pair<void*, size_t>>, NUM_SIZES> sizePtrs;
+    for (auto& ptrs : sizePtrs) {
+      ptrs.reserve(ALLOCS_PER_THREAD / NUM_SIZES);
+    }
+
+    for (size_t i = 0; i < ALLOCS_PER_THREAD; i++) {
+      size_t sizeIndex = i % NUM_SIZES;
+      size_t size = SIZES[sizeIndex];
+
+      void* ptr = allocate(useMemPool, size);
+      sizePtrs[sizeIndex].push_back({ptr, size});
+
+      // 测试内存复用 每100次循环释放一部分内存
+      if (i % 100 == 0) {
+        size_t releasIndex = dist_size_index(gen);
+        auto& ptrs = sizePtrs[releasIndex];
+        if (!ptrs.empty()) {
+          size_t releaseCount = ptrs.size() * dist_percent(gen) / 100;
+          releaseCount = std::min(releaseCount, ptrs.size());
+
+          for (size_t j = 0; j < releaseCount; j++) {
+            size_t index = randomIndex(ptrs.size());
+            deallocate(useMemPool, ptrs[index].first, ptrs[index].second);
+            ptrs[index] = ptrs.back();
             ptrs.pop_back();
           }
         }
       }
-      for (auto& ptrs : sizePtrs) {
-        for (auto& ptr : ptrs) {
-          MemoryPool::deallocate(ptr.first, ptr.second);
+      // 测试CentralCache的线程竞争
+      if (i % 1000 == 0) {
+        std::vector<std::pair<void*, size_t>> pressurePtrs;
+        for (size_t j = 0; j < 50; j++) {
+          size_t size = SIZES[randomIndex(NUM_SIZES)];
+          pressurePtrs.push_back({allocate(useMemPool, size), size});
+        }
+
+        // 立即释放这些内存
+        for (const auto& [ptr, size] : pressurePtrs) {
+          deallocate(useMemPool, ptr, size);
         }
       }
-      std::cout << "Memory Pool: " << std::fixed << std::setprecision(3)
-                << T.elapsed() << " ms" << std::endl;
     }
+    // 清理所有内存
+    for (auto& ptrs : sizePtrs) {
+      for (auto& [ptr, size] : ptrs) {
+        deallocate(useMemPool, ptr, size);
+      }
+    }
+  }
 
-    // 测试new 和 delete
-    {
-      Timer T;
-      std::array<std::vector<std::pair<void*, size_t>>, NUM_SIZES> sizePtrs;
-      for (auto& ptrs : sizePtrs) {
-        ptrs.reserve(NUM_ALLOCS / NUM_SIZES);
+  // 60%小块、30%中块、10%大块 每50次随机释放一组中的一部分
+  static void mixedSizesWorkload(bool useMemPool) {
+    const size_t SMALL_SIZES[] = {8, 16, 32, 64, 128};
+    const size_t MEDIUM_SIZES[] = {256, 384, 512};
+    const size_t LARGE_SIZES[] = {1024, 2048, 4096};
+
+    const size_t NUM_SMALL = sizeof(SMALL_SIZES) / sizeof(SMALL_SIZES[0]);
+    const size_t NUM_MEDIUM = sizeof(MEDIUM_SIZES) / sizeof(MEDIUM_SIZES[0]);
+    const size_t NUM_LARGE = sizeof(LARGE_SIZES) / sizeof(LARGE_SIZES[0]);
+    const size_t NUM_PTRS = NUM_SMALL + NUM_MEDIUM + NUM_LARGE;
+
+    std::array<std::vector<std::pair<void*, size_t>>, NUM_PTRS> sizePtrs;
+    for (auto& ptrs : sizePtrs) {
+      ptrs.reserve(MIXED_NUM_ALLOCS / NUM_PTRS);
+    }
+    for (size_t i = 0; i < MIXED_NUM_ALLOCS; i++) {
+      size_t size;
+      size_t category = i % 100;
+      if (category < 60) {
+        size_t index = (i / 60) % NUM_SMALL;
+        size = SMALL_SIZES[index];
+      } else if (category < 90) {
+        size_t index = (i / 30) % NUM_MEDIUM;
+        size = MEDIUM_SIZES[index];
+      } else {
+        size_t index = (i / 10) % NUM_LARGE;
+        size = LARGE_SIZES[index];
       }
-      for (size_t i = 0; i < NUM_ALLOCS; i++) {
-        size_t sizeIndex = i % NUM_SIZES;
-        size_t size = SIZES[sizeIndex];
-        void* ptr = operator new(size);
-        sizePtrs[sizeIndex].push_back({ptr, size});
-        if (i % 4 == 0) {
-          size_t releaseIndex = rand() % NUM_SIZES;
-          auto& ptrs = sizePtrs[releaseIndex];
-
-          if (!ptrs.empty()) {
-            operator delete(ptrs.back().first);
+
+      void* ptr = allocate(useMemPool, size);
+      size_t prtIndex = (category < 60) ? (i / 60) % NUM_SMALL
+                        : (category < 90)
+                            ? NUM_SMALL + (i / 30) % NUM_MEDIUM
+                            : NUM_SMALL + NUM_MEDIUM + (i / 10) % NUM_LARGE;
+      sizePtrs[prtIndex].push_back({ptr, size});
+
+      if (i % 50 == 0) {
+        size_t releaseIndex = randomIndex(sizePtrs.size());
+        auto& ptrs = sizePtrs[releaseIndex];
+
+        if (!ptrs.empty()) {
+          size_t realeaseCount =
+              ptrs.size() * (20 + randomIndex(11)) / 100;
+          realeaseCount = std::min(realeaseCount, ptrs.size());
+          for (size_t j = 0; j < realeaseCount; j++) {
+            size_t index = randomIndex(ptrs.size());
+            auto& ptr = ptrs[index];
+            deallocate(useMemPool, ptr.first, ptr.second);
+            ptrs[index] = ptrs.back();
             ptrs.pop_back();
           }
         }
       }
-      // 清除剩余内存
-      for (auto& ptrs : sizePtrs) {
-        for (auto& ptr : ptrs) {
-          operator delete(ptr.first);
-        }
+    }
+    for (auto& ptrs : sizePtrs) {
+      for (auto& ptr : ptrs) {
+        deallocate(useMemPool, ptr.first, ptr.second);
       }
+    }
+  }
+
+  // 小对象分配测试
+  static void testSmallAllocation() {
+    std::cout << "\nTesting small allocations (" << SMALL_NUM_ALLOCS
+              << " allocations of fixed sizes):" << std::endl;
+
+    // 测试内存池
+    {
+      Timer T;
+      smallAllocationWorkload(true);
+      std::cout << "Memory Pool: " << std::fixed << std::setprecision(3)
+                << T.elapsed() << " ms" << std::endl;
+    }
+
+    // 测试new 和 delete
+    {
+      Timer T;
+      smallAllocationWorkload(false);
       std::cout << "New/Delete: " << std::fixed << std::setprecision(3)
                 << T.elapsed() << " ms" << std::endl;
     }
@@ -129,92 +368,17 @@ class PerformanceTest {
   // 多线程测试
   static void testMutiThread() {
     constexpr size_t NUM_THREADS = 4;
-    constexpr size_t ALLOCS_PER_THREAD = 25000;
 
     std::cout << "\nTesting multi-threaded allocations (" << NUM_THREADS
               << " threads, " << ALLOCS_PER_THREAD
               << " allocations each):" << std::endl;
 
-    auto ThreadFunc = [&](bool useMemPool) {
-      const size_t SIZES[] = {8, 16, 32, 64, 128, 256};
-      const size_t NUM_SIZES = sizeof(SIZES) / sizeof(SIZES[0]);
-
-      thread_local std::random_device rd;
-      thread_local std::mt19937 gen(rd());
-      std::uniform_int_distribution<size_t> dist_size_index(0, NUM_SIZES - 1);
-      std::uniform_int_distribution<size_t> dist_percent(20, 30);
-
-      std::array<std::vector<std::pair<void*, size_t>>, NUM_SIZES> sizePtrs;
-      for (auto& ptrs : sizePtrs) {
-        ptrs.reserve(ALLOCS_PER_THREAD / NUM_SIZES);
-      }
-
-      for (size_t i = 0; i < ALLOCS_PER_THREAD; i++) {
-        size_t sizeIndex = i % NUM_SIZES;
-        size_t size = SIZES[sizeIndex];
-
-        void* ptr =
-            useMemPool ? MemoryPool::allocate(size) : operator new(size);
-        sizePtrs[sizeIndex].push_back({ptr, size});
-
-        // 测试内存复用 每100次循环释放一部分内存
-        if (i % 100 == 0) {
-          size_t releasIndex = dist_size_index(gen);
-          auto& ptrs = sizePtrs[releasIndex];
-          if (!ptrs.empty()) {
-            size_t releaseCount = ptrs.size() * dist_percent(gen) / 100;
-            releaseCount = std::min(releaseCount, ptrs.size());
-
-            for (size_t j = 0; j < releaseCount; j++) {
-              size_t index = rand() % ptrs.size();
-              if (useMemPool) {
-                MemoryPool::deallocate(ptrs[index].first, ptrs[index].second);
-              } else {
-                operator delete(ptrs[index].first);
-              }
-              ptrs[index] = ptrs.back();
-              ptrs.pop_back();
-            }
-          }
-        }
-        // 测试CentralCache的线程竞争
-        if (i % 1000 == 0) {
-          std::vector<std::pair<void*, size_t>> pressurePtrs;
-          for (size_t j = 0; j < 50; j++) {
-            size_t size = SIZES[rand() % NUM_SIZES];
-            void* ptr =
-                useMemPool ? MemoryPool::allocate(size) : operator new(size);
-            pressurePtrs.push_back({ptr, size});
-          }
-
-          // 立即释放这些内存
-          for (const auto& [ptr, size] : pressurePtrs) {
-            if (useMemPool) {
-              MemoryPool::deallocate(ptr, size);
-            } else {
-              operator delete(ptr);
-            }
-          }
-        }
-      }
-      // 清理所有内存
-      for (auto& ptrs : sizePtrs) {
-        for (auto& [ptr, size] : ptrs) {
-          if (useMemPool) {
-            MemoryPool::deallocate(ptr, size);
-          } else {
-            operator delete(ptr);
-          }
-        }
-      }
-    };
-
     // 测试内存池
     {
       Timer T;
       std::vector<std::thread> threads;
       for (size_t i = 0; i < NUM_THREADS; i++) {
-        threads.emplace_back(ThreadFunc, true);
+        threads.emplace_back(mutiThreadWorkload, true);
       }
 
       for (auto& thread : threads) {
@@ -229,7 +393,7 @@ class PerformanceTest {
       Timer T;
       std::vector<std::thread> threads;
       for (size_t i = 0; i < NUM_THREADS; i++) {
-        threads.emplace_back(ThreadFunc, false);
+        threads.emplace_back(mutiThreadWorkload, false);
       }
 
       for (auto& thread : threads) {
@@ -241,70 +405,13 @@ class PerformanceTest {
   }
 
   static void testMixeddSizes() {
-    constexpr size_t NUM_ALLOCS = 100000;
-
-    const size_t SMALL_SIZES[] = {8, 16, 32, 64, 128};
-    const size_t MEDIUM_SIZES[] = {256, 384, 512};
-    const size_t LARGE_SIZES[] = {1024, 2048, 4096};
-
-    const size_t NUM_SMALL = sizeof(SMALL_SIZES) / sizeof(SMALL_SIZES[0]);
-    const size_t NUM_MEDIUM = sizeof(MEDIUM_SIZES) / sizeof(MEDIUM_SIZES[0]);
-    const size_t NUM_LARGE = sizeof(LARGE_SIZES) / sizeof(LARGE_SIZES[0]);
-
-    std::cout << "\nTesting mixed size allocations (" << NUM_ALLOCS
+    std::cout << "\nTesting mixed size allocations (" << MIXED_NUM_ALLOCS
               << " allocations with fixed sizes):" << std::endl;
 
     // 测试内存池
     {
       Timer T;
-      const size_t NUM_PTRS = NUM_SMALL + NUM_MEDIUM + NUM_LARGE;
-      std::array<std::vector<std::pair<void*, size_t>>, NUM_PTRS> sizePtrs;
-      for (auto& ptrs : sizePtrs) {
-        ptrs.reserve(NUM_ALLOCS / (NUM_PTRS));
-      }
-      for (size_t i = 0; i < NUM_ALLOCS; i++) {
-        size_t size;
-        size_t category = i % 100;
-        if (category < 60) {
-          size_t index = (i / 60) % NUM_SMALL;
-          size = SMALL_SIZES[index];
-        } else if (category < 90) {
-          size_t index = (i / 30) % NUM_MEDIUM;
-          size = MEDIUM_SIZES[index];
-        } else {
-          size_t index = (i / 10) % NUM_LARGE;
-          size = LARGE_SIZES[index];
-        }
-
-        void* ptr = MemoryPool::allocate(size);
-        size_t prtIndex = (category < 60) ? (i / 60) % NUM_SMALL
-                          : (category < 90)
-                              ? NUM_SMALL + (i / 30) % NUM_MEDIUM
-                              : NUM_SMALL + NUM_MEDIUM + (i / 10) % NUM_LARGE;
-        sizePtrs[prtIndex].push_back({ptr, size});
-
-        if (i % 50 == 0) {
-          size_t releaseIndex = rand() % sizePtrs.size();
-          auto& ptrs = sizePtrs[releaseIndex];
-
-          if (!ptrs.empty()) {
-            size_t realeaseCount = ptrs.size() * (20 + rand() % 11) / 100;
-            realeaseCount = std::min(realeaseCount, ptrs.size());
-            for (size_t j = 0; j < realeaseCount; j++) {
-              size_t index = rand() % ptrs.size();
-              auto& ptr = ptrs[index];
-              MemoryPool::deallocate(ptr.first, ptr.second);
-              ptrs[index] = ptrs.back();
-              ptrs.pop_back();
-            }
-          }
-        }
-      }
-      for (auto& ptrs : sizePtrs) {
-        for (auto& ptr : ptrs) {
-          MemoryPool::deallocate(ptr.first, ptr.second);
-        }
-      }
+      mixedSizesWorkload(true);
       std::cout << "Memory Pool: " << std::fixed << std::setprecision(3)
                 << T.elapsed() << " ms" << std::endl;
     }
@@ -312,70 +419,237 @@ class PerformanceTest {
     // 测试new delete
     {
       Timer T;
-      std::array<std::vector<std::pair<void*, size_t>>,
-                 NUM_SMALL + NUM_MEDIUM + NUM_LARGE>
-          sizePtrs;
-      for (auto& ptrs : sizePtrs) {
-        ptrs.reserve(NUM_ALLOCS / (NUM_SMALL + NUM_MEDIUM + NUM_LARGE));
+      mixedSizesWorkload(false);
+      std::cout << "New/Delete: " << std::fixed << std::setprecision(3)
+                << T.elapsed() << " ms" << std::endl;
+    }
+  }
+
+  // 节点型容器测试
+  template <typename Container>
+  static double runContainerWorkload(Container& container, size_t numOps) {
+    Timer T;
+    for (size_t i = 0; i < numOps; i++) {
+      container.emplace(static_cast<int>(i), static_cast<int>(i));
+      // 每插入4个删除1个 制造节点复用
+      if (i % 4 == 3) {
+        container.erase(static_cast<int>(i / 2));
       }
+    }
+    container.clear();
+    return T.elapsed();
+  }
 
-      for (size_t i = 0; i < NUM_ALLOCS; ++i) {
-        size_t size;
-        int category = i % 100;
-
-        if (category < 60) {
-          size_t index = (i / 60) % NUM_SMALL;
-          size = SMALL_SIZES[index];
-        } else if (category < 90) {
-          size_t index = (i / 30) % NUM_MEDIUM;
-          size = MEDIUM_SIZES[index];
-        } else {
-          size_t index = (i / 10) % NUM_LARGE;
-          size = LARGE_SIZES[index];
+  static void testContainers() {
+    constexpr size_t NUM_OPS = 200000;
+    std::cout << "\nTesting node-based containers (" << NUM_OPS
+              << " insertions):" << std::endl;
+
+    using Pair = std::pair<const int, int>;
+    {
+      std::map<int, int> stdMap;
+      std::map<int, int, std::less<int>, StlAllocator<Pair>> poolMap;
+      double poolTime = runContainerWorkload(poolMap, NUM_OPS);
+      double stdTime = runContainerWorkload(stdMap, NUM_OPS);
+      std::cout << "std::map Memory Pool: " << std::fixed
+                << std::setprecision(3) << poolTime << " ms" << std::endl;
+      std::cout << "std::map std::allocator: " << std::fixed
+                << std::setprecision(3) << stdTime << " ms" << std::endl;
+    }
+    {
+      std::unordered_map<int, int> stdHash;
+      std::unordered_map<int, int, std::hash<int>, std::equal_to<int>,
+                         StlAllocator<Pair>>
+          poolHash;
+      std::pmr::unordered_map<int, int> pmrHash(
+          &PoolMemoryResource::getInstance());
+      double poolTime = runContainerWorkload(poolHash, NUM_OPS);
+      double pmrTime = runContainerWorkload(pmrHash, NUM_OPS);
+      double stdTime = runContainerWorkload(stdHash, NUM_OPS);
+      std::cout << "std::unordered_map Memory Pool: " << std::fixed
+                << std::setprecision(3) << poolTime << " ms" << std::endl;
+      std::cout << "std::pmr::unordered_map Memory Pool: " << std::fixed
+                << std::setprecision(3) << pmrTime << " ms" << std::endl;
+      std::cout << "std::unordered_map std::allocator: " << std::fixed
+                << std::setprecision(3) << stdTime << " ms" << std::endl;
+    }
+    {
+      // list没有按键插入 单独测试
+      std::list<int> stdList;
+      std::list<int, StlAllocator<int>> poolList;
+      auto listWorkload = [](auto& list) {
+        Timer T;
+        for (size_t i = 0; i < NUM_OPS; i++) {
+          list.push_back(static_cast<int>(i));
+          if (i % 4 == 3) list.pop_front();
         }
+        list.clear();
+        return T.elapsed();
+      };
+      double poolTime = listWorkload(poolList);
+      double stdTime = listWorkload(stdList);
+      std::cout << "std::list Memory Pool: " << std::fixed
+                << std::setprecision(3) << poolTime << " ms" << std::endl;
+      std::cout << "std::list std::allocator: " << std::fixed
+                << std::setprecision(3) << stdTime << " ms" << std::endl;
+    }
+  }
 
-        void* ptr = new char[size];
-        size_t ptrIndex = (category < 60) ? (i / 60) % NUM_SMALL
-                          : (category < 90)
-                              ? NUM_SMALL + (i / 30) % NUM_MEDIUM
-                              : NUM_SMALL + NUM_MEDIUM + (i / 10) % NUM_LARGE;
-        sizePtrs[ptrIndex].push_back({ptr, size});
-
-        if (i % 50 == 0) {
-          size_t releaseIndex = rand() % sizePtrs.size();
-          auto& ptrs = sizePtrs[releaseIndex];
-
-          if (!ptrs.empty()) {
-            size_t releaseCount = ptrs.size() * (20 + (rand() % 11)) / 100;
-            releaseCount = std::min(releaseCount, ptrs.size());
-
-            for (size_t j = 0; j < releaseCount; ++j) {
-              size_t index = rand() % ptrs.size();
-              delete[] static_cast<char*>(ptrs[index].first);
-              ptrs[index] = ptrs.back();
-              ptrs.pop_back();
-            }
-          }
+  // 扩展性测试: 每种负载在1到maxThreads个线程下各跑一次, 每个线程的工作量不变
+  // 结果写成CSV 每行一个配置, 包括perf计数、RSS与内存池各层锁的等待
+  static void testScalability(size_t maxThreads, FILE* csv) {
+    struct Workload {
+      const char* name;
+      void (*run)(bool useMemPool);
+      size_t allocsPerThread;
+    };
+    const Workload WORKLOADS[] = {
+        {"small_allocation", smallAllocationWorkload, SMALL_NUM_ALLOCS},
+        {"muti_thread", mutiThreadWorkload, ALLOCS_PER_THREAD},
+        {"mixed_sizes", mixedSizesWorkload, MIXED_NUM_ALLOCS},
+    };
+    std::cout << "\nTesting scalability (1 to " << maxThreads
+              << " threads):" << std::endl;
+
+    {
+      PerfCounters probe;
+      for (size_t i = 0; i < PerfCounters::NUM_EVENTS; i++) {
+        if (!probe.available(i)) {
+          std::cerr << "perf event " << PerfCounters::EVENTS[i].name
+                    << " unavailable: " << strerror(probe.error(i))
+                    << std::endl;
         }
       }
+    }
+    // 中心缓存与页缓存锁的等待 用于把扩展性问题定位到具体的层
+    LockProfiler::start();
 
-      for (auto& ptrs : sizePtrs) {
-        for (const auto& [ptr, size] : ptrs) {
-          delete[] static_cast<char*>(ptr);
+    fprintf(csv, "workload,allocator,threads,allocs,elapsed_ms,speedup");
+    for (const PerfCounters::Event& event : PerfCounters::EVENTS) {
+      fprintf(csv, ",%s", event.name);
+    }
+    fprintf(csv,
+            ",ipc,rss_start_kb,rss_peak_kb,central_lock_contended,"
+            "central_lock_wait_ns,page_lock_contended,page_lock_wait_ns\n");
+
+    for (const Workload& workload : WORKLOADS) {
+      for (bool useMemPool : {true, false}) {
+        double baseMs = 0;
+        for (size_t threads = 1; threads <= maxThreads; threads++) {
+          LockContentionStats pageBefore, pageAfter;
+          std::vector<LockContentionStats> centralBefore, centralAfter;
+          LockProfiler::collect(&pageBefore, &centralBefore);
+
+          std::atomic<bool> go{false};
+          std::atomic<bool> done{false};
+          std::atomic<long> peakRss{residentKb()};
+          long startRss = peakRss.load();
+          std::thread sampler([&] {
+            while (!done.load()) {
+              long rss = residentKb();
+              if (rss > peakRss.load()) peakRss.store(rss);
+              std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            }
+          });
+
+          // 计数器须在工作线程创建之前打开 才会继承到这些线程
+          std::array<double, PerfCounters::NUM_EVENTS> counts;
+          PerfCounters counters;
+          std::vector<std::thread> workers;
+          for (size_t t = 0; t < threads; t++) {
+            workers.emplace_back([&] {
+              while (!go.load()) std::this_thread::yield();
+              workload.run(useMemPool);
+            });
+          }
+          counters.start();
+          Timer T;
+          go.store(true);
+          for (auto& worker : workers) worker.join();
+          double ms = T.elapsed();
+          counters.stop(&counts);
+          done.store(true);
+          sampler.join();
+          LockProfiler::collect(&pageAfter, &centralAfter);
+
+          if (threads == 1) baseMs = ms;
+          // 每线程工作量不变 理想情况下耗时不变, 加速比等于线程数
+          double speedup = baseMs * threads / ms;
+          fprintf(csv, "%s,%s,%zu,%zu,%.3f,%.3f", workload.name,
+                  useMemPool ? "memory_pool" : "new_delete", threads,
+                  workload.allocsPerThread * threads, ms, speedup);
+          for (size_t i = 0; i < PerfCounters::NUM_EVENTS; i++) {
+            if (counters.available(i)) {
+              fprintf(csv, ",%.0f", counts[i]);
+            } else {
+              fprintf(csv, ",");
+            }
+          }
+          if (counters.available(0) && counters.available(1) && counts[0]) {
+            fprintf(csv, ",%.3f", counts[1] / counts[0]);
+          } else {
+            fprintf(csv, ",");
+          }
+          fprintf(csv, ",%ld,%ld", startRss, peakRss.load());
+          if (useMemPool) {
+            uint64_t contended = 0, waitNs = 0;
+            for (const LockContentionStats& lock : centralAfter) {
+              contended += lock.contended;
+              waitNs += lock.waitNs;
+            }
+            for (const LockContentionStats& lock : centralBefore) {
+              contended -= lock.contended;
+              waitNs -= lock.waitNs;
+            }
+            fprintf(csv, ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+                    contended, waitNs,
+                    pageAfter.contended - pageBefore.contended,
+                    pageAfter.waitNs - pageBefore.waitNs);
+          } else {
+            fprintf(csv, ",,,,\n");
+          }
+          fflush(csv);
+          std::cout << workload.name << " "
+                    << (useMemPool ? "Memory Pool" : "New/Delete") << " "
+                    << threads << " threads: " << std::fixed
+                    << std::setprecision(3) << ms << " ms (speedup "
+                    << speedup << ")" << std::endl;
         }
       }
-
-      std::cout << "New/Delete: " << std::fixed << std::setprecision(3)
-                << T.elapsed() << " ms" << std::endl;
     }
+    LockProfiler::stop();
   }
 };
 
-int main() {
+// 不带参数时运行全部单项测试
+// --scale [N] [--csv 文件]: 运行1到N个线程的扩展性测试, N默认为CPU数
+int main(int argc, char** argv) {
+  if (argc > 1 && strcmp(argv[1], "--scale") == 0) {
+    size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    const char* csvPath = nullptr;
+    for (int i = 2; i < argc; i++) {
+      if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+        csvPath = argv[++i];
+      } else if (atoi(argv[i]) > 0) {
+        maxThreads = atoi(argv[i]);
+      }
+    }
+    FILE* csv = csvPath ? fopen(csvPath, "w") : stdout;
+    if (!csv) {
+      perror(csvPath);
+      return 1;
+    }
+    PerformanceTest::warmUp();
+    PerformanceTest::testScalability(maxThreads, csv);
+    if (csv != stdout) fclose(csv);
+    return 0;
+  }
+
   std::cout << "Starting performance tests..." << std::endl;
   PerformanceTest::warmUp();
   PerformanceTest::testSmallAllocation();
   PerformanceTest::testMutiThread();
   PerformanceTest::testMixeddSizes();
+  PerformanceTest::testContainers();
   std::cout << "All the tests have been completed.." << std::endl;
 }
\ No newline at end of file
@@ -0,0 +1,68 @@
+// 通过LD_PRELOAD加载libmemorypool.so后运行 只使用标准分配接口
+#include <malloc.h>
+
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+// 按对齐要求检查指针并写满可用空间
+void checkAligned(void* ptr, size_t size, size_t align) {
+  assert(ptr != nullptr);
+  assert((reinterpret_cast<uintptr_t>(ptr) & (align - 1)) == 0);
+  assert(malloc_usable_size(ptr) >= size);
+  memset(ptr, 0xab, size);
+}
+
+void testPreloaded() {
+  std::cout << "Running preloaded test..." << std::endl;
+
+  // 内存池的最小块为8字节 glibc的最小块更大, 以此确认替换生效
+  void* ptr = malloc(1);
+  assert(malloc_usable_size(ptr) == 8);
+  free(ptr);
+
+  std::cout << "Preloaded test passed!" << std::endl;
+}
+
+void testLargeAlignment() {
+  std::cout << "Running large alignment test..." << std::endl;
+
+  const size_t aligns[] = {8192, 65536, 2 * 1024 * 1024};
+  for (size_t align : aligns) {
+    for (size_t size : {size_t(100), 3 * align}) {
+      void* ptr = nullptr;
+      [[maybe_unused]] int result = posix_memalign(&ptr, align, size);
+      assert(result == 0);
+      checkAligned(ptr, size, align);
+      free(ptr);
+
+      ptr = aligned_alloc(align, size);
+      checkAligned(ptr, size, align);
+      free(ptr);
+
+      ptr = memalign(align, size);
+      checkAligned(ptr, size, align);
+      // 超过对齐的块扩展后数据保留
+      ptr = realloc(ptr, 4 * size);
+      assert(ptr != nullptr && static_cast<unsigned char*>(ptr)[0] == 0xab);
+      free(ptr);
+
+      ptr = operator new(size, std::align_val_t(align));
+      checkAligned(ptr, size, align);
+      operator delete(ptr, size, std::align_val_t(align));
+      ptr = operator new[](size, std::align_val_t(align));
+      checkAligned(ptr, size, align);
+      operator delete[](ptr, std::align_val_t(align));
+    }
+  }
+
+  std::cout << "Large alignment test passed!" << std::endl;
+}
+
+int main() {
+  testPreloaded();
+  testLargeAlignment();
+}
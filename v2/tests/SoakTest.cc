@@ -0,0 +1,353 @@
+// 长时间运行的碎片浸泡测试
+// 工作线程按阶段切换大小分布, 每个周期先突发分配再进入空闲期, 对象寿命服从
+// 长尾的帕累托分布. 主线程定期采样RSS、在用字节、映射字节、span数与空闲span的
+// 外部碎片, 预热之后 RSS与在用字节之比超过阈值即判为失败
+//
+// 用法: soak_test [--duration 秒] [--phase 秒] [--cycle 毫秒] [--threads N]
+//                 [--max-live-mb 64] [--min-live-mb 8] [--threshold 4]
+//                 [--warmup 秒] [--interval 毫秒] [--csv 输出文件] [--seed N]
+// 通过返回0, 比值超过阈值返回1
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "HeapReport.h"
+#include "MemoryPool.h"
+
+namespace {
+using clock_type = std::chrono::steady_clock;
+
+// 每个阶段的请求大小在[minSize, maxSize]内按对数均匀分布
+struct Phase {
+  const char* name;
+  size_t minSize;
+  size_t maxSize;
+};
+
+// 依次从小块移到大块再回到混合分布 让前一阶段留下的span难以复用
+const Phase PHASES[] = {
+    {"small", 8, 256},
+    {"medium", 256, 4096},
+    {"large", 4096, 64 * 1024},
+    {"huge", 64 * 1024, 1024 * 1024},
+    {"mixed", 8, 64 * 1024},
+};
+constexpr size_t PHASE_COUNT = sizeof(PHASES) / sizeof(PHASES[0]);
+
+// 寿命的帕累托分布 最短MIN_LIFETIME_MS, 越小的ALPHA尾部越长
+constexpr double MIN_LIFETIME_MS = 5.0;
+constexpr double LIFETIME_ALPHA = 1.1;
+// 每个周期中突发分配所占的比例
+constexpr double BURST_FRACTION = 0.25;
+// 空闲期每次分配之间的间隔
+constexpr auto QUIET_INTERVAL = std::chrono::microseconds(200);
+
+struct Options {
+  double durationSec = 30;
+  double phaseSec = 3;
+  double cycleMs = 1000;
+  size_t threads = 4;
+  size_t maxLiveMb = 64;  // 所有线程合计的在用字节上限
+  size_t minLiveMb = 8;   // 计算比值时在用字节的下限 避免空闲期除以接近0的数
+  double threshold = 4;
+  double warmupSec = -1;  // 默认跳过第一轮全部阶段
+  double intervalMs = 250;
+  std::string csvPath;
+  unsigned seed = 1;
+};
+
+struct Object {
+  clock_type::time_point expiry;
+  void* ptr;
+  size_t size;
+
+  bool operator>(const Object& other) const { return expiry > other.expiry; }
+};
+
+// 每个工作线程的在用字节 由所属线程写, 采样线程读
+struct alignas(64) WorkerState {
+  std::atomic<size_t> liveBytes{0};
+  std::atomic<size_t> liveObjects{0};
+};
+
+struct Sample {
+  double timeSec;
+  size_t phase;
+  bool burst;
+  long rssBytes;
+  size_t liveBytes;
+  size_t liveObjects;
+  size_t mappedBytes;
+  size_t pageFreeBytes;
+  size_t centralBytes;
+  size_t threadBytes;
+  size_t spans;
+  size_t freeSpans;
+  size_t freeSpanBytes;
+  double externalFragmentation;
+  double ratio;
+};
+
+long residentBytes() {
+  FILE* in = fopen("/proc/self/statm", "r");
+  if (!in) return 0;
+  long size = 0, resident = 0;
+  if (fscanf(in, "%ld %ld", &size, &resident) != 2) resident = 0;
+  fclose(in);
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+// 阶段与周期都由开始以来的时间决定 所有线程同步切换
+size_t phaseAt(const Options& options, double elapsedSec) {
+  return static_cast<size_t>(elapsedSec / options.phaseSec) % PHASE_COUNT;
+}
+
+bool burstAt(const Options& options, double elapsedSec) {
+  double cycle = std::fmod(elapsedSec * 1000, options.cycleMs);
+  return cycle < options.cycleMs * BURST_FRACTION;
+}
+
+double secondsSince(clock_type::time_point start) {
+  return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+void worker(const Options& options, size_t index, WorkerState* state,
+            clock_type::time_point start, const std::atomic<bool>* stop) {
+  std::mt19937_64 rng(options.seed * 1000003 + index);
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+  size_t budget = options.maxLiveMb * 1048576 / options.threads;
+  auto maxLifetime = std::chrono::duration<double>(options.durationSec);
+  std::priority_queue<Object, std::vector<Object>, std::greater<Object>>
+      objects;
+  size_t liveBytes = 0;
+
+  while (!stop->load(std::memory_order_relaxed)) {
+    clock_type::time_point now = clock_type::now();
+    while (!objects.empty() && objects.top().expiry <= now) {
+      const Object& obj = objects.top();
+      memory_pool::MemoryPool::deallocate(obj.ptr, obj.size);
+      liveBytes -= obj.size;
+      objects.pop();
+    }
+
+    double elapsed = std::chrono::duration<double>(now - start).count();
+    const Phase& phase = PHASES[phaseAt(options, elapsed)];
+    bool burst = burstAt(options, elapsed);
+    double logMin = std::log(static_cast<double>(phase.minSize));
+    double logMax = std::log(static_cast<double>(phase.maxSize));
+    size_t size =
+        static_cast<size_t>(std::exp(logMin + (logMax - logMin) * unit(rng)));
+    if (liveBytes + size <= budget) {
+      void* ptr = memory_pool::MemoryPool::allocate(size);
+      if (ptr) {
+        // 写第一个字节 让新页计入RSS
+        *static_cast<char*>(ptr) = 1;
+        double lifetimeMs =
+            MIN_LIFETIME_MS / std::pow(1.0 - unit(rng), 1.0 / LIFETIME_ALPHA);
+        auto lifetime = std::min(
+            std::chrono::duration<double>(lifetimeMs / 1000), maxLifetime);
+        objects.push(
+            {now + std::chrono::duration_cast<clock_type::duration>(lifetime),
+             ptr, size});
+        liveBytes += size;
+      }
+    }
+    state->liveBytes.store(liveBytes, std::memory_order_relaxed);
+    state->liveObjects.store(objects.size(), std::memory_order_relaxed);
+    if (!burst) std::this_thread::sleep_for(QUIET_INTERVAL);
+  }
+
+  while (!objects.empty()) {
+    memory_pool::MemoryPool::deallocate(objects.top().ptr, objects.top().size);
+    objects.pop();
+  }
+  state->liveBytes.store(0, std::memory_order_relaxed);
+  state->liveObjects.store(0, std::memory_order_relaxed);
+}
+
+Sample takeSample(const Options& options,
+                  const std::vector<WorkerState>& states,
+                  clock_type::time_point start, long baseRss) {
+  Sample sample = {};
+  sample.timeSec = secondsSince(start);
+  sample.phase = phaseAt(options, sample.timeSec);
+  sample.burst = burstAt(options, sample.timeSec);
+  for (const WorkerState& state : states) {
+    sample.liveBytes += state.liveBytes.load(std::memory_order_relaxed);
+    sample.liveObjects += state.liveObjects.load(std::memory_order_relaxed);
+  }
+
+  memory_pool::PoolStats stats = memory_pool::MemoryPool::getStats();
+  sample.mappedBytes = stats.pageCache.mappedBytes;
+  sample.pageFreeBytes = stats.pageCache.freeBytes;
+  for (const memory_pool::SizeClassStats& cls : stats.sizeClasses) {
+    sample.threadBytes += cls.threadCacheBytes;
+    sample.centralBytes += cls.centralCacheBytes;
+  }
+  memory_pool::HeapReport report = memory_pool::HeapReport::collect();
+  sample.spans = report.spans.size();
+  sample.freeSpans = report.freeSpans;
+  sample.freeSpanBytes = report.freeSpanBytes;
+  sample.externalFragmentation = report.externalFragmentation;
+
+  // 最后读RSS 包含上面统计本身占用的内存
+  sample.rssBytes = std::max(residentBytes() - baseRss, 0L);
+  size_t floor = options.minLiveMb * 1048576;
+  sample.ratio = static_cast<double>(sample.rssBytes) /
+                 std::max<size_t>(std::max<size_t>(sample.liveBytes, floor), 1);
+  return sample;
+}
+
+void writeCsvHeader(FILE* out) {
+  fprintf(out,
+          "time_s,phase,burst,rss_bytes,live_bytes,live_objects,"
+          "mapped_bytes,page_free_bytes,central_bytes,thread_bytes,spans,"
+          "free_spans,free_span_bytes,external_fragmentation,ratio\n");
+}
+
+void writeCsvRow(FILE* out, const Sample& s) {
+  fprintf(out, "%.3f,%s,%d,%ld,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%.4f,%.3f\n",
+          s.timeSec, PHASES[s.phase].name, s.burst ? 1 : 0, s.rssBytes,
+          s.liveBytes, s.liveObjects, s.mappedBytes, s.pageFreeBytes,
+          s.centralBytes, s.threadBytes, s.spans, s.freeSpans,
+          s.freeSpanBytes, s.externalFragmentation, s.ratio);
+}
+
+bool parseOptions(int argc, char** argv, Options* options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) return false;
+    const char* value = argv[++i];
+    if (arg == "--duration") {
+      options->durationSec = atof(value);
+    } else if (arg == "--phase") {
+      options->phaseSec = atof(value);
+    } else if (arg == "--cycle") {
+      options->cycleMs = atof(value);
+    } else if (arg == "--threads") {
+      options->threads = strtoul(value, nullptr, 10);
+    } else if (arg == "--max-live-mb") {
+      options->maxLiveMb = strtoul(value, nullptr, 10);
+    } else if (arg == "--min-live-mb") {
+      options->minLiveMb = strtoul(value, nullptr, 10);
+    } else if (arg == "--threshold") {
+      options->threshold = atof(value);
+    } else if (arg == "--warmup") {
+      options->warmupSec = atof(value);
+    } else if (arg == "--interval") {
+      options->intervalMs = atof(value);
+    } else if (arg == "--csv") {
+      options->csvPath = value;
+    } else if (arg == "--seed") {
+      options->seed = strtoul(value, nullptr, 10);
+    } else {
+      return false;
+    }
+  }
+  if (options->warmupSec < 0) {
+    options->warmupSec = options->phaseSec * PHASE_COUNT;
+  }
+  return options->durationSec > 0 && options->phaseSec > 0 &&
+         options->cycleMs > 0 && options->threads > 0 &&
+         options->maxLiveMb > 0 && options->threshold > 0 &&
+         options->intervalMs > 0;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!parseOptions(argc, argv, &options)) {
+    fprintf(stderr,
+            "usage: %s [--duration sec] [--phase sec] [--cycle ms] "
+            "[--threads N] [--max-live-mb 64] [--min-live-mb 8] "
+            "[--threshold 4] [--warmup sec] [--interval ms] [--csv out.csv] "
+            "[--seed N]\n",
+            argv[0]);
+    return 2;
+  }
+  FILE* csv = nullptr;
+  if (!options.csvPath.empty()) {
+    csv = fopen(options.csvPath.c_str(), "w");
+    if (!csv) {
+      perror(options.csvPath.c_str());
+      return 2;
+    }
+    writeCsvHeader(csv);
+  }
+
+  printf("soak: %.0fs, %zu threads, live <= %zu MB, threshold %.2f "
+         "(checked after %.0fs)\n",
+         options.durationSec, options.threads, options.maxLiveMb,
+         options.threshold, options.warmupSec);
+  printf("%8s %-7s %5s %9s %9s %9s %10s %9s %7s %10s %6s %7s\n", "time",
+         "phase", "burst", "rss MB", "live MB", "mapped MB", "central MB",
+         "thread MB", "spans", "free spans", "frag", "ratio");
+
+  long baseRss = residentBytes();
+  std::vector<WorkerState> states(options.threads);
+  std::atomic<bool> stop{false};
+  clock_type::time_point start = clock_type::now();
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < options.threads; t++) {
+    workers.emplace_back(worker, std::cref(options), t, &states[t], start,
+                         &stop);
+  }
+
+  auto interval = std::chrono::duration<double, std::milli>(options.intervalMs);
+  Sample worst = {};
+  size_t failures = 0;
+  size_t samples = 0;
+  long peakRss = 0;
+  size_t peakLive = 0;
+  clock_type::time_point next = start;
+  while (secondsSince(start) < options.durationSec) {
+    next += std::chrono::duration_cast<clock_type::duration>(interval);
+    std::this_thread::sleep_until(next);
+    Sample s = takeSample(options, states, start, baseRss);
+    samples++;
+    peakRss = std::max(peakRss, s.rssBytes);
+    peakLive = std::max(peakLive, s.liveBytes);
+    bool checked = s.timeSec >= options.warmupSec;
+    bool failed = checked && s.ratio > options.threshold;
+    if (failed) failures++;
+    if (checked && s.ratio > worst.ratio) worst = s;
+    if (csv) writeCsvRow(csv, s);
+    printf("%8.2f %-7s %5s %9.1f %9.1f %9.1f %10.1f %9.1f %7zu %10zu %6.3f "
+           "%6.2f%s\n",
+           s.timeSec, PHASES[s.phase].name, s.burst ? "yes" : "",
+           s.rssBytes / 1048576.0, s.liveBytes / 1048576.0,
+           s.mappedBytes / 1048576.0, s.centralBytes / 1048576.0,
+           s.threadBytes / 1048576.0, s.spans, s.freeSpans,
+           s.externalFragmentation, s.ratio, failed ? " !" : "");
+    fflush(stdout);
+  }
+
+  stop.store(true);
+  for (std::thread& t : workers) t.join();
+  if (csv) fclose(csv);
+
+  printf("\n%zu samples, peak rss %.1f MB, peak live %.1f MB\n", samples,
+         peakRss / 1048576.0, peakLive / 1048576.0);
+  if (worst.timeSec > 0) {
+    printf("worst ratio %.2f at %.2fs (%s, rss %.1f MB, live %.1f MB)\n",
+           worst.ratio, worst.timeSec, PHASES[worst.phase].name,
+           worst.rssBytes / 1048576.0, worst.liveBytes / 1048576.0);
+  }
+  if (failures > 0) {
+    printf("FAILED: rss/live exceeded %.2f in %zu samples\n", options.threshold,
+           failures);
+    return 1;
+  }
+  printf("passed\n");
+  return 0;
+}
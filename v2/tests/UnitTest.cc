@@ -1,12 +1,30 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
 #include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <memory_resource>
 #include <random>
+#include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include "../include/Arena.h"
+#include "../include/Heap.h"
+#include "../include/GuardedPool.h"
+#include "../include/HeapProfiler.h"
+#include "../include/LockProfiler.h"
 #include "../include/MemoryPool.h"
+#include "../include/ObjectPool.h"
+#include "../include/PoolAllocator.h"
+#include "../include/RealTimePool.h"
+#include "../include/TraceRecorder.h"
 using namespace memory_pool;
 
 // 基础分配测试
@@ -123,6 +141,17 @@ void testEdgeCases() {
   assert(ptr4 != nullptr);
   MemoryPool::deallocate(ptr4, MAX_BYTES + 1);
 
+  // 页数计算会溢出的大小直接失败 即使页缓存中有空闲span
+  void* ptr5 = MemoryPool::allocate(1024 * 1024);
+  MemoryPool::deallocate(ptr5, 1024 * 1024);
+  const size_t hugeSizes[] = {SIZE_MAX, SIZE_MAX - 100, MAX_ALLOC_BYTES + 1};
+  for (size_t size : hugeSizes) {
+    [[maybe_unused]] void* huge = MemoryPool::allocate(size);
+    assert(huge == nullptr);
+    huge = MemoryPool::allocateAligned(size, 64);
+    assert(huge == nullptr);
+  }
+
   std::cout << "Edge cases test passed!" << std::endl;
 }
 
@@ -152,10 +181,1199 @@ void testStress() {
   std::cout << "Stress test passed!" << std::endl;
 }
 
+// 批量分配测试
+void testBatchAllocation() {
+  std::cout << "Running batch allocation test..." << std::endl;
+
+  const size_t sizes[] = {8, 24, 256, 4096, 64 * 1024};
+  for (size_t size : sizes) {
+    const size_t n = 500;
+    std::vector<void*> ptrs(n);
+    [[maybe_unused]] size_t count =
+        MemoryPool::allocateBatch(size, n, ptrs.data());
+    assert(count == n);
+
+    // 块之间不能重叠
+    for (size_t i = 0; i < n; i++) {
+      memset(ptrs[i], static_cast<int>(i & 0xff), size);
+    }
+    for (size_t i = 0; i < n; i++) {
+      [[maybe_unused]] const unsigned char* p =
+          static_cast<const unsigned char*>(ptrs[i]);
+      assert(p[0] == (i & 0xff) && p[size - 1] == (i & 0xff));
+    }
+    MemoryPool::deallocateBatch(ptrs.data(), n, size);
+
+    // 批量释放的块可以再被单个分配取回
+    void* ptr = MemoryPool::allocate(size);
+    assert(ptr != nullptr);
+    MemoryPool::deallocate(ptr, size);
+  }
+
+  std::cout << "Batch allocation test passed!" << std::endl;
+}
+
+// 对齐分配测试
+void testAlignedAllocation() {
+  std::cout << "Running aligned allocation test..." << std::endl;
+
+  const size_t aligns[] = {8, 16, 32, 64, 256, 4096};
+  const size_t sizes[] = {1, 24, 100, 1000, 5000, MAX_BYTES + 1};
+  for (size_t align : aligns) {
+    for (size_t size : sizes) {
+      std::vector<void*> ptrs;
+      for (int i = 0; i < 100; i++) {
+        void* ptr = MemoryPool::allocateAligned(size, align);
+        assert(ptr != nullptr);
+        assert((reinterpret_cast<uintptr_t>(ptr) & (align - 1)) == 0);
+        memset(ptr, 0xab, size);
+        ptrs.push_back(ptr);
+      }
+      for (void* ptr : ptrs) {
+        MemoryPool::deallocateAligned(ptr, size, align);
+      }
+    }
+  }
+
+  // 超过页大小的对齐单独占用span 不带大小的释放同样识别
+  const size_t largeAligns[] = {8192, 65536, 2 * 1024 * 1024};
+  for (size_t align : largeAligns) {
+    for (size_t size : {size_t(100), 3 * align}) {
+      void* ptrs[4];
+      for (void*& ptr : ptrs) {
+        ptr = MemoryPool::allocateAligned(size, align);
+        assert(ptr != nullptr);
+        assert((reinterpret_cast<uintptr_t>(ptr) & (align - 1)) == 0);
+        assert(MemoryPool::getUsableSize(ptr) >= size);
+        memset(ptr, 0xab, size);
+      }
+      MemoryPool::deallocateAligned(ptrs[0], size, align);
+      MemoryPool::deallocate(ptrs[1]);
+      MemoryPool::deallocateAligned(ptrs[2], size, align);
+      MemoryPool::deallocate(ptrs[3]);
+    }
+  }
+
+  // 非2的幂的对齐要求不支持
+  [[maybe_unused]] void* invalid = MemoryPool::allocateAligned(64, 48);
+  assert(invalid == nullptr);
+
+  std::cout << "Aligned allocation test passed!" << std::endl;
+}
+
+// 不带大小释放测试
+void testUnsizedDeallocation() {
+  std::cout << "Running unsized deallocation test..." << std::endl;
+
+  const size_t sizes[] = {1, 8, 100, 4096, 40000, MAX_BYTES, MAX_BYTES + 1};
+  for (size_t size : sizes) {
+    void* ptr = MemoryPool::allocate(size);
+    assert(ptr != nullptr);
+    // 可用大小至少为申请大小
+    assert(MemoryPool::getUsableSize(ptr) >= size);
+    memset(ptr, 0xcd, MemoryPool::getUsableSize(ptr));
+    MemoryPool::deallocate(ptr);
+  }
+
+  // 不属于内存池的指针
+  [[maybe_unused]] int local = 0;
+  assert(MemoryPool::getUsableSize(&local) == 0);
+
+  std::cout << "Unsized deallocation test passed!" << std::endl;
+}
+
+// 重新分配测试
+void testReallocation() {
+  std::cout << "Running reallocation test..." << std::endl;
+
+  // 同一大小类内原地返回
+  char* ptr = static_cast<char*>(MemoryPool::allocate(17));
+  memset(ptr, 1, 17);
+  [[maybe_unused]] void* same = MemoryPool::reallocate(ptr, 17, 24);
+  assert(same == ptr);
+
+  // 超出上限时失败 原块不变
+  [[maybe_unused]] void* failed =
+      MemoryPool::reallocate(ptr, 24, SIZE_MAX - 100);
+  assert(failed == nullptr && ptr[16] == 1);
+  // 跨大小类时搬移并保留数据
+  char* grown = static_cast<char*>(MemoryPool::reallocate(ptr, 24, 1000));
+  assert(grown != nullptr);
+  for (size_t i = 0; i < 17; i++) {
+    assert(grown[i] == 1);
+  }
+  MemoryPool::deallocate(grown, 1000);
+
+  // 大块收缩后原地扩展回原大小
+  const size_t large = 1024 * 1024;
+  char* big = static_cast<char*>(MemoryPool::allocate(large));
+  memset(big, 2, large);
+  same = MemoryPool::reallocate(big, large, large / 2);
+  assert(same == big);
+  same = MemoryPool::reallocate(big, large / 2, large);
+  assert(same == big);
+  assert(big[large / 2 - 1] == 2);
+  failed = MemoryPool::reallocate(big, large, SIZE_MAX - 100);
+  assert(failed == nullptr);
+  assert(MemoryPool::getUsableSize(big) == large && big[large - 1] == 2);
+
+  // 超大块扩展 保留原有数据
+  char* huge =
+      static_cast<char*>(MemoryPool::reallocate(big, large, 8 * large));
+  assert(huge != nullptr);
+  assert(huge[0] == 2 && huge[large / 2 - 1] == 2);
+  memset(huge, 3, 8 * large);
+  MemoryPool::deallocate(huge, 8 * large);
+
+  std::cout << "Reallocation test passed!" << std::endl;
+}
+
+// STL分配器测试
+void testStlAllocator() {
+  std::cout << "Running STL allocator test..." << std::endl;
+
+  std::vector<int, StlAllocator<int>> vec;
+  for (int i = 0; i < 10000; i++) {
+    vec.push_back(i);
+  }
+  assert(vec[9999] == 9999);
+
+  std::map<int, std::string, std::less<int>,
+           StlAllocator<std::pair<const int, std::string>>>
+      tree;
+  for (int i = 0; i < 1000; i++) {
+    tree[i] = std::to_string(i);
+  }
+  assert(tree[500] == "500");
+
+  // 超过ALIGNMENT的对齐要求
+  struct alignas(64) CacheLine {
+    char data[64];
+  };
+  std::vector<CacheLine, StlAllocator<CacheLine>> lines(10);
+  assert((reinterpret_cast<uintptr_t>(lines.data()) & 63) == 0);
+
+  std::pmr::unordered_map<int, int> hash(&PoolMemoryResource::getInstance());
+  for (int i = 0; i < 10000; i++) {
+    hash[i] = i * 2;
+  }
+  assert(hash[1234] == 2468);
+
+  std::cout << "STL allocator test passed!" << std::endl;
+}
+
+// 类型化对象池测试
+struct PooledObject {
+  static int liveCount;
+  int value;
+  std::string name;
+  explicit PooledObject(int v) : value(v), name(std::to_string(v)) {
+    liveCount++;
+  }
+  ~PooledObject() { liveCount--; }
+};
+int PooledObject::liveCount = 0;
+
+void testObjectPool() {
+  std::cout << "Running object pool test..." << std::endl;
+
+  {
+    PooledPtr<PooledObject> obj = make_pooled<PooledObject>(42);
+    assert(obj->value == 42 && obj->name == "42");
+    assert(PooledObject::liveCount == 1);
+  }
+  assert(PooledObject::liveCount == 0);
+
+  const size_t n = 300;
+  std::vector<PooledObject*> objs(n);
+  ObjectPool<PooledObject>::createBatch(objs.data(), n, 7);
+  assert(PooledObject::liveCount == static_cast<int>(n));
+  assert(objs[n - 1]->value == 7);
+  ObjectPool<PooledObject>::destroyBatch(objs.data(), n);
+  assert(PooledObject::liveCount == 0);
+
+  // 平凡析构类型与超对齐类型
+  struct alignas(64) Vec4 {
+    double v[4];
+  };
+  static_assert(ObjectPool<Vec4>::BLOCK_SIZE % 64 == 0, "block not aligned");
+  std::vector<Vec4*> vecs(n);
+  ObjectPool<Vec4>::createBatch(vecs.data(), n);
+  for ([[maybe_unused]] Vec4* v : vecs) {
+    assert((reinterpret_cast<uintptr_t>(v) & 63) == 0);
+  }
+  ObjectPool<Vec4>::destroyBatch(vecs.data(), n);
+
+  std::cout << "Object pool test passed!" << std::endl;
+}
+
+// 区域分配器测试
+void testArena() {
+  std::cout << "Running arena test..." << std::endl;
+
+  Arena arena;
+  for (int round = 0; round < 3; round++) {
+    std::vector<char*> ptrs;
+    for (size_t i = 0; i < 10000; i++) {
+      size_t size = i % 200 + 1;
+      char* ptr = static_cast<char*>(arena.allocate(size));
+      assert(ptr != nullptr);
+      assert((reinterpret_cast<uintptr_t>(ptr) &
+              (alignof(std::max_align_t) - 1)) == 0);
+      memset(ptr, static_cast<int>(size), size);
+      ptrs.push_back(ptr);
+    }
+    for (size_t i = 0; i < ptrs.size(); i++) {
+      assert(ptrs[i][0] == static_cast<char>(i % 200 + 1));
+    }
+
+    // 超过一个span的大块与高对齐要求
+    void* big = arena.allocate(1024 * 1024, 4096);
+    assert((reinterpret_cast<uintptr_t>(big) & 4095) == 0);
+    memset(big, 0, 1024 * 1024);
+
+    assert(arena.getBytesAllocated() > 0);
+    arena.reset();
+    assert(arena.getBytesAllocated() == 0);
+  }
+
+  // 0字节的分配同样返回有效地址 包括新建与reset后的区域
+  Arena empty;
+  [[maybe_unused]] void* zero = empty.allocate(0);
+  [[maybe_unused]] void* next = empty.allocate(0);
+  assert(zero != nullptr && next != nullptr && next != zero);
+  empty.reset();
+  zero = empty.allocate(0);
+  assert(zero != nullptr);
+  // 加上对齐与span头后溢出的大小返回nullptr
+  for (size_t size : {SIZE_MAX, SIZE_MAX - 8, SIZE_MAX - 4096 - 100}) {
+    [[maybe_unused]] void* huge = empty.allocate(size);
+    assert(huge == nullptr);
+  }
+
+  // 作为pmr的memory_resource
+  ArenaMemoryResource resource(arena);
+  zero = resource.allocate(0);
+  assert(zero != nullptr);
+  std::pmr::vector<std::pmr::string> strings(&resource);
+  for (int i = 0; i < 1000; i++) {
+    strings.emplace_back(std::to_string(i) + " a string long enough to spill");
+  }
+  assert(strings[999].compare(0, 3, "999") == 0);
+
+  std::cout << "Arena test passed!" << std::endl;
+}
+
+void testHeap() {
+  std::cout << "Running heap test..." << std::endl;
+
+  {
+    Heap heap;
+    std::vector<std::pair<void*, size_t>> ptrs;
+    for (size_t i = 0; i < 1000; i++) {
+      size_t size = (i * 37) % 4096 + 1;
+      void* ptr = heap.allocate(size);
+      assert(ptr != nullptr);
+      memset(ptr, 0xCD, size);
+      ptrs.push_back({ptr, size});
+    }
+    void* large = heap.allocate(1024 * 1024);
+    assert(large != nullptr);
+    memset(large, 0, 1024 * 1024);
+
+    HeapStats stats = heap.getStats();
+    assert(stats.allocCount == 1001);
+    assert(stats.liveBytes >= 1024 * 1024);
+    assert(stats.mappedBytes >= stats.liveBytes);
+
+    for (size_t i = 0; i < ptrs.size(); i += 2) {
+      heap.deallocate(ptrs[i].first, ptrs[i].second);
+    }
+    heap.deallocate(large);
+    stats = heap.getStats();
+    assert(stats.freeCount == 501);
+    // 页数会溢出的大小不会拿到刚释放的span
+    [[maybe_unused]] void* huge = heap.allocate(SIZE_MAX - 100);
+    assert(huge == nullptr);
+
+    // 多个线程共享同一个堆 剩余的块由destroy统一回收
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+      threads.emplace_back([&heap]() {
+        std::vector<void*> local;
+        for (int i = 0; i < 2000; i++) {
+          void* ptr = heap.allocate(i % 512 + 1);
+          assert(ptr != nullptr);
+          local.push_back(ptr);
+          if (i % 3 == 0) {
+            heap.deallocate(local.back());
+            local.pop_back();
+          }
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    assert(heap.getStats().allocCount == 1001 + 4 * 2000);
+  }
+
+  // 内存上限
+  Heap limited(4 * 1024 * 1024);
+  std::vector<void*> blocks;
+  void* ptr;
+  while ((ptr = limited.allocate(64 * 1024)) != nullptr) {
+    blocks.push_back(ptr);
+  }
+  assert(!blocks.empty());
+  assert(limited.getStats().mappedBytes <= 4 * 1024 * 1024);
+  limited.deallocate(blocks.back(), 64 * 1024);
+  blocks.pop_back();
+  ptr = limited.allocate(64 * 1024);
+  assert(ptr != nullptr);
+  blocks.push_back(ptr);
+  // 达到上限时其他线程仍能释放 线程缓存不计入上限
+  void* last = blocks.back();
+  blocks.pop_back();
+  std::thread([&limited, last] { limited.deallocate(last, 64 * 1024); })
+      .join();
+  ptr = limited.allocate(64 * 1024);
+  assert(ptr != nullptr);
+  blocks.push_back(ptr);
+  for (void* block : blocks) limited.deallocate(block, 64 * 1024);
+  limited.destroy();
+
+  // 上限很小的堆也能分配
+  Heap tiny(1024 * 1024);
+  void* small = tiny.allocate(4096);
+  assert(small != nullptr);
+  tiny.deallocate(small, 4096);
+  tiny.destroy();
+
+  // 同时使用的堆多于线程缓存表容量
+  std::vector<std::unique_ptr<Heap>> heaps;
+  for (int i = 0; i < 12; i++) {
+    heaps.emplace_back(new Heap());
+  }
+  for (int round = 0; round < 3; round++) {
+    for (auto& heap : heaps) {
+      void* block = heap->allocate(128);
+      assert(block != nullptr);
+      heap->deallocate(block, 128);
+    }
+  }
+  heaps.clear();
+
+  std::cout << "Heap test passed!" << std::endl;
+}
+
+void testStats() {
+  std::cout << "Running stats test..." << std::endl;
+
+  PoolStats before = MemoryPool::getStats();
+  auto findClass = [](const PoolStats& stats, size_t size) {
+    for (const SizeClassStats& cls : stats.sizeClasses) {
+      if (cls.size == size) return cls;
+    }
+    return SizeClassStats{};
+  };
+
+  // 选一个其他测试不用的大小类
+  const size_t size = 1000;
+  std::vector<void*> ptrs;
+  for (int i = 0; i < 100; i++) {
+    ptrs.push_back(MemoryPool::allocate(size));
+  }
+  for (int i = 0; i < 40; i++) {
+    MemoryPool::deallocate(ptrs[i], size);
+  }
+  void* large = MemoryPool::allocate(MAX_BYTES + 1);
+  MemoryPool::deallocate(large, MAX_BYTES + 1);
+
+  PoolStats after = MemoryPool::getStats();
+  [[maybe_unused]] SizeClassStats oldClass = findClass(before, size);
+  [[maybe_unused]] SizeClassStats newClass = findClass(after, size);
+  assert(newClass.allocCount - oldClass.allocCount == 100);
+  assert(newClass.freeCount - oldClass.freeCount == 40);
+  assert(newClass.spanBytes > 0);
+  // 释放的块留在线程缓存或中心缓存中
+  assert(newClass.threadCacheBytes + newClass.centralCacheBytes >=
+         40 * size);
+  assert(after.largeAllocCount == before.largeAllocCount + 1);
+  assert(after.largeFreeCount == before.largeFreeCount + 1);
+  assert(after.pageCache.mappedBytes >= newClass.spanBytes);
+
+  // 线程退出后计数并入汇总 缓存的块归还中心缓存
+  std::thread([size]() {
+    void* ptr = MemoryPool::allocate(size);
+    MemoryPool::deallocate(ptr, size);
+  }).join();
+  PoolStats joined = MemoryPool::getStats();
+  assert(findClass(joined, size).allocCount == newClass.allocCount + 1);
+
+  for (int i = 40; i < 100; i++) {
+    MemoryPool::deallocate(ptrs[i], size);
+  }
+
+  FILE* out = tmpfile();
+  joined.dumpText(out);
+  joined.dumpJson(out);
+  assert(ftell(out) > 0);
+  fclose(out);
+
+  std::cout << "Stats test passed!" << std::endl;
+}
+
+// 读出整个文件内容
+static std::string readFile(const char* path) {
+  std::string content;
+  FILE* file = fopen(path, "r");
+  if (!file) return content;
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+    content.append(buf, n);
+  }
+  fclose(file);
+  return content;
+}
+
+void testHeapProfiler() {
+  std::cout << "Running heap profiler test..." << std::endl;
+
+  // 采样间隔为1字节时几乎每次分配都会被采样
+  HeapProfiler::start(1);
+  std::vector<void*> ptrs;
+  for (int i = 0; i < 100; i++) {
+    void* ptr = MemoryPool::allocate(100);
+    memset(ptr, 0, 100);
+    ptrs.push_back(ptr);
+  }
+  char path[] = "/tmp/memory_pool_heap_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  [[maybe_unused]] bool ok = HeapProfiler::dump(fd);
+  assert(ok);
+  close(fd);
+
+  std::string profile = readFile(path);
+  assert(profile.compare(0, 13, "heap profile:") == 0);
+  assert(profile.find("@ heap_v2/1\n") != std::string::npos);
+  assert(profile.find("MAPPED_LIBRARIES:") != std::string::npos);
+  [[maybe_unused]] size_t liveCount = std::stoul(profile.substr(13));
+  assert(liveCount >= 90);
+
+  // 采样的内存释放后不再计入在用 批量释放同样记录
+  MemoryPool::deallocateBatch(ptrs.data(), 50, 100);
+  // 采样的span已归还页缓存 不再属于任何块
+  assert(PageCache::getObjectSize(ptrs[0]) == 0);
+  for (size_t i = 50; i < ptrs.size(); i++) {
+    MemoryPool::deallocate(ptrs[i], 100);
+  }
+  HeapProfiler::stop();
+  ok = HeapProfiler::dump(path);
+  assert(ok);
+  profile = readFile(path);
+  assert(std::stoul(profile.substr(13)) == 0);
+  unlink(path);
+
+  // 停止后不再采样 释放后的span可以正常复用
+  void* ptr = MemoryPool::allocate(100);
+  assert(MemoryPool::getUsableSize(ptr) == 104);
+  MemoryPool::deallocate(ptr);
+
+  std::cout << "Heap profiler test passed!" << std::endl;
+}
+
+void testLockProfiler() {
+  std::cout << "Running lock profiler test..." << std::endl;
+
+  // 未开启时不记录
+  assert(!LockProfiler::isEnabled());
+  assert(MemoryPool::getStats().centralLocks.empty());
+
+  [[maybe_unused]] bool started = LockProfiler::start();
+  assert(started);
+  // 大块的批量小, 每个线程都频繁访问中心缓存
+  const size_t size = 48 * 1024;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([size]() {
+      for (int round = 0; round < 50; round++) {
+        void* ptrs[16];
+        for (void*& ptr : ptrs) ptr = MemoryPool::allocate(size);
+        for (void* ptr : ptrs) MemoryPool::deallocate(ptr, size);
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  LockProfiler::stop();
+
+  PoolStats stats = MemoryPool::getStats();
+  assert(stats.pageCacheLock.acquisitions > 0);
+  [[maybe_unused]] const LockContentionStats* cls = nullptr;
+  for (size_t i = 0; i < stats.centralLocks.size(); i++) {
+    const LockContentionStats& lock = stats.centralLocks[i];
+    if (i > 0) assert(stats.centralLocks[i - 1].waitNs >= lock.waitNs);
+    if (lock.size == size) cls = &lock;
+    // 每次加锁在两个直方图中各计一次
+    uint64_t waits = 0, holds = 0;
+    for (size_t b = 0; b < LockContentionStats::BUCKETS; b++) {
+      waits += lock.waitHistogram[b];
+      holds += lock.holdHistogram[b];
+    }
+    assert(waits == lock.acquisitions && holds == lock.acquisitions);
+    assert(lock.contended <= lock.acquisitions);
+  }
+  assert(cls && cls->acquisitions > 0 && cls->holdNs > 0);
+
+  // 关闭后计数不再变化
+  [[maybe_unused]] uint64_t acquisitions = stats.pageCacheLock.acquisitions;
+  void* ptr = MemoryPool::allocate(MAX_BYTES + 1);
+  MemoryPool::deallocate(ptr, MAX_BYTES + 1);
+  assert(MemoryPool::getStats().pageCacheLock.acquisitions == acquisitions);
+
+  FILE* out = tmpfile();
+  stats.dumpText(out);
+  stats.dumpJson(out);
+  assert(ftell(out) > 0);
+  fclose(out);
+
+  std::cout << "Lock profiler test passed!" << std::endl;
+}
+
+void testHeapWalk() {
+  std::cout << "Running heap walk test..." << std::endl;
+
+  // 选一个其他测试不用的大小类
+  const size_t size = 3000;
+  std::vector<void*> ptrs;
+  for (int i = 0; i < 100; i++) {
+    ptrs.push_back(MemoryPool::allocate(size));
+  }
+  for (int i = 0; i < 40; i++) {
+    MemoryPool::deallocate(ptrs[i], size);
+  }
+  void* large = MemoryPool::allocate(MAX_BYTES + 1);
+
+  HeapReport report = MemoryPool::walkHeap();
+  [[maybe_unused]] const SizeClassFragmentation* cls = nullptr;
+  for (const SizeClassFragmentation& c : report.sizeClasses) {
+    if (c.size == size) cls = &c;
+  }
+  // 释放的块在本线程缓存或中心缓存中 都能被遍历到
+  assert(cls && cls->liveBlocks == 60);
+  assert(cls->blocks >= 100);
+  assert(cls->freeBytes == (cls->blocks - 60) * size);
+  assert(cls->tailBytes == cls->spanBytes - cls->blocks * size);
+
+  [[maybe_unused]] bool foundLarge = false;
+  size_t spanBlocks = 0, utilized = 0, smallSpans = 0;
+  for (size_t i = 0; i < report.spans.size(); i++) {
+    const SpanInfo& span = report.spans[i];
+    if (i > 0) assert(report.spans[i - 1].address < span.address);
+    assert(span.liveBlocks + span.freeBlocks == span.blockCount);
+    if (span.address == reinterpret_cast<uintptr_t>(large)) {
+      foundLarge = !span.free && span.blockCount == 1 && span.liveBlocks == 1;
+    }
+    if (span.objSize == size && !span.free) spanBlocks += span.blockCount;
+    if (!span.free && span.objSize && !span.sampled) smallSpans++;
+  }
+  for (size_t count : report.utilization) utilized += count;
+  assert(foundLarge);
+  assert(spanBlocks == cls->blocks);
+  assert(utilized == smallSpans);
+  assert(report.largestFreeSpanBytes <= report.freeSpanBytes);
+  assert(report.externalFragmentation >= 0 &&
+         report.externalFragmentation <= 1);
+
+  FILE* out = tmpfile();
+  MemoryPool::dumpHeap(out);
+  MemoryPool::dumpHeapJson(out);
+  assert(ftell(out) > 0);
+  fclose(out);
+
+  MemoryPool::deallocate(large, MAX_BYTES + 1);
+  for (int i = 40; i < 100; i++) {
+    MemoryPool::deallocate(ptrs[i], size);
+  }
+  std::cout << "Heap walk test passed!" << std::endl;
+}
+
+void testLatencyStats() {
+  std::cout << "Running latency stats test..." << std::endl;
+
+  PoolStats before = MemoryPool::getStats();
+#ifdef MEMORY_POOL_LATENCY_STATS
+  const size_t size = 5000;
+  std::vector<void*> ptrs;
+  for (int i = 0; i < 1000; i++) ptrs.push_back(MemoryPool::allocate(size));
+  for (void* ptr : ptrs) MemoryPool::deallocate(ptr, size);
+  void* large = MemoryPool::allocate(MAX_BYTES + 1);
+  MemoryPool::deallocate(large, MAX_BYTES + 1);
+
+  PoolStats after = MemoryPool::getStats();
+  assert(after.latency.enabled && after.latency.cyclesPerNs > 0);
+  size_t group = ThreadLatency::sizeGroup(size);
+  size_t largeGroup = LATENCY_SIZE_GROUPS - 1;
+  for (size_t op = 0; op < OP_COUNT; op++) {
+    const LatencySummary& now = after.latency.bySize[op][group];
+    assert(now.count - before.latency.bySize[op][group].count == 1000);
+    assert(after.latency.bySize[op][largeGroup].count -
+               before.latency.bySize[op][largeGroup].count ==
+           1);
+    assert(now.p50 <= now.p99 && now.p99 <= now.p999);
+    // 按层级与按大小分组的总数相同
+    uint64_t byTier = 0, bySize = 0;
+    for (const LatencySummary& tier : after.latency.byTier[op]) {
+      byTier += tier.count;
+    }
+    for (const LatencySummary& sizes : after.latency.bySize[op]) {
+      bySize += sizes.count;
+    }
+    assert(byTier == bySize);
+  }
+  // 大块分配至少经过页缓存
+  assert(after.latency.byTier[OP_ALLOCATE][TIER_PAGE_CACHE].count +
+             after.latency.byTier[OP_ALLOCATE][TIER_SYSTEM].count >
+         before.latency.byTier[OP_ALLOCATE][TIER_PAGE_CACHE].count +
+             before.latency.byTier[OP_ALLOCATE][TIER_SYSTEM].count);
+  assert(after.latency.byTier[OP_ALLOCATE][TIER_THREAD_CACHE].count > 0);
+
+  FILE* out = tmpfile();
+  after.dumpText(out);
+  after.dumpJson(out);
+  assert(ftell(out) > 0);
+  fclose(out);
+#else
+  assert(!before.latency.enabled);
+#endif
+
+  std::cout << "Latency stats test passed!" << std::endl;
+}
+
+// 在子进程中执行action 异常终止时返回true, 标准错误输出读到output
+// 在sanitizer下再次触发的错误由其处理函数以退出码结束进程
+static bool crashesInChild(const std::function<void()>& action,
+                      std::string* output) {
+  int fds[2];
+  [[maybe_unused]] int piped = pipe(fds);
+  assert(piped == 0);
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if (pid == 0) {
+    dup2(fds[1], STDERR_FILENO);
+    close(fds[0]);
+    action();
+    _exit(0);
+  }
+  close(fds[1]);
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(fds[0], buf, sizeof(buf))) > 0) output->append(buf, n);
+  close(fds[0]);
+  int status = 0;
+  waitpid(pid, &status, 0);
+  return WIFSIGNALED(status) || WEXITSTATUS(status) != 0;
+}
+
+void testGuardedPool() {
+  std::cout << "Running guarded pool test..." << std::endl;
+
+  assert(!GuardedPool::contains(nullptr));
+  // 采样率为1时每次分配都放入槽位
+  [[maybe_unused]] bool enabled = GuardedPool::enable(1, 4);
+  assert(enabled);
+  char* ptr = static_cast<char*>(MemoryPool::allocate(100));
+  assert(GuardedPool::contains(ptr));
+  // 块尾紧贴保护页
+  assert((reinterpret_cast<uintptr_t>(ptr) + 104) % 4096 == 0);
+  assert(MemoryPool::getUsableSize(ptr) == 104);
+  memset(ptr, 0xab, 104);
+
+  std::string output;
+  [[maybe_unused]] bool crashed =
+      crashesInChild([ptr] { ptr[104] = 1; }, &output);
+  assert(crashed);
+  assert(output.find("buffer-overflow") != std::string::npos);
+  assert(output.find("allocated by thread") != std::string::npos);
+
+  // 不带大小的释放也能识别槽位
+  MemoryPool::deallocate(ptr);
+  output.clear();
+  crashed = crashesInChild([ptr] { ptr[0] = 1; }, &output);
+  assert(crashed);
+  assert(output.find("use-after-free") != std::string::npos);
+  assert(output.find("freed by thread") != std::string::npos);
+
+  output.clear();
+  crashed =
+      crashesInChild([ptr] { MemoryPool::deallocate(ptr, 100); }, &output);
+  assert(crashed);
+  assert(output.find("double-free") != std::string::npos);
+
+  // 槽位用尽后退回普通分配 刚释放的槽位最后才复用
+  std::vector<void*> ptrs;
+  for (int i = 0; i < 5; i++) ptrs.push_back(MemoryPool::allocate(64));
+  for (int i = 0; i < 4; i++) {
+    assert(GuardedPool::contains(ptrs[i]));
+    assert(PageCache::getObjectSize(ptrs[i]) == 64);
+  }
+  assert(ptrs[3] == ptr + 104 - 64);
+  assert(!GuardedPool::contains(ptrs[4]));
+  for (void* p : ptrs) MemoryPool::deallocate(p, 64);
+
+  // 批量释放中的槽位同样经过GuardedPool 释放后仍不可访问
+  void* batch[2] = {MemoryPool::allocate(64), nullptr};
+  GuardedPool::disable();
+  batch[1] = MemoryPool::allocate(64);
+  assert(GuardedPool::contains(batch[0]) && !GuardedPool::contains(batch[1]));
+  MemoryPool::deallocateBatch(batch, 2, 64);
+  char* freed = static_cast<char*>(batch[0]);
+  output.clear();
+  crashed = crashesInChild([freed] { freed[0] = 1; }, &output);
+  assert(crashed);
+  assert(output.find("use-after-free") != std::string::npos);
+
+  void* normal = MemoryPool::allocate(64);
+  assert(!GuardedPool::contains(normal));
+  MemoryPool::deallocate(normal, 64);
+
+  std::cout << "Guarded pool test passed!" << std::endl;
+}
+
+void testTraceRecorder() {
+  std::cout << "Running trace recorder test..." << std::endl;
+
+  char path[] = "/tmp/memory_pool_trace_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  close(fd);
+  [[maybe_unused]] bool ok = TraceRecorder::start(path);
+  assert(ok);
+  void* a = MemoryPool::allocate(48);
+  void* b = MemoryPool::allocateAligned(100, 64);
+  void* c = MemoryPool::reallocate(a, 48, 1000);
+  // 另一个线程释放 记录在该线程自己的缓冲区中
+  std::thread([b] { MemoryPool::deallocateAligned(b, 100, 64); }).join();
+  MemoryPool::deallocate(c);
+  TraceRecorder::stop();
+  // 停止后不再记录
+  MemoryPool::deallocate(MemoryPool::allocate(48), 48);
+
+  std::vector<TraceEvent> events;
+  ok = TraceRecorder::load(path, &events);
+  assert(ok);
+  unlink(path);
+  assert(events.size() == 6);
+  for (size_t i = 1; i < events.size(); i++) {
+    assert(events[i - 1].timestamp <= events[i].timestamp);
+  }
+  [[maybe_unused]] auto at = [&](size_t i, TraceOp op, const void* ptr,
+                                 uint64_t size) {
+    return events[i].op == op &&
+           events[i].object == reinterpret_cast<uintptr_t>(ptr) &&
+           events[i].size == size;
+  };
+  assert(at(0, TRACE_ALLOCATE, a, 48) && events[0].align == 0);
+  assert(at(1, TRACE_ALLOCATE, b, 100) && events[1].align == 64);
+  assert(at(2, TRACE_REALLOC_FROM, a, 48));
+  assert(at(3, TRACE_REALLOC_TO, c, 1000));
+  assert(at(4, TRACE_FREE, b, 100) && events[4].thread != events[0].thread);
+  assert(at(5, TRACE_FREE, c, 0) && events[5].thread == events[0].thread);
+
+  // 超过一个缓冲区的记录分块写出
+  ok = TraceRecorder::start(path);
+  assert(ok);
+  for (size_t i = 0; i < TraceRecorder::BUFFER_RECORDS; i++) {
+    MemoryPool::deallocate(MemoryPool::allocate(16), 16);
+  }
+  TraceRecorder::stop();
+  events.clear();
+  ok = TraceRecorder::load(path, &events);
+  assert(ok);
+  assert(events.size() == 2 * TraceRecorder::BUFFER_RECORDS);
+  unlink(path);
+
+  std::cout << "Trace recorder test passed!" << std::endl;
+}
+
+void testForkSafety() {
+  std::cout << "Running fork safety test..." << std::endl;
+
+  // 其他线程不断经过各层加锁时fork 子进程的分配不能卡在fork前被持有的锁上
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> workers;
+  Heap heap;
+  for (int t = 0; t < 4; t++) {
+    workers.emplace_back([&stop, &heap, t] {
+      std::mt19937 rng(t);
+      std::vector<std::pair<void*, size_t>> live;
+      while (!stop.load()) {
+        size_t size = size_t(1) << (rng() % 19);
+        live.emplace_back(MemoryPool::allocate(size), size);
+        void* p = heap.allocate(size);
+        heap.deallocate(p, size);
+        if (live.size() > 64) {
+          for (auto& [ptr, n] : live) MemoryPool::deallocate(ptr, n);
+          live.clear();
+        }
+      }
+      for (auto& [ptr, n] : live) MemoryPool::deallocate(ptr, n);
+    });
+  }
+  std::string output;
+  for (int i = 0; i < 50; i++) {
+    // 死锁时由SIGALRM结束子进程
+    [[maybe_unused]] bool crashed = crashesInChild(
+        [&heap] {
+          alarm(10);
+          for (size_t size = 8; size <= 1024 * 1024; size *= 2) {
+            MemoryPool::deallocate(MemoryPool::allocate(size), size);
+            heap.deallocate(heap.allocate(size), size);
+          }
+          PoolStats::collect();
+        },
+        &output);
+    assert(!crashed);
+  }
+  stop.store(true);
+  for (std::thread& t : workers) t.join();
+
+  // 其他线程缓存中的块在子进程中归还中心缓存, 堆的线程缓存可被新线程复用
+  constexpr size_t SIZE = 6008;
+  constexpr size_t COUNT = 100;
+  Heap forkHeap;
+  std::atomic<bool> cached{false};
+  std::atomic<bool> done{false};
+  std::thread holder([&] {
+    std::vector<void*> ptrs;
+    for (size_t i = 0; i < COUNT; i++) {
+      ptrs.push_back(MemoryPool::allocate(SIZE));
+    }
+    for (void* p : ptrs) MemoryPool::deallocate(p, SIZE);
+    forkHeap.deallocate(forkHeap.allocate(SIZE), SIZE);
+    cached.store(true);
+    while (!done.load()) std::this_thread::yield();
+  });
+  while (!cached.load()) std::this_thread::yield();
+  auto threadCacheBytes = [] {
+    for (const SizeClassStats& cls : PoolStats::collect().sizeClasses) {
+      if (cls.size == SIZE) return cls.threadCacheBytes;
+    }
+    return size_t(0);
+  };
+  // 当前线程的缓存中可能留有之前测试的同样大小的块
+  size_t before = threadCacheBytes();
+  assert(before >= COUNT * SIZE);
+  [[maybe_unused]] bool crashed = crashesInChild(
+      [&] {
+        if (before - threadCacheBytes() != COUNT * SIZE) _exit(1);
+        std::thread([&] {
+          forkHeap.deallocate(forkHeap.allocate(SIZE), SIZE);
+        }).join();
+        if (forkHeap.getStats().threadCaches != 1) _exit(1);
+      },
+      &output);
+  assert(!crashed);
+  done.store(true);
+  holder.join();
+
+  std::cout << "Fork safety test passed!" << std::endl;
+}
+
+void testReserve() {
+  std::cout << "Running reserve test..." << std::endl;
+
+  auto mappedBytes = [] { return PoolStats::collect().pageCache.mappedBytes; };
+  auto cachedBytes = [](size_t size, bool threadCache) {
+    for (const SizeClassStats& cls : PoolStats::collect().sizeClasses) {
+      if (cls.size == size) {
+        return threadCache ? cls.threadCacheBytes : cls.centralCacheBytes;
+      }
+    }
+    return size_t(0);
+  };
+
+  // 预留的块已切分到中心缓存 之后的分配不再向系统申请
+  constexpr size_t SIZE = 3336;
+  constexpr size_t COUNT = 500;
+  [[maybe_unused]] size_t before = mappedBytes();
+  [[maybe_unused]] bool ok = MemoryPool::reserve(SIZE, COUNT);
+  assert(ok);
+  [[maybe_unused]] size_t reserved = mappedBytes();
+  assert(reserved > before);
+  assert(cachedBytes(SIZE, false) >= COUNT * SIZE);
+  std::vector<void*> ptrs;
+  for (size_t i = 0; i < COUNT; i++) {
+    ptrs.push_back(MemoryPool::allocate(SIZE));
+  }
+  assert(mappedBytes() == reserved);
+  for (void* p : ptrs) MemoryPool::deallocate(p, SIZE);
+
+  // 填入线程缓存的部分不超过THREAD_HOLD
+  constexpr size_t SMALL = 72;
+  [[maybe_unused]] size_t cached = cachedBytes(SMALL, true);
+  ok = MemoryPool::reserve(SMALL, 1000, true);
+  assert(ok);
+  [[maybe_unused]] size_t filled = cachedBytes(SMALL, true);
+  assert(filled > cached && filled <= THREAD_HOLD * SMALL);
+
+  // 大块在页缓存中预留 分配时从预留的页切分
+  constexpr size_t LARGE = 300 * 1024;
+  ok = MemoryPool::reserve(LARGE, 4);
+  assert(ok);
+  reserved = mappedBytes();
+  ptrs.clear();
+  for (int i = 0; i < 4; i++) ptrs.push_back(MemoryPool::allocate(LARGE));
+  assert(mappedBytes() == reserved);
+  for (void* p : ptrs) MemoryPool::deallocate(p, LARGE);
+
+  ok = MemoryPool::warmUp("1000:10,2000:5");
+  assert(ok);
+  ok = MemoryPool::warmUp("");
+  assert(ok);
+  ok = MemoryPool::warmUp("1000");
+  assert(!ok);
+  ok = MemoryPool::warmUp("1000:10;2000:5");
+  assert(!ok);
+
+  // 超过独立堆的内存上限时失败
+  Heap heap(1024 * 1024);
+  ok = heap.reserve(LARGE, 10);
+  assert(!ok);
+
+  std::cout << "Reserve test passed!" << std::endl;
+}
+
+// 回调释放调用方缓存的大块
+void releaseHeldBlock(size_t, void* context) {
+  auto* held = static_cast<std::pair<void*, size_t>*>(context);
+  MemoryPool::deallocate(held->first, held->second);
+  held->first = nullptr;
+}
+
+void testMemoryPressure() {
+  std::cout << "Running memory pressure test..." << std::endl;
+
+  auto committedBytes = [] {
+    PageCacheStats pages = PoolStats::collect().pageCache;
+    return pages.mappedBytes - pages.releasedBytes;
+  };
+  PageCache& pageCache = PageCache::getInstance();
+
+  // 空闲页归还后映射仍保留 重新分配时得到清零的页
+  constexpr size_t LARGE = 1024 * 1024;
+  [[maybe_unused]] bool ok = MemoryPool::reserve(LARGE, 4);
+  assert(ok);
+  [[maybe_unused]] size_t released = pageCache.releaseFreeSpans();
+  assert(released >= 4 * LARGE);
+  assert(PoolStats::collect().pageCache.releasedBytes >= released);
+  [[maybe_unused]] size_t again = pageCache.releaseFreeSpans();
+  assert(again == 0);
+  char* large = static_cast<char*>(MemoryPool::allocate(LARGE));
+  assert(large && large[0] == 0 && large[LARGE - 1] == 0);
+  assert(PoolStats::collect().pageCache.releasedBytes <= released - LARGE);
+  memset(large, 1, LARGE);
+  MemoryPool::deallocate(large, LARGE);
+  pageCache.releaseFreeSpans();
+
+  // 线程缓存中的块占满上限 分级回收后大块分配成功
+  constexpr size_t SMALL = 16 * 1024;
+  std::vector<void*> ptrs;
+  for (int i = 0; i < 100; i++) ptrs.push_back(MemoryPool::allocate(SMALL));
+  for (void* p : ptrs) MemoryPool::deallocate(p, SMALL);
+  MemoryPressureStats before = PoolStats::collect().pressure;
+  MemoryPool::setMemoryLimit(committedBytes());
+  large = static_cast<char*>(MemoryPool::allocate(LARGE));
+  assert(large);
+  MemoryPressureStats after = PoolStats::collect().pressure;
+  assert(after.memoryLimit > 0);
+  assert(after.limitHits == before.limitHits + 1);
+  assert(after.threadCacheFlushes > before.threadCacheFlushes);
+  assert(after.failures == before.failures);
+  assert(committedBytes() <= after.memoryLimit);
+
+  // 各级缓存都无可回收时调用回调 由调用方释放自己持有的内存
+  constexpr size_t HUGE = 2 * LARGE;
+  std::pair<void*, size_t> held(MemoryPool::allocate(HUGE), HUGE);
+  assert(held.first);
+  MemoryPool::setMemoryLimit(committedBytes());
+  MemoryPool::setPressureCallback(releaseHeldBlock, &held);
+  before = PoolStats::collect().pressure;
+  void* huge = MemoryPool::allocate(HUGE);
+  after = PoolStats::collect().pressure;
+  assert(huge && !held.first);
+  assert(after.callbacks == before.callbacks + 1);
+  assert(after.pageReleases > before.pageReleases);
+  assert(after.failures == before.failures);
+
+  // 全部阶段之后仍不足时失败
+  MemoryPool::setPressureCallback(nullptr);
+  before = PoolStats::collect().pressure;
+  [[maybe_unused]] void* failed = MemoryPool::allocate(HUGE);
+  assert(failed == nullptr);
+  after = PoolStats::collect().pressure;
+  assert(after.failures == before.failures + 1);
+  assert(after.callbacks == before.callbacks);
+
+  MemoryPool::setMemoryLimit(0);
+  assert(PoolStats::collect().pressure.memoryLimit == 0);
+  MemoryPool::deallocate(huge, HUGE);
+  MemoryPool::deallocate(large, LARGE);
+
+  std::cout << "Memory pressure test passed!" << std::endl;
+}
+
+void testRealTime() {
+  std::cout << "Running real time test..." << std::endl;
+
+  [[maybe_unused]] bool ok = MemoryPool::enterRealTime();
+  assert(!ok);
+  ok = MemoryPool::enableRealTime(4 * 1024 * 1024);
+  assert(ok);
+  ok = MemoryPool::enableRealTime(4 * 1024 * 1024);
+  assert(!ok);
+  RealTimeStats stats = PoolStats::collect().realTime;
+  assert(stats.regionBytes > 0 && stats.regionBytes <= 4 * 1024 * 1024);
+
+  auto cachedBytes = [](size_t size, bool threadCache) {
+    for (const SizeClassStats& cls : PoolStats::collect().sizeClasses) {
+      if (cls.size == size) {
+        return threadCache ? cls.threadCacheBytes : cls.centralCacheBytes;
+      }
+    }
+    return size_t(0);
+  };
+
+  // 进入实时模式前的分配仍来自普通路径
+  void* normal = MemoryPool::allocate(64);
+  assert(!RealTimePool::contains(normal));
+  constexpr size_t NORMAL_SIZE = 920;
+  std::vector<void*> normals;
+  for (size_t i = 0; i < THREAD_HOLD + 10; i++) {
+    normals.push_back(MemoryPool::allocate(NORMAL_SIZE));
+  }
+  ok = MemoryPool::enterRealTime();
+  assert(ok);
+  assert(PoolStats::collect().realTime.threads == 1);
+
+  // 实时模式下的分配都来自锁定区域 不再向系统申请
+  [[maybe_unused]] size_t mapped = PoolStats::collect().pageCache.mappedBytes;
+  std::vector<std::pair<void*, size_t>> blocks;
+  for (size_t size : {1, 8, 24, 100, 4096, 70000, 300 * 1024}) {
+    void* p = MemoryPool::allocate(size);
+    assert(p && RealTimePool::contains(p));
+    assert(reinterpret_cast<uintptr_t>(p) % ALIGNMENT == 0);
+    assert(MemoryPool::getUsableSize(p) >= size);
+    memset(p, 0xab, size);
+    blocks.emplace_back(p, size);
+  }
+  void* aligned = MemoryPool::allocateAligned(100, 4096);
+  assert(RealTimePool::contains(aligned));
+  assert(reinterpret_cast<uintptr_t>(aligned) % 4096 == 0);
+  MemoryPool::deallocateAligned(aligned, 100, 4096);
+  assert(PoolStats::collect().pageCache.mappedBytes == mapped);
+
+  // 释放后同一大小立即复用 不带大小的释放同样识别实时区域的块
+  void* p = MemoryPool::allocate(48);
+  MemoryPool::deallocate(p);
+  void* reused = MemoryPool::allocate(48);
+  assert(reused == p);
+
+  // 重新分配 块仍放得下时原地返回, 否则复制到新块
+  char* text = static_cast<char*>(MemoryPool::reallocate(p, 48, 52));
+  assert(text == p);
+  strcpy(text, "real time");
+  text = static_cast<char*>(MemoryPool::reallocate(text, 52, 1000));
+  assert(RealTimePool::contains(text) && strcmp(text, "real time") == 0);
+  MemoryPool::deallocate(text, 1000);
+  // 实时线程释放进入实时模式前的普通块 超过THREAD_HOLD也不归还中心缓存
+  MemoryPool::deallocate(normal, 64);
+  [[maybe_unused]] size_t central = cachedBytes(NORMAL_SIZE, false);
+  for (void* q : normals) MemoryPool::deallocate(q, NORMAL_SIZE);
+  assert(cachedBytes(NORMAL_SIZE, false) == central);
+  assert(cachedBytes(NORMAL_SIZE, true) >= normals.size() * NORMAL_SIZE);
+
+  // 对象池在实时线程中同样只从锁定区域分配
+  {
+    PooledPtr<std::pair<int, double>> pooled =
+        make_pooled<std::pair<int, double>>(1, 2.0);
+    assert(RealTimePool::contains(pooled.get()));
+    assert(pooled->first == 1 && pooled->second == 2.0);
+  }
+  assert(PoolStats::collect().pageCache.mappedBytes == mapped);
+
+  // 其他线程释放的块压入远程链表 所属线程之后取回
+  void* remote = MemoryPool::allocate(200);
+  std::thread([remote] {
+    void* local = MemoryPool::allocate(200);
+    assert(!RealTimePool::contains(local));
+    MemoryPool::deallocate(local, 200);
+    MemoryPool::deallocate(remote, 200);
+  }).join();
+  reused = MemoryPool::allocate(200);
+  assert(reused == remote);
+  MemoryPool::deallocate(remote, 200);
+
+  // 区域用尽时返回nullptr 释放后可以再次分配
+  [[maybe_unused]] size_t failures = PoolStats::collect().realTime.failures;
+  std::vector<void*> large;
+  while (void* q = MemoryPool::allocate(100000)) large.push_back(q);
+  assert(!large.empty());
+  stats = PoolStats::collect().realTime;
+  assert(stats.failures == failures + 1);
+  assert(stats.usedBytes <= stats.regionBytes);
+  reused = MemoryPool::allocate(stats.regionBytes * 2);
+  assert(reused == nullptr);
+  for (void* q : large) MemoryPool::deallocate(q);
+  reused = MemoryPool::allocate(100000);
+  assert(reused == large.back());
+  MemoryPool::deallocate(reused);
+  for (auto& [block, size] : blocks) MemoryPool::deallocate(block, size);
+
+  // 退出后的状态由新进入的线程接管 其中的空闲块可以继续使用
+  MemoryPool::leaveRealTime();
+  // 推迟的普通块在退出时归还
+  assert(cachedBytes(NORMAL_SIZE, true) <= THREAD_HOLD * NORMAL_SIZE);
+  p = MemoryPool::allocate(48);
+  assert(!RealTimePool::contains(p));
+  MemoryPool::deallocate(p, 48);
+  std::thread([] {
+    [[maybe_unused]] bool entered = MemoryPool::enterRealTime();
+    assert(entered);
+    void* q = MemoryPool::allocate(100000);
+    assert(q && RealTimePool::contains(q));
+    MemoryPool::deallocate(q, 100000);
+  }).join();
+  assert(PoolStats::collect().realTime.threads == 0);
+
+  std::cout << "Real time test passed!" << std::endl;
+}
+
 int main() {
   testBasicAllocation();
   testMemoryWriting();
   testMultiThreading();
   testEdgeCases();
   testStress();
+  testBatchAllocation();
+  testAlignedAllocation();
+  testUnsizedDeallocation();
+  testReallocation();
+  testStlAllocator();
+  testObjectPool();
+  testArena();
+  testHeap();
+  testStats();
+  testHeapProfiler();
+  testLockProfiler();
+  testHeapWalk();
+  testLatencyStats();
+  testGuardedPool();
+  testTraceRecorder();
+  testForkSafety();
+  testReserve();
+  testMemoryPressure();
+  testRealTime();
 }
\ No newline at end of file
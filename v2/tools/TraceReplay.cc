@@ -0,0 +1,391 @@
+// 重放TraceRecorder记录的分配轨迹 报告耗时、RSS峰值与碎片
+//
+// 用法: trace_replay [--allocator v2|system] [--relaxed] [--json 输出文件]
+//                    轨迹文件
+// 默认严格按记录的全局时间顺序执行, 各线程轮流前进, 得到与原程序相同的交错
+// --relaxed只保证跨线程释放发生在对应的分配之后, 线程间可并发执行
+// 每次运行只重放一种分配器 RSS才不会相互影响
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "MemoryPool.h"
+#include "TraceRecorder.h"
+
+using namespace memory_pool;
+
+namespace {
+enum ReplayKind : uint8_t { REPLAY_ALLOCATE, REPLAY_FREE, REPLAY_REALLOCATE };
+
+constexpr uint32_t NO_OBJECT = UINT32_MAX;
+
+// 一次待重放的操作 对象编号代替原始地址
+struct ReplayOp {
+  uint64_t seq;  // 全局顺序
+  uint32_t object;
+  uint32_t oldObject;  // reallocate的原对象
+  uint64_t size;
+  uint32_t align;
+  ReplayKind kind;
+};
+
+struct Replay {
+  std::vector<std::vector<ReplayOp>> threads;
+  std::vector<uint64_t> objectSizes;
+  std::vector<uint32_t> objectAligns;
+  uint64_t ops = 0;
+  uint64_t peakLiveBytes = 0;  // 请求字节数的峰值
+  uint64_t peakSeq = 0;        // 达到峰值的操作
+  uint64_t skippedFrees = 0;   // 记录开始前分配的对象
+};
+
+// 按时间顺序把地址换成对象编号 地址复用时得到新的编号
+Replay buildReplay(const std::vector<TraceEvent>& events) {
+  Replay replay;
+  std::unordered_map<uint64_t, uint32_t> live;
+  std::vector<uint32_t> pendingRealloc;  // 每个线程待配对的REALLOC_FROM
+  uint64_t liveBytes = 0;
+
+  auto newObject = [&](uint64_t address, uint64_t size, size_t align) {
+    uint32_t object = replay.objectSizes.size();
+    replay.objectSizes.push_back(size);
+    replay.objectAligns.push_back(align);
+    live[address] = object;
+    liveBytes += size;
+    return object;
+  };
+  auto freeObject = [&](uint64_t address) {
+    auto it = live.find(address);
+    if (it == live.end()) return NO_OBJECT;
+    uint32_t object = it->second;
+    live.erase(it);
+    liveBytes -= replay.objectSizes[object];
+    return object;
+  };
+
+  for (const TraceEvent& event : events) {
+    if (event.thread >= replay.threads.size()) {
+      replay.threads.resize(event.thread + 1);
+      pendingRealloc.resize(event.thread + 1, NO_OBJECT);
+    }
+    ReplayOp op = {replay.ops, NO_OBJECT, NO_OBJECT, event.size,
+                   static_cast<uint32_t>(event.align), REPLAY_ALLOCATE};
+    switch (event.op) {
+      case TRACE_ALLOCATE:
+        op.object = newObject(event.object, event.size, event.align);
+        break;
+      case TRACE_FREE:
+        op.kind = REPLAY_FREE;
+        op.object = freeObject(event.object);
+        if (op.object == NO_OBJECT) {
+          replay.skippedFrees++;
+          continue;
+        }
+        break;
+      case TRACE_REALLOC_FROM:
+        pendingRealloc[event.thread] = freeObject(event.object);
+        continue;
+      case TRACE_REALLOC_TO:
+        // 原对象在记录开始前分配时 当作一次新的分配
+        op.oldObject = pendingRealloc[event.thread];
+        pendingRealloc[event.thread] = NO_OBJECT;
+        if (op.oldObject != NO_OBJECT) op.kind = REPLAY_REALLOCATE;
+        op.object = newObject(event.object, event.size, 0);
+        break;
+    }
+    replay.threads[event.thread].push_back(op);
+    if (liveBytes > replay.peakLiveBytes) {
+      replay.peakLiveBytes = liveBytes;
+      replay.peakSeq = replay.ops;
+    }
+    replay.ops++;
+  }
+  return replay;
+}
+
+struct ReplayAllocator {
+  const char* name;
+  void* (*allocate)(size_t size, size_t align);
+  void (*deallocate)(void* ptr, size_t size, size_t align);
+  void* (*reallocate)(void* ptr, size_t oldSize, size_t newSize);
+  bool heapReport;  // 可用MemoryPool::walkHeap分析碎片
+};
+
+const ReplayAllocator ALLOCATORS[] = {
+    {"v2",
+     [](size_t size, size_t align) {
+       return align ? MemoryPool::allocateAligned(size, align)
+                    : MemoryPool::allocate(size);
+     },
+     [](void* ptr, size_t size, size_t align) {
+       if (align) {
+         MemoryPool::deallocateAligned(ptr, size, align);
+       } else {
+         MemoryPool::deallocate(ptr, size);
+       }
+     },
+     [](void* ptr, size_t oldSize, size_t newSize) {
+       return MemoryPool::reallocate(ptr, oldSize, newSize);
+     },
+     true},
+    {"system",
+     [](size_t size, size_t align) -> void* {
+       if (!align) return malloc(size);
+       void* ptr = nullptr;
+       return posix_memalign(&ptr, std::max(align, sizeof(void*)), size) == 0
+                  ? ptr
+                  : nullptr;
+     },
+     [](void* ptr, size_t, size_t) { free(ptr); },
+     [](void* ptr, size_t, size_t newSize) { return realloc(ptr, newSize); },
+     false},
+};
+
+// 分配失败时后续的释放无法进行 直接退出
+void* checked(void* ptr) {
+  if (!ptr) {
+    fprintf(stderr, "allocation failed during replay\n");
+    exit(1);
+  }
+  return ptr;
+}
+
+long residentBytes() {
+  FILE* in = fopen("/proc/self/statm", "r");
+  if (!in) return 0;
+  long size = 0, resident = 0;
+  if (fscanf(in, "%ld %ld", &size, &resident) != 2) resident = 0;
+  fclose(in);
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+// 活跃字节达到峰值时的内存状态
+struct PeakSnapshot {
+  long rssBytes;  // 相对重放开始前
+  bool hasHeap;   // 只有v2有堆报告
+  size_t spanBytes;
+  size_t wastedBytes;  // 大小类span中的尾部与空闲块
+  double externalFragmentation;
+};
+
+struct ReplayResult {
+  double seconds;
+  long peakRssBytes;  // 相对重放开始前
+  PeakSnapshot peak;
+};
+
+ReplayResult runReplay(const Replay& replay, const ReplayAllocator& alloc,
+                       bool relaxed) {
+  using clock = std::chrono::steady_clock;
+  size_t objects = replay.objectSizes.size();
+  std::vector<std::atomic<void*>> ptrs(objects);
+  std::atomic<uint64_t> turn{0};
+  std::atomic<bool> go{false};
+  std::atomic<bool> done{false};
+  std::atomic<long> peakRss{0};
+  std::atomic<long> snapshotNs{0};
+  long baseRss = residentBytes();
+  ReplayResult result = {};
+
+  auto waitFor = [](auto ready) {
+    for (int spins = 0; !ready(); spins++) {
+      if (spins >= 64) std::this_thread::yield();
+    }
+  };
+  auto takeSnapshot = [&] {
+    auto start = clock::now();
+    PeakSnapshot& peak = result.peak;
+    peak.rssBytes = residentBytes() - baseRss;
+    if (alloc.heapReport) {
+      HeapReport report = MemoryPool::walkHeap();
+      peak.hasHeap = true;
+      for (const SizeClassFragmentation& cls : report.sizeClasses) {
+        peak.spanBytes += cls.spanBytes;
+        peak.wastedBytes += cls.tailBytes + cls.freeBytes;
+      }
+      peak.externalFragmentation = report.externalFragmentation;
+    }
+    snapshotNs.store(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() -
+                                                             start)
+            .count());
+  };
+
+  auto worker = [&](const std::vector<ReplayOp>& ops) {
+    while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+    for (const ReplayOp& op : ops) {
+      if (relaxed) {
+        if (op.kind != REPLAY_ALLOCATE) {
+          uint32_t object =
+              op.kind == REPLAY_FREE ? op.object : op.oldObject;
+          waitFor([&] {
+            return ptrs[object].load(std::memory_order_acquire) != nullptr;
+          });
+        }
+      } else {
+        waitFor([&] {
+          return turn.load(std::memory_order_acquire) == op.seq;
+        });
+      }
+      switch (op.kind) {
+        case REPLAY_ALLOCATE: {
+          void* ptr = checked(alloc.allocate(op.size, op.align));
+          memset(ptr, 0, std::min<size_t>(op.size, 64));
+          ptrs[op.object].store(ptr, std::memory_order_release);
+          break;
+        }
+        case REPLAY_FREE:
+          // 释放后置空 结束时仍非空的就是轨迹中未释放的对象
+          alloc.deallocate(ptrs[op.object].exchange(nullptr),
+                           replay.objectSizes[op.object],
+                           replay.objectAligns[op.object]);
+          break;
+        case REPLAY_REALLOCATE: {
+          void* ptr = checked(
+              alloc.reallocate(ptrs[op.oldObject].exchange(nullptr),
+                               replay.objectSizes[op.oldObject], op.size));
+          ptrs[op.object].store(ptr, std::memory_order_release);
+          break;
+        }
+      }
+      if (op.seq == replay.peakSeq) takeSnapshot();
+      if (!relaxed) turn.store(op.seq + 1, std::memory_order_release);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (const std::vector<ReplayOp>& ops : replay.threads) {
+    threads.emplace_back(worker, std::cref(ops));
+  }
+  std::thread sampler([&] {
+    while (!done.load(std::memory_order_relaxed)) {
+      long rss = residentBytes() - baseRss;
+      if (rss > peakRss.load()) peakRss.store(rss);
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+  });
+  auto start = clock::now();
+  go.store(true, std::memory_order_release);
+  for (std::thread& thread : threads) thread.join();
+  auto elapsed = clock::now() - start;
+  done.store(true);
+  sampler.join();
+
+  result.seconds =
+      std::chrono::duration<double>(elapsed).count() - snapshotNs.load() / 1e9;
+  result.peakRssBytes = std::max(peakRss.load(), result.peak.rssBytes);
+  // 轨迹结束时仍存活的对象 在计时之外释放
+  for (size_t i = 0; i < objects; i++) {
+    void* ptr = ptrs[i].load(std::memory_order_relaxed);
+    if (ptr) {
+      alloc.deallocate(ptr, replay.objectSizes[i], replay.objectAligns[i]);
+    }
+  }
+  return result;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  const ReplayAllocator* alloc = &ALLOCATORS[0];
+  bool relaxed = false;
+  const char* jsonPath = nullptr;
+  const char* tracePath = nullptr;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--allocator" && i + 1 < argc) {
+      std::string name = argv[++i];
+      alloc = nullptr;
+      for (const ReplayAllocator& candidate : ALLOCATORS) {
+        if (name == candidate.name) alloc = &candidate;
+      }
+    } else if (arg == "--relaxed") {
+      relaxed = true;
+    } else if (arg == "--json" && i + 1 < argc) {
+      jsonPath = argv[++i];
+    } else if (!tracePath && arg[0] != '-') {
+      tracePath = argv[i];
+    } else {
+      alloc = nullptr;
+    }
+  }
+  if (!alloc || !tracePath) {
+    fprintf(stderr,
+            "usage: %s [--allocator v2|system] [--relaxed] [--json out.json] "
+            "trace\n",
+            argv[0]);
+    return 2;
+  }
+
+  Replay replay;
+  {
+    std::vector<TraceEvent> events;
+    if (!TraceRecorder::load(tracePath, &events)) {
+      fprintf(stderr, "%s: cannot read trace\n", tracePath);
+      return 1;
+    }
+    replay = buildReplay(events);
+  }
+  ReplayResult result = runReplay(replay, *alloc, relaxed);
+  const PeakSnapshot& peak = result.peak;
+  // 峰值时RSS超出活跃字节的部分 包括分配器元数据、缓存与碎片
+  double overhead =
+      replay.peakLiveBytes
+          ? static_cast<double>(peak.rssBytes) / replay.peakLiveBytes - 1
+          : 0;
+  double waste = peak.spanBytes
+                     ? static_cast<double>(peak.wastedBytes) / peak.spanBytes
+                     : 0;
+
+  printf("allocator %s, %s replay of %s\n", alloc->name,
+         relaxed ? "relaxed" : "strict", tracePath);
+  printf("threads %zu, ops %llu, objects %zu, skipped frees %llu\n",
+         replay.threads.size(), static_cast<unsigned long long>(replay.ops),
+         replay.objectSizes.size(),
+         static_cast<unsigned long long>(replay.skippedFrees));
+  printf("time %.3f s, %.1f ns/op\n", result.seconds,
+         replay.ops ? result.seconds * 1e9 / replay.ops : 0);
+  printf("peak live %.2f MB, peak rss %.2f MB, rss at peak live %.2f MB "
+         "(overhead %.1f%%)\n",
+         replay.peakLiveBytes / 1048576.0, result.peakRssBytes / 1048576.0,
+         peak.rssBytes / 1048576.0, overhead * 100);
+  if (peak.hasHeap) {
+    printf("size class waste %.1f%% of %.2f MB, external fragmentation %.3f\n",
+           waste * 100, peak.spanBytes / 1048576.0,
+           peak.externalFragmentation);
+  }
+
+  if (jsonPath) {
+    FILE* out = fopen(jsonPath, "w");
+    if (!out) {
+      perror(jsonPath);
+      return 1;
+    }
+    fprintf(out,
+            "{\"allocator\":\"%s\",\"mode\":\"%s\",\"threads\":%zu,"
+            "\"ops\":%llu,\"objects\":%zu,\"seconds\":%.6f,"
+            "\"peak_live_bytes\":%llu,\"peak_rss_bytes\":%ld,"
+            "\"rss_at_peak_live_bytes\":%ld,\"overhead\":%.4f",
+            alloc->name, relaxed ? "relaxed" : "strict",
+            replay.threads.size(), static_cast<unsigned long long>(replay.ops),
+            replay.objectSizes.size(), result.seconds,
+            static_cast<unsigned long long>(replay.peakLiveBytes),
+            result.peakRssBytes, peak.rssBytes, overhead);
+    if (peak.hasHeap) {
+      fprintf(out,
+              ",\"size_class_waste\":%.4f,\"external_fragmentation\":%.4f",
+              waste, peak.externalFragmentation);
+    }
+    fprintf(out, "}\n");
+    fclose(out);
+  }
+  return 0;
+}